@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// AsyncReader keeps several positional reads against file descriptors in
+// flight at once. It's backed by io_uring when llama is built with liburing
+// and the kernel allows it, and by a shared pool of pread() threads otherwise.
+//
+// Each worker thread queues its reads on its own AsyncReader, via
+// AsyncReader::local(). Its methods are thread-safe all the same, so that
+// another thread can wait out reads it didn't queue, e.g., when it closes
+// a stream opened elsewhere.
+class AsyncReader {
+public:
+  virtual ~AsyncReader() {}
+
+  // Queues a read of up to len bytes at offset into buf, which must stay
+  // alive until wait() has been called with the returned ticket.
+  virtual uint64_t submit(int fd, uint64_t offset, uint8_t* buf, size_t len) = 0;
+
+  // Blocks until the read for ticket completes. Returns the number of bytes
+  // read, or -1 on error.
+  virtual int64_t wait(uint64_t ticket) = 0;
+
+  virtual const char* name() const = 0;
+
+  // io_uring if available, otherwise the thread pool
+  static std::unique_ptr<AsyncReader> create(unsigned queueDepth);
+
+  static std::unique_ptr<AsyncReader> createThreadPool(unsigned queueDepth);
+
+  // the calling thread's reader, created on first use; it lives on after
+  // the thread for as long as it's shared
+  static std::shared_ptr<AsyncReader> local(unsigned queueDepth);
+};
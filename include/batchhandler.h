@@ -1,8 +1,10 @@
 #include "inputhandler.h"
 
+#include <chrono>
 #include <memory>
 #include <vector>
 
+#include "batchsizer.h"
 #include "direntbatch.h"
 #include "duckinode.h"
 #include "readseek.h"
@@ -24,9 +26,16 @@ public:
   virtual void maybeFlush() override; // flushes only if the batch is full
   virtual void flush() override; // always flushes
 
+  // another batcher for the same scheduler
+  virtual std::shared_ptr<InputHandler> fork() override;
+
 private:
   std::shared_ptr<FileScheduler> Sink;
 
+  BatchSizer Sizer;
+  const std::chrono::steady_clock::time_point Start;
+  uint64_t CurBytes;
+
   std::unique_ptr<DirentBatch> CurDents;
   std::unique_ptr<InodeBatch>  CurInodes;
   std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>> CurStreams;
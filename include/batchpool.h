@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// BatchPool recycles batches, so that a batch's buffers keep their
+// capacity from one use to the next rather than being reallocated. The
+// thread which fills a batch takes it from the pool, and the one which
+// empties it gives it back.
+template <class T>
+class BatchPool {
+public:
+  explicit BatchPool(size_t maxKept): MaxKept(maxKept), Mutex(), Kept() {}
+
+  BatchPool(const BatchPool&) = delete;
+
+  // batches waiting to be reused
+  size_t kept() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Kept.size();
+  }
+
+  // returns an empty batch, a recycled one if there is any
+  std::unique_ptr<T> take() {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (!Kept.empty()) {
+        std::unique_ptr<T> ret(std::move(Kept.back()));
+        Kept.pop_back();
+        return ret;
+      }
+    }
+    return std::make_unique<T>();
+  }
+
+  // empties batch and keeps it for reuse, unless enough are kept already
+  void give(std::unique_ptr<T> batch) {
+    batch->clear();
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Kept.size() < MaxKept) {
+      Kept.push_back(std::move(batch));
+    }
+  }
+
+private:
+  const size_t MaxKept;
+
+  mutable std::mutex Mutex;
+  std::vector<std::unique_ptr<T>> Kept;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// BatchSizer decides when BatchHandler should cut a batch. A batch is
+// sized to take about TargetSeconds to process, in files and in bytes, at
+// the throughput observed so far, so that batches arrive at a steady pace
+// whether they hold empty files or huge ones.
+class BatchSizer {
+public:
+  static constexpr size_t MIN_FILES = 100;
+  static constexpr size_t MAX_FILES = 50000;
+  static constexpr size_t INITIAL_FILES = 5000;
+
+  static constexpr uint64_t MIN_BYTES = uint64_t(4) << 20;
+  static constexpr uint64_t MAX_BYTES = uint64_t(4) << 30;
+  static constexpr uint64_t INITIAL_BYTES = uint64_t(256) << 20;
+
+  // throughput is sampled at most this often, in seconds
+  static constexpr double MIN_SAMPLE_INTERVAL = 0.1;
+
+  explicit BatchSizer(double targetSeconds = 2.0);
+
+  // Updates the throughput estimate, given the cumulative bytes and files
+  // processed as of now, in seconds
+  void observe(uint64_t bytesDone, uint64_t filesDone, double now);
+
+  size_t maxFiles() const { return MaxFiles; }
+  uint64_t maxBytes() const { return MaxBytes; }
+
+  // whether a batch should be cut at the next directory boundary
+  bool full(uint64_t bytes, size_t files) const {
+    return bytes >= MaxBytes || files >= MaxFiles;
+  }
+
+  // whether a batch should be cut now, mid-directory
+  bool overfull(uint64_t bytes, size_t files) const {
+    return bytes >= 2 * MaxBytes || files >= 2 * MaxFiles;
+  }
+
+private:
+  const double TargetSeconds;
+
+  bool Started;
+  uint64_t LastBytes, LastFiles;
+  double LastTime;
+
+  double ByteRate, FileRate; // moving averages, per second
+
+  size_t MaxFiles;
+  uint64_t MaxBytes;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// BlockCache keeps the most recently used fixed-size blocks of an image,
+// e.g., decompressed E01 chunks, in memory. Blocks are spread over shards,
+// each with a lock and an LRU list of its own, so threads reading
+// different blocks rarely contend. A cache may be shared by several
+// handles of the same image.
+class BlockCache {
+public:
+  static constexpr size_t NUM_SHARDS = 16;
+  static constexpr size_t DEFAULT_BLOCK_SIZE = 64 << 10;
+
+  // Reads up to len bytes at off from the image into buf, returning the
+  // number read, which is short only at the end of the image, or -1
+  using Fill = std::function<int64_t(uint64_t off, uint8_t* buf, size_t len)>;
+
+  struct Stats {
+    uint64_t Hits = 0;
+    uint64_t Misses = 0; // blocks read from the image
+    uint64_t Evictions = 0;
+  };
+
+  // holds about capacity bytes, and at least a block per shard
+  BlockCache(uint64_t capacity, size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+  BlockCache(const BlockCache&) = delete;
+
+  size_t blockSize() const { return BlockSize; }
+
+  uint64_t capacity() const { return uint64_t(BlocksPerShard) * NUM_SHARDS * BlockSize; }
+
+  // Reads len bytes at off into buf, with fill for the blocks not in the
+  // cache. Returns the number of bytes read, or -1 if fill failed first.
+  int64_t read(uint64_t off, uint8_t* buf, size_t len, const Fill& fill);
+
+  Stats stats() const;
+
+private:
+  using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+  struct Shard {
+    std::mutex Mutex;
+    std::list<std::pair<uint64_t, Data>> Lru; // most recent first
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Data>>::iterator> Index;
+  };
+
+  // returns the block, reading it with fill if need be, or null on error
+  Data block(uint64_t index, const Fill& fill);
+
+  Shard& shardOf(uint64_t index) { return Shards[index % NUM_SHARDS]; }
+
+  const size_t BlockSize;
+  const size_t BlocksPerShard;
+
+  std::array<Shard, NUM_SHARDS> Shards;
+
+  std::atomic<uint64_t> Hits, Misses, Evictions;
+};
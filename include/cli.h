@@ -27,6 +27,10 @@ public:
 private:
   std::string figureOutCommand(const boost::program_options::variables_map& optsMap) const;
   Codec figureOutCodec() const;
+  uint64_t figureOutHashes() const;
+  uint64_t figureOutKnownHashesAlg() const;
+  uint64_t figureOutMemoryLimit() const;
+  uint64_t figureOutImageCacheSize(const boost::program_options::variables_map& optsMap) const;
 
   void validateOpts() const;
 
@@ -35,5 +39,9 @@ private:
 
   std::shared_ptr<Options> Opts;
   std::string CodecSelect;
+  std::string HashesSelect;
+  std::string KnownHashesAlgSelect;
+  std::string MemoryLimitSelect;
+  std::string ImageCacheSelect;
 };
 
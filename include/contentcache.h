@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+// ContentCache remembers which file contents have been searched, so that
+// Processor clones can skip searching duplicates. Content is identified by
+// its BLAKE3 digest. A cheap fingerprint of a file's size and prefix marks
+// files which are worth hashing before they're searched.
+class ContentCache {
+public:
+  using Digest = std::array<uint8_t, 32>;
+
+  static constexpr size_t PREFIX_SIZE = 4096;
+
+  // Returns true if digest wasn't seen before, i.e., if the caller should
+  // go on to search the content
+  bool insert(const Digest& digest);
+
+  bool contains(const Digest& digest) const;
+
+  void addFingerprint(uint64_t fp);
+
+  bool hasFingerprint(uint64_t fp) const;
+
+  size_t size() const;
+
+  static uint64_t fingerprint(uint64_t size, const uint8_t* prefix, size_t len);
+
+private:
+  static constexpr size_t NUM_SHARDS = 64;
+
+  struct DigestHash {
+    size_t operator()(const Digest& d) const;
+  };
+
+  struct Shard {
+    mutable std::mutex Mutex;
+    std::unordered_set<Digest, DigestHash> Digests;
+    std::unordered_set<uint64_t> Fingerprints;
+  };
+
+  Shard& shard(uint64_t key) { return Shards[key % NUM_SHARDS]; }
+  const Shard& shard(uint64_t key) const { return Shards[key % NUM_SHARDS]; }
+
+  std::array<Shard, NUM_SHARDS> Shards;
+};
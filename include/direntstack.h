@@ -11,6 +11,14 @@ class DirentStack {
 public:
   DirentStack(RecordHasher& rh): RecHasher(rh) {}
 
+  // For walking a subtree: the paths of dirents pushed onto the empty
+  // stack start with basePath
+  DirentStack(RecordHasher& rh, const std::string& basePath): Path(basePath), RecHasher(rh) {}
+
+  // For walking another subtree with the same stack: drops any dirents
+  // left, and the paths of those pushed next start with basePath
+  void reset(const std::string& basePath);
+
   bool empty() const;
 
   const Dirent& top() const;
@@ -4,6 +4,7 @@
 
 #include "dirconversion.h"
 #include "direntstack.h"
+#include "fieldhasher.h"
 #include "inputreader.h"
 #include "recordhasher.h"
 
@@ -11,7 +12,7 @@ class InputHandler;
 
 class DirReader: public InputReader {
 public:
-  DirReader(const std::string& path);
+  DirReader(const std::string& path, unsigned int ioQueueDepth = 0);
 
   virtual ~DirReader() {}
 
@@ -24,7 +25,12 @@ public:
   void handleFile(const std::filesystem::directory_entry& de);
 
 private:
+  // stands in for an inode number in the scan cache, so it has to be the
+  // same from one run, and build, to the next
+  uint64_t pathAddr(const std::string& path);
+
   std::string Root;
+  unsigned int IoQueueDepth; // 0 for synchronous reads
 
   std::shared_ptr<InputHandler> Input;
   std::shared_ptr<OutputHandler> Output;
@@ -33,5 +39,8 @@ private:
 
   RecordHasher RecHasher;
   DirentStack Dirents;
+  FieldHasher PathHasher;
+
+  uint64_t NextAddr;
 };
 
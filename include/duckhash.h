@@ -6,13 +6,32 @@
 #include "llamaduck.h"
 
 struct HashRec {
-  void set(SFHASH_HashValues h, uint64_t metaAddr) {
+  // hashes not in algs weren't computed, and are left empty
+  void set(const SFHASH_HashValues& h, uint64_t metaAddr, uint64_t algs) {
     MetaAddr = metaAddr;
-    MD5 = hexEncode(h.Md5, h.Md5 + sizeof(h.Md5));
-    SHA1 = hexEncode(h.Sha1, h.Sha1 + sizeof(h.Sha1));
-    SHA256 = hexEncode(h.Sha2_256, h.Sha2_256 + sizeof(h.Sha2_256));
-    Blake3 = hexEncode(h.Blake3, h.Blake3 + sizeof(h.Blake3));
-    Ssdeep = hexEncode(h.Fuzzy, h.Fuzzy + sizeof(h.Fuzzy));
+    setOne(MD5, algs & SFHASH_MD5, h.Md5, sizeof(h.Md5));
+    setOne(SHA1, algs & SFHASH_SHA_1, h.Sha1, sizeof(h.Sha1));
+    setOne(SHA256, algs & SFHASH_SHA_2_256, h.Sha2_256, sizeof(h.Sha2_256));
+    setOne(Blake3, algs & SFHASH_BLAKE3, h.Blake3, sizeof(h.Blake3));
+    setOne(Ssdeep, algs & SFHASH_FUZZY, h.Fuzzy, sizeof(h.Fuzzy));
+  }
+
+  // the inverse of set(), for hashes which aren't empty
+  void get(SFHASH_HashValues& h) const {
+    hexDecode(MD5, h.Md5, sizeof(h.Md5));
+    hexDecode(SHA1, h.Sha1, sizeof(h.Sha1));
+    hexDecode(SHA256, h.Sha2_256, sizeof(h.Sha2_256));
+    hexDecode(Blake3, h.Blake3, sizeof(h.Blake3));
+    hexDecode(Ssdeep, h.Fuzzy, sizeof(h.Fuzzy));
+  }
+
+  static void setOne(std::string& field, bool computed, const void* hash, size_t len) {
+    if (computed) {
+      field = hexEncode(hash, len);
+    }
+    else {
+      field.clear();
+    }
   }
 
   static constexpr auto ColNames = {"MetaAddr",
@@ -27,6 +27,10 @@ public:
   virtual void populateAttrs(TSK_FS_FILE* /* file */) const override {
   }
 
+  virtual std::optional<uint64_t> firstDataOffset(TSK_FS_FILE* /* file */) const override {
+    return std::nullopt;
+  }
+
   virtual bool walk(
     TSK_IMG_INFO* /* info */,
     std::function<TSK_FILTER_ENUM(const TSK_VS_INFO*)> /* vs_cb */,
@@ -37,6 +41,20 @@ public:
     return true;
   }
 
+  virtual bool walkFs(
+    TSK_IMG_INFO* /* info */,
+    TSK_OFF_T /* off */,
+    TSK_FS_TYPE_ENUM /* type */,
+    std::function<TSK_FILTER_ENUM(TSK_FS_INFO*)> /* fs_cb */,
+    std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)> /* file_cb */) override
+  {
+    return true;
+  }
+
+  virtual bool listDir(TSK_FS_INFO* /* fs */, TSK_INUM_T /* inum */, std::function<void(TSK_FS_FILE*)> /* file_cb */) const override {
+    return true;
+  }
+
   jsoncons::json convertImg(const TSK_IMG_INFO& /* img */) const override {
     return jsoncons::json();
   }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Identifies a file across runs over the same evidence. If any of these
+// differ, the file is treated as a different file.
+struct FileIdentity {
+  uint64_t FsOffset;
+  uint64_t Addr;
+  uint64_t SeqNum;
+  uint64_t Filesize;
+  std::string Modified;
+
+  bool operator==(const FileIdentity& other) const {
+    return FsOffset == other.FsOffset && Addr == other.Addr && SeqNum == other.SeqNum &&
+           Filesize == other.Filesize && Modified == other.Modified;
+  }
+};
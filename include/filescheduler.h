@@ -1,17 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include "boost_asio.h"
 
 #include "llamaduck.h"
+#include "batchpool.h"
 #include "direntbatch.h"
 #include "duckinode.h"
+#include "memorybudget.h"
+#include "readahead.h"
 #include "readseek.h"
+#include "workqueues.h"
 
 struct FileRecord;
 struct Options;
@@ -20,31 +29,153 @@ class Processor;
 
 class FileScheduler {
 public:
+  // Streams of at least LARGE_FILE_SIZE are split into SEGMENT_SIZE pieces
+  // which are searched in parallel, rather than pinning one Processor.
+  static constexpr uint64_t SEGMENT_SIZE = uint64_t(64) << 20;
+  static constexpr uint64_t LARGE_FILE_SIZE = 4 * SEGMENT_SIZE;
+  // hits longer than this may be lost or truncated at segment boundaries
+  static constexpr uint64_t SEGMENT_OVERLAP = 1 << 20;
+  // Up to this many segments of a large file are read at once, and held
+  // until hashed, since the hashes take them in order. Large files are
+  // split one per this many workers at a time.
+  static constexpr size_t SEGMENTS_IN_FLIGHT = 4;
+
+  // Scheduling waits while this many files per worker are queued
+  static constexpr size_t MAX_QUEUED_PER_WORKER = 5000;
+  // A busy worker flushes its Processor after this many files
+  static constexpr size_t FLUSH_FILES = 5000;
+
+  // Each read-ahead thread has this many buffers of READ_AHEAD_BLOCK bytes
+  static constexpr size_t READ_AHEAD_BUFFERS = 16;
+  static constexpr size_t READ_AHEAD_BLOCK = 1 << 20;
+  // Read-ahead waits while this many streams per worker await a worker
+  static constexpr size_t MAX_READY_PER_WORKER = 2;
+
+  // what a queued file is charged to the memory budget, its stream and
+  // path, roughly
+  static constexpr uint64_t STREAM_BYTES = 512;
+
+  // ingested batches kept for reuse, of each kind
+  static constexpr size_t MAX_POOLED_BATCHES = 4;
+
   FileScheduler(LlamaDB& db, boost::asio::thread_pool& pool,
                 const std::shared_ptr<Processor>& protoProc,
                 const std::shared_ptr<Options>& opts);
 
-  void scheduleFileBatch(const DirentBatch& dirents,
-                         const InodeBatch& inodes,
+  ~FileScheduler();
+
+  // Empty batches to fill and pass to scheduleFileBatch(); these are
+  // recycled once their contents are ingested
+  std::unique_ptr<DirentBatch> newDirentBatch() { return DirentBatches.take(); }
+  std::unique_ptr<InodeBatch> newInodeBatch() { return InodeBatches.take(); }
+
+  // Takes over the batches, rather than copying them. Waits, on the
+  // caller's thread, while the memory budget is spent or the workers'
+  // queues are full, which keeps the reader from getting too far ahead
+  // of the pipeline.
+  void scheduleFileBatch(std::unique_ptr<DirentBatch> dirents,
+                         std::unique_ptr<InodeBatch> inodes,
                          const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams);
 
+  // Call once every batch is scheduled, so the read-ahead threads can
+  // exit, letting the pool finish, once they've read everything
+  void finish();
+
   double getProcessorTime();
 
+  // shared with the input, which charges what it holds
+  const std::shared_ptr<MemoryBudget>& memoryBudget() const { return Budget; }
+
+  // The order in which a stream is taken from the queues, highest first:
+  // by ascending disk offset with diskOrder, and by descending size without
+  static uint64_t priority(const ReadSeek& stream, bool diskOrder);
+
 private:
-  void performScheduling(DirentBatch& dirents,
-                         InodeBatch& inodes,
-                         const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams);
+  // deals a batch's files out to the workers' queues, on Strand
+  void performScheduling(const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams);
+
+  // appends a batch's dirents and inodes to their tables, on IngestStrand,
+  // then gives back the memory they were charged
+  void ingestEntries(DirentBatch& dirents, InodeBatch& inodes, uint64_t charged);
+
+  // Processes queued segments and files with Workers[w]'s Processor until
+  // there are none left in any queue
+  void runWorker(size_t w);
+  // leaves stream empty if it was handed to a large file's job
+  void processStream(Processor& proc, std::unique_ptr<ReadSeek>& stream);
+
+  // takes a segment of a large file to search, before any file
+  bool takeSegment(std::function<void()>& task);
+  // takes a file for worker w, from the queues or from read-ahead
+  bool takeFile(size_t w, std::unique_ptr<ReadSeek>& stream);
+  // posts idle workers if there are files for them, under WorkerMutex
+  void wakeWorkers();
+  // wakes the readers, if they're waiting, after a file leaves the queues
+  void madeRoom();
+
+  // Takes files from the queues, opens them, and hands them to the
+  // workers, reading ahead of them with ReadBuffers[r], until finish()
+  void runReader(size_t r);
+  // returns stream to be read ahead by fill, or as it is if fill is unset
+  std::unique_ptr<ReadSeek> readAhead(size_t r, std::unique_ptr<ReadSeek> stream, std::function<void()>& fill);
 
-  std::shared_ptr<Processor> popProc();
-  void pushProc(const std::shared_ptr<Processor>& proc);
+  struct LargeFileJob;
+
+  // Queues the segments of an open stream for the workers, who search
+  // them and pass them to the file's hasher in order; the last one hashed
+  // records the file. Returns false, leaving stream alone, if it can't be
+  // read from several threads, or if too many large files are in flight
+  // and none of their segments is left for this thread to help with.
+  bool processLargeFile(std::unique_ptr<ReadSeek>& stream);
+  // queues the job's segments which may be read before the hashes catch up
+  void queueSegments(const std::shared_ptr<LargeFileJob>& job);
+  // hashes the segments read, in order, unless another thread is at it
+  void hashSegments(const std::shared_ptr<LargeFileJob>& job, size_t i, std::vector<uint8_t>&& data);
+  void finishLargeFile(LargeFileJob& job);
+
+  // shared with the workers' Processors; the read-ahead buffers are set
+  // aside from the limit up front
+  std::shared_ptr<MemoryBudget> Budget;
+
+  BatchPool<DirentBatch> DirentBatches;
+  BatchPool<InodeBatch> InodeBatches;
 
   LlamaDBConnection DBConn;
+  LlamaDBAppender DirentAppender;
+  LlamaDBAppender InodeAppender;
 
   boost::asio::thread_pool& Pool;
+  boost::asio::strand<boost::asio::thread_pool::executor_type> IngestStrand;
   boost::asio::strand<boost::asio::thread_pool::executor_type> Strand;
 
-  std::vector<std::shared_ptr<Processor>> Processors;
+  // Each worker owns a Processor, and is running on the pool only while
+  // there are files queued.
+  std::vector<std::shared_ptr<Processor>> Workers;
+  WorkQueues<std::unique_ptr<ReadSeek>> Files;
+  size_t NextQueue; // where the next file is queued, on the strand
+  const bool DiskOrder;
+
+  std::mutex WorkerMutex;
+  std::vector<bool> Active; // under WorkerMutex
+  std::condition_variable RoomCV; // signaled once the queues have room
+  std::atomic<size_t> RoomWaiters; // readers waiting on RoomCV
+  size_t Unscheduled; // files posted to Strand, not yet queued, under WorkerMutex
+
+  // With read-ahead, I/O threads take from Files and the workers from
+  // Ready. The pool is kept running until the I/O threads are done.
+  std::vector<std::unique_ptr<BufferPool>> ReadBuffers;
+  std::deque<std::unique_ptr<ReadSeek>> Ready; // under WorkerMutex
+  std::condition_variable ReaderCV; // files queued, room in Ready, or input done
+  bool InputDone; // under WorkerMutex
+  bool Stopping; // under WorkerMutex
+  size_t ReadersRunning; // under WorkerMutex
+  std::optional<boost::asio::executor_work_guard<boost::asio::thread_pool::executor_type>> PoolGuard;
+  std::vector<std::thread> Readers;
 
-  std::mutex ProcMutex;
-  std::condition_variable ProcCV;
+  std::shared_ptr<Processor> LargeProc; // records large files, under LargeProcMutex
+  std::mutex LargeProcMutex;
+  const size_t MaxLargeJobs;
+  size_t LargeJobs; // in flight, under WorkerMutex
+  std::deque<std::function<void()>> Segments; // under WorkerMutex
+  std::atomic<size_t> SegmentsQueued; // Segments.size(), to check without the lock
 };
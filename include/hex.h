@@ -5,3 +5,6 @@
 std::string hexEncode(const void* buf, size_t size);
 
 std::string hexEncode(const void* beg, const void* end);
+
+// Decodes exactly size bytes into buf; false if hex isn't that long, or isn't hex
+bool hexDecode(const std::string& hex, void* buf, size_t size);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <lightgrep/search_hit.h>
+
+class LlamaParser;
+struct Node;
+struct Rule;
+
+// HitNeeds works out, from the grep conditions of the rules, when the hits
+// found so far in a file already decide every condition, so that further
+// hits couldn't change any rule's result and the search can stop.
+//
+// Conditions over the presence or number of hits (any, all, count, and
+// count_has_hits) are decided as soon as the counts allow. offset(p) and
+// length(p) ask whether any hit qualifies, and are decided once one does.
+// The nth-occurrence forms, offset(p, n) and length(p, n), are never
+// decided early, since lightgrep doesn't report hits in order of offset.
+// Hits only ever make any, all, offset, and length true, and some counts
+// only false, so an AND is decided early only if a side can become false
+// or both true, and an OR the other way around.
+class HitNeeds {
+public:
+  // The hits of one file
+  class State {
+  public:
+    bool settled() const { return Unsettled == 0; }
+
+  private:
+    friend class HitNeeds;
+
+    std::vector<uint64_t> Counts; // by pattern
+    std::vector<bool> Qualified; // by offset or length condition
+    std::vector<bool> Settled; // by rule
+    size_t Unsettled = 0;
+  };
+
+  // keywordPatterns gives the rule index and pattern name of each
+  // lightgrep keyword index
+  HitNeeds(const std::vector<Rule>& rules, const LlamaParser& parser,
+           const std::vector<std::pair<size_t, std::string_view>>& keywordPatterns);
+
+  // Whether every rule can be decided before the end of a file; if not,
+  // there's no point in tracking hits
+  bool canSettle() const;
+
+  // Readies state for a new file
+  void reset(State& state) const;
+
+  // Counts a hit, returning true once no rule's result can change
+  bool addHit(State& state, const LG_SearchHit& hit) const;
+
+private:
+  enum class Truth {
+    FALSE,
+    TRUE,
+    UNKNOWN
+  };
+
+  struct Cond {
+    enum Kind {
+      AND,
+      OR,
+      ANY,
+      ALL,
+      COUNT,
+      COUNT_HAS_HITS,
+      OFFSET,
+      LENGTH,
+      NEVER
+    };
+
+    Kind Type;
+    std::vector<size_t> Patterns;
+    uint64_t Op = 0;
+    uint64_t Value = 0;
+    size_t Left = 0, Right = 0; // for AND and OR
+    size_t Qualifier = SIZE_MAX; // for OFFSET and LENGTH, into State::Qualified
+  };
+
+  size_t compile(const std::shared_ptr<Node>& node, const LlamaParser& parser, const std::vector<size_t>& rulePatterns,
+                 const std::vector<std::string_view>& ruleNames);
+
+  Truth eval(const State& state, size_t cond) const;
+
+  // whether a condition can become true, or false, before the end of a
+  // file, as more hits are found
+  struct Reach {
+    bool True;
+    bool False;
+  };
+
+  Reach reach(size_t cond) const;
+
+  void settle(State& state, size_t rule) const;
+
+  std::vector<Cond> Conds;
+  std::vector<size_t> RuleRoots; // by rule, NO_COND if the rule has no condition
+  std::vector<bool> RuleGreps; // by rule, whether it has patterns
+  std::vector<size_t> KeywordPattern; // by keyword index
+  std::vector<size_t> PatternRule; // by pattern
+  std::vector<std::vector<size_t>> PatternQualifiers; // by pattern, its OFFSET and LENGTH conditions
+  size_t NumQualifiers = 0;
+  State Initial;
+
+  static constexpr size_t NO_COND = SIZE_MAX;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// InodeClaims records which inodes of a file system have been seen, so
+// that each is recorded once, by whichever walk reaches it first, when
+// several threads walk parts of the file system.
+class InodeClaims {
+public:
+  // tracks the inodes in [first, end)
+  InodeClaims(uint64_t first, uint64_t end):
+    First(first), End(end), Words(new std::atomic<uint64_t>[(end - first + 63) / 64])
+  {
+    for (uint64_t i = 0; i < (End - First + 63) / 64; ++i) {
+      Words[i] = 0;
+    }
+  }
+
+  InodeClaims(const InodeClaims&) = delete;
+
+  // true only the first time inum is claimed; inodes out of range can't
+  // be tracked, so are always claimed
+  bool claim(uint64_t inum) {
+    if (inum < First || inum >= End) {
+      return true;
+    }
+    const uint64_t i = inum - First;
+    const uint64_t bit = uint64_t(1) << (i % 64);
+    return !(Words[i / 64].fetch_or(bit, std::memory_order_relaxed) & bit);
+  }
+
+private:
+  const uint64_t First, End;
+  std::unique_ptr<std::atomic<uint64_t>[]> Words;
+};
@@ -16,4 +16,8 @@ public:
 
   virtual void maybeFlush() = 0;
   virtual void flush() = 0;
+
+  // Returns a handler with the same destination, for another thread to
+  // push to, or null if this handler can't be shared that way
+  virtual std::shared_ptr<InputHandler> fork() { return nullptr; }
 };
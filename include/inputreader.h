@@ -4,7 +4,9 @@
 #include <string>
 
 class InputHandler;
+class MemoryBudget;
 class OutputHandler;
+struct Options;
 
 class InputReader {
 public:
@@ -13,6 +15,9 @@ public:
   virtual void setOutputHandler(const std::shared_ptr<OutputHandler>& out) = 0;
   virtual bool startReading() = 0;
 
-  static std::shared_ptr<InputReader> createTSK(const std::string& imgName);
-  static std::shared_ptr<InputReader> createDir(const std::string& dirPath);
+  // for charging what the reader holds open, if it does
+  virtual void setMemoryBudget(const std::shared_ptr<MemoryBudget>&) {}
+
+  static std::shared_ptr<InputReader> createTSK(const std::string& imgName, const Options& opts);
+  static std::shared_ptr<InputReader> createDir(const std::string& dirPath, const Options& opts);
 };
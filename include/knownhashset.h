@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <hasher/api.h>
+
+// KnownHashSet holds the digests of known files, e.g., an NSRL hash set,
+// for one hash algorithm. On disk it's a header, a bloom filter, and then
+// the sorted digests, so it's memory-mapped and used without any parsing.
+// Most unknown digests are turned away by the bloom filter; the rest are
+// looked up in the sorted digests.
+class KnownHashSet {
+public:
+  explicit KnownHashSet(const std::string& path);
+
+  KnownHashSet(const KnownHashSet&) = delete;
+  KnownHashSet& operator=(const KnownHashSet&) = delete;
+
+  SFHASH_HashAlgorithm algorithm() const { return Alg; }
+  uint64_t size() const { return NumDigests; }
+
+  bool contains(const uint8_t* digest) const;
+  bool contains(const SFHASH_HashValues& h) const;
+
+  // Writes digests, each digestSize(alg) bytes long and back to back, as a
+  // set file. Duplicates are dropped. Returns the number of digests written.
+  static uint64_t write(const std::string& path, SFHASH_HashAlgorithm alg, const std::vector<uint8_t>& digests);
+
+  // Writes the hex digests in a text file, one per line, as a set file.
+  // Lines which aren't a digest of the right length are skipped.
+  static uint64_t writeFromHexFile(const std::string& path, SFHASH_HashAlgorithm alg, const std::string& hexPath);
+
+  // 0 for algorithms which can't be used, i.e., fuzzy hashes
+  static size_t digestSize(SFHASH_HashAlgorithm alg);
+
+private:
+  struct Mapping {
+    Mapping(const std::string& path);
+    ~Mapping();
+
+    const uint8_t* Data;
+    size_t Len;
+    std::vector<uint8_t> Owned; // file contents where mmap() isn't available
+  };
+
+  bool bloomContains(const uint8_t* digest) const;
+
+  Mapping File;
+
+  SFHASH_HashAlgorithm Alg;
+  size_t DigestSize;
+  uint64_t NumDigests;
+  uint64_t BloomBits; // a power of two
+  uint32_t BloomHashes;
+
+  const uint8_t* Bloom;
+  const uint8_t* Digests;
+};
@@ -27,18 +27,40 @@ struct RuleMatch {
   uint64_t addr;
 };
 
+// one row per lightgrep keyword index, which search hits refer to
+struct PatternRec {
+  static constexpr auto ColNames = {"id",
+                                    "pattern",
+                                    "encoding",
+                                    "rule_id"};
+
+  uint64_t Id;
+  std::string Pattern;
+  std::string Encoding;
+  std::string RuleId;
+};
+
 struct SearchHit {
-  static constexpr auto ColNames = {"pattern",
+  static constexpr auto ColNames = {"pattern_id",
                                     "start_offset",
                                     "end_offset",
-                                    "rule_id",
                                     "file_hash",
                                     "length"};
   
-  std::string pattern;
+  uint64_t pattern_id; // patterns.id
   uint64_t start_offset;
   uint64_t end_offset;
-  std::string rule_id;
   std::string file_hash;
   uint64_t length;
+};
+
+// the number of hits dropped for a pattern in a file by the hit limits
+struct SearchHitOverflow {
+  static constexpr auto ColNames = {"pattern_id",
+                                    "file_hash",
+                                    "dropped"};
+
+  uint64_t pattern_id; // patterns.id
+  std::string file_hash;
+  uint64_t dropped;
 };
\ No newline at end of file
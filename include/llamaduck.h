@@ -177,6 +177,9 @@ template<typename T>
 struct DBBatch {
   size_t size() const { return NumRows; }
 
+  // the memory used by the rows, roughly
+  size_t bytes() const { return Buf.size() + OffsetVals.size() * sizeof(uint64_t); }
+
   std::vector<char>    Buf; // strings stored in sequence here
   std::vector<uint64_t> OffsetVals; // offsets to strings OR uint64_t values
 
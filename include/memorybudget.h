@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// MemoryBudget accounts for the memory held across the pipeline: batches
+// in flight from the reader, the reader's open image handles, the files
+// queued for the workers, and the workers' unflushed DB batches. Producers acquire memory before holding
+// it and wait while the budget is spent; holders release it once freed.
+// A limit of 0 means there is none.
+class MemoryBudget {
+public:
+  explicit MemoryBudget(uint64_t limit);
+
+  MemoryBudget(const MemoryBudget&) = delete;
+
+  uint64_t limit() const { return Limit; }
+  uint64_t used() const;
+
+  // Waits until n bytes fit in the budget, then takes them. Anything fits
+  // when nothing is held, so an oversized request can't wait forever.
+  void acquire(uint64_t n);
+
+  // Takes n bytes without waiting, for memory which is already held
+  void charge(uint64_t n);
+
+  // Gives back n bytes. Giving back more than is held is a bug in the
+  // accounting; the excess is counted in overReleased() rather than
+  // wrapping around.
+  void release(uint64_t n);
+
+  uint64_t overReleased() const;
+
+  // whether holders should give memory back early
+  bool over() const;
+
+private:
+  const uint64_t Limit;
+
+  mutable std::mutex Mutex;
+  std::condition_variable Released;
+  uint64_t Used;
+  uint64_t OverReleased;
+};
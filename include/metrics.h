@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Metrics counts the work done by each stage of the pipeline. Every thread
+// updates a slot of its own, so updates take no locks and share no cache
+// lines; a snapshot sums the slots.
+class Metrics {
+public:
+  enum Counter {
+    FILES,
+    BYTES_READ,
+    READ_ERRORS, // files whose reads failed part way, so were cut short
+    HITS, // kept, not dropped by the hit limits
+    BATCHES_QUEUED,
+    BATCHES_DONE, // dealt out to the workers
+    IMAGE_CACHE_HITS,
+    IMAGE_CACHE_MISSES, // blocks read, and decompressed, from the image
+    NUM_COUNTERS
+  };
+
+  // durations, in nanoseconds
+  enum Histogram {
+    READ_NS, // each read from a stream
+    HASH_NS,
+    SEARCH_NS,
+    INGEST_NS, // appending a batch's inodes and dirents
+    QUEUE_WAIT_NS, // waiting for room in the workers' queues
+    MEMORY_WAIT_NS, // the reader waiting for the memory budget
+    FLUSH_NS, // appending a Processor's batches to DuckDB
+    NUM_HISTOGRAMS
+  };
+
+  // bucket 0 counts zeros, and bucket i > 0 counts values in [2^(i-1), 2^i)
+  static constexpr size_t NUM_BUCKETS = 64;
+
+  struct HistogramSnapshot {
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+    uint64_t Max = 0;
+    std::array<uint64_t, NUM_BUCKETS> Buckets{};
+
+    // an upper bound on the pth percentile, 0 <= p <= 1
+    uint64_t percentile(double p) const;
+  };
+
+  struct Snapshot {
+    std::array<uint64_t, NUM_COUNTERS> Counters{};
+    std::array<HistogramSnapshot, NUM_HISTOGRAMS> Histograms{};
+
+    uint64_t pendingBatches() const { return Counters[BATCHES_QUEUED] - Counters[BATCHES_DONE]; }
+
+    // what happened after earlier; maxima can't be separated, so are kept
+    Snapshot since(const Snapshot& earlier) const;
+  };
+
+  // Times the enclosing scope into a histogram
+  class Latency {
+  public:
+    Latency(Histogram h, Metrics& metrics = Metrics::global()) : Owner(metrics), Hist(h) {}
+
+    ~Latency() {
+      Owner.record(Hist, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - Start
+      ).count());
+    }
+
+  private:
+    Metrics& Owner;
+    Histogram Hist;
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+  };
+
+  // Writes a progress line to out every interval seconds, until destroyed
+  class ProgressReporter {
+  public:
+    ProgressReporter(const Metrics& metrics, std::ostream& out, unsigned int interval);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter&) = delete;
+
+  private:
+    void run();
+
+    const Metrics& Source;
+    std::ostream& Out;
+    const unsigned int Interval;
+
+    std::mutex Mutex;
+    std::condition_variable Stop;
+    bool Stopping;
+    std::thread Thread;
+  };
+
+  Metrics();
+
+  Metrics(const Metrics&) = delete;
+
+  // the metrics of the whole process
+  static Metrics& global();
+
+  void add(Counter c, uint64_t n = 1) {
+    bump(slot().Counters[c], n);
+  }
+
+  void record(Histogram h, uint64_t nanos);
+
+  Snapshot snapshot() const;
+
+  // a single counter, more cheaply than by snapshot
+  uint64_t count(Counter c) const;
+
+  static const char* name(Counter c);
+  static const char* name(Histogram h);
+
+  // Summarizes progress as of cur; rates are since prev, interval seconds earlier
+  static std::string progressLine(const Snapshot& cur, const Snapshot& prev, double interval);
+
+  static std::string toJson(const Snapshot& snap, double elapsed);
+
+private:
+  struct Slot {
+    std::array<std::atomic<uint64_t>, NUM_COUNTERS> Counters;
+    std::array<std::array<std::atomic<uint64_t>, NUM_BUCKETS>, NUM_HISTOGRAMS> Buckets;
+    std::array<std::atomic<uint64_t>, NUM_HISTOGRAMS> Sums;
+    std::array<std::atomic<uint64_t>, NUM_HISTOGRAMS> Maxes;
+  };
+
+  // only the slot's own thread writes to it, so there's no need for an
+  // atomic read-modify-write
+  static void bump(std::atomic<uint64_t>& a, uint64_t n) {
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Slot& slot();
+
+  const uint64_t Id; // tells the thread-local slot caches apart
+
+  mutable std::mutex SlotsMutex;
+  std::vector<std::unique_ptr<Slot>> Slots;
+};
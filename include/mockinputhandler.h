@@ -2,7 +2,9 @@
 
 #include "inputhandler.h"
 #include "filerecord.h"
+#include "readseek.h"
 
+#include <memory>
 #include <vector>
 
 class MockInputHandler: public InputHandler {
@@ -17,10 +19,15 @@ public:
     Inodes.push_back(i);
   }
 
+  virtual void push(std::unique_ptr<ReadSeek> stream) override {
+    Streams.push_back(std::move(stream));
+  }
+
   virtual void maybeFlush() override {}
 
   virtual void flush() override {}
 
   std::vector<Dirent> Dirents;
   std::vector<Inode> Inodes;
+  std::vector<std::unique_ptr<ReadSeek>> Streams;
 };
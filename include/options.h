@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -14,6 +15,20 @@ struct Options {
   std::string MatchSet;
   std::vector<std::string> KeyFiles;
   unsigned int NumThreads;
+  unsigned int IoThreads; // read-ahead threads, 0 to read on the workers
+  unsigned int IoQueueDepth;
+  unsigned int WalkThreads; // threads splitting the walks of an image's file systems
+  uint64_t ImageCacheSize; // bytes of image blocks cached, 0 for none
+  uint64_t MemoryLimit; // bytes held by the pipeline, roughly, 0 for no limit
+  unsigned int ProgressInterval; // seconds between progress lines, 0 for none
+  bool DiskOrder; // read queued files in image order, not largest first
+  bool AllHits; // don't stop searching files once the rules are decided
+  uint64_t MaxHitsPerPattern; // hits kept for each pattern in a file, 0 for all
+  uint64_t MaxHitsPerFile; // hits kept for each file, 0 for all
+  uint64_t HashAlgs; // SFHASH_HashAlgorithm flags requested on the command line
+  std::string KnownHashes; // known hash set file, whose files aren't searched
+  uint64_t KnownHashesAlg; // for build-known-hashes
+  std::string ScanCache; // database of earlier runs' hashes and hits
   Codec OutputCodec;
 };
 
@@ -2,62 +2,192 @@
 
 #include "llamaduck.h"
 #include "duckhash.h"
+#include "hitneeds.h"
 #include "llamabatch.h"
+#include <hasher/api.h>
 #include <lightgrep/search_hit.h>
 
 #include <memory>
+#include <string>
 #include <vector>
 
-struct SFHASH_Hasher;
-
 struct ProgramHandle;
 struct ContextHandle;
 
 struct FileRecord;
+class ContentCache;
+class KnownHashSet;
+class MemoryBudget;
 class OutputHandler;
 class ReadSeek;
+class ScanCache;
 
 class Processor {
 public:
-  Processor(LlamaDB* db, const std::shared_ptr<ProgramHandle>& prog, const std::vector<std::string>& patternToRuleId);
+  static const uint64_t DEFAULT_HASH_ALGS;
+
+  // Files no bigger than SMALL_FILE_SIZE are packed into one buffer and
+  // searched together once it reaches COALESCE_SIZE, or on flush().
+  static constexpr uint64_t SMALL_FILE_SIZE = 64 << 10;
+  static constexpr uint64_t COALESCE_SIZE = 16 << 20;
+
+  // hashAlgs is a set of SFHASH_HashAlgorithm flags; BLAKE3 is always added,
+  // since search hits are keyed on it. If seen is given, content already
+  // searched by any Processor sharing it isn't searched again. Files in
+  // known are hashed, but never searched. Files found in cache reuse the
+  // hashes, and possibly the hits, of an earlier run. If needs is given,
+  // a file's search stops once its hits have decided every rule.
+  Processor(LlamaDB* db, const std::shared_ptr<ProgramHandle>& prog,
+            uint64_t hashAlgs = DEFAULT_HASH_ALGS, const std::shared_ptr<ContentCache>& seen = nullptr,
+            const std::shared_ptr<const KnownHashSet>& known = nullptr,
+            const std::shared_ptr<ScanCache>& cache = nullptr,
+            const std::shared_ptr<const HitNeeds>& needs = nullptr);
 
   std::shared_ptr<Processor> clone() const;
 
+  // Caps the hits kept for each pattern in a file, and for a file overall;
+  // 0 means no cap. Dropped hits are counted in search_hits_overflow.
+  void setHitLimits(uint64_t perPattern, uint64_t perFile);
+
+  // Charges the unflushed batches to budget, which is shared with the rest
+  // of the pipeline; see chargeMemory()
+  void setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget);
+
   void process(ReadSeek& stream);
 
+  // Whether the stream's hashes can be had from the scan cache
+  bool isCached(const ReadSeek& stream) const;
+
   void flush(void);
 
+  // Brings the memory budget up to date with the unflushed batches, and
+  // flushes them early if the budget is spent. Call between files.
+  void chargeMemory();
+
+  // the memory held by the unflushed batches, roughly
+  uint64_t batchBytes() const;
+
   Processor(const Processor&) = delete;
 
   double getProcessorTime() const { return ProcTimeTotal; }
 
   void search(ReadSeek& rs);
 
+  // Searches the small files packed so far and adds their hits
+  void searchCoalesced();
+
+  // Searches the segment [beg, end) of stream with its own context, so that
+  // segments of one stream can be searched concurrently. The search starts
+  // overlap bytes before beg and runs overlap bytes past end, and only hits
+  // starting in the segment are kept; as long as no hit is longer than
+  // overlap, the hits of all the segments are those of a full search.
+  // The hit limits apply to each segment; if dropped is given, it gets the
+  // number of hits dropped, by keyword index. If data is given, it gets
+  // the bytes of [beg, end) as read, for hashing with hashPiece().
+  std::vector<LG_SearchHit> searchSegment(ReadSeek& stream, uint64_t beg, uint64_t end, uint64_t overlap,
+                                          std::vector<uint64_t>* dropped = nullptr,
+                                          std::vector<uint8_t>* data = nullptr) const;
+
+  // Hashes the whole stream with its own hasher; safe to run concurrently
+  // with searchSegment().
+  SFHASH_HashValues hashStream(ReadSeek& stream) const;
+
+  // A hasher of this Processor's algorithms, for hashing a stream piece
+  // by piece, in order, with hashPiece(), so that the pieces may be read
+  // concurrently; get the hashes with sfhash_get_hashes()
+  std::shared_ptr<SFHASH_Hasher> makeHasher() const;
+  void hashPiece(SFHASH_Hasher* hasher, const std::vector<uint8_t>& piece) const;
+
+  // Records a file whose hashes and hits were computed out of band, along
+  // with the hits dropped by keyword index, if any
+  void addFile(const ReadSeek& stream, const SFHASH_HashValues& h, std::vector<LG_SearchHit>&& hits,
+               const std::vector<uint64_t>& dropped = {});
+
+  void collectHit(const LG_SearchHit* const hit);
+
   void addToSearchHitBatch(const LG_SearchHit* const hit);
 
+  // moves the hits collected for the current file into the search hit batch
+  void addFileHitsToBatch();
+
   // for testing purposes
   void setBlake3(const std::string& hash) { HashRecord.Blake3 = hash; }
 
   DBBatch<SearchHit>* searchHits() { return SearchHits.get(); }
 
 private:
-  const std::vector<std::string>& PatternToRuleId;
+  struct CoalescedFile {
+    uint64_t Base, Len;
+    std::string Blake3;
+  };
+
+  void recordFile(const SFHASH_HashValues& h, const ReadSeek& stream);
+
+  // returns false if the stream isn't in the scan cache
+  bool processCached(ReadSeek& stream);
+
+  void coalesce(ReadSeek& stream);
+
+  // hashes, then searches only if the content is new; for files cheap to
+  // read again when a known set is loaded, and for probable duplicates
+  void hashThenSearch(ReadSeek& stream);
 
-  std::vector<unsigned char> Buf; // to avoid reallocations
+  // returns false if the content is known, or was searched already, in
+  // this run or a cached one
+  bool shouldSearch(const SFHASH_HashValues& h);
+
+  void hashAll(SFHASH_Hasher* hasher, ReadSeek& stream, SFHASH_HashValues& h) const;
+
+  // counts a hit against the limits, returning false if it's to be dropped
+  bool admitHit(const LG_SearchHit& hit);
+
+  void resetHitCounts();
+
+  // adds the counts of dropped hits for the file, and resets the counts
+  void recordOverflow(const std::string& fileHash);
+
+  // true once the current file's hits have decided every rule
+  bool searchSettled() const { return Needs && NeedsState.settled(); }
+
+  void addToSearchHitBatch(const LG_SearchHit* const hit, const std::string& fileHash);
 
   LlamaDB* const Db; // weak pointer, allows for clone()
   LlamaDBConnection DbConn;
   LlamaDBAppender   HashAppender;
   LlamaDBAppender   SearchHitAppender;
+  LlamaDBAppender   OverflowAppender;
 
   std::shared_ptr<ProgramHandle> LgProg; // shared
   std::shared_ptr<ContextHandle> Ctx; // not shared, could be unique_ptr
+  uint64_t HashAlgs;
   std::shared_ptr<SFHASH_Hasher> Hasher; // not shared, could be unique_ptr
 
+  std::shared_ptr<ContentCache> Seen; // shared, may be null
+  std::shared_ptr<const KnownHashSet> Known; // shared, may be null
+  std::shared_ptr<ScanCache> Cache; // shared, may be null
+  std::shared_ptr<const HitNeeds> Needs; // shared, may be null
+  HitNeeds::State NeedsState; // for the file being searched
+
+  uint64_t MaxHitsPerPattern, MaxHitsPerFile; // 0 for no limit
+  std::vector<uint64_t> PatternHitCounts; // by keyword index, for the current file
+  std::vector<uint64_t> DroppedHits; // by keyword index, for the current file
+  std::vector<uint32_t> HitPatterns; // keyword indices with counts to reset
+  uint64_t FileHitCount;
+  bool Coalescing; // true while searching coalesced files, whose hits are limited per file afterwards
+
   HashRec HashRecord; // to be reused per set of hashes
 
+  std::vector<LG_SearchHit> FileHits; // hits for the current file, pending its hash
+
+  std::vector<uint8_t> Coalesced; // contents of small files, back to back
+  std::vector<CoalescedFile> CoalescedFiles; // where each file is in Coalesced
+
   std::unique_ptr<HashBatch> Hashes;
   std::unique_ptr<DBBatch<SearchHit>> SearchHits;
+  std::unique_ptr<DBBatch<SearchHitOverflow>> Overflows;
+
+  std::shared_ptr<MemoryBudget> Budget; // shared, may be null
+  uint64_t Charged; // bytes of batches charged to Budget
 
   double ProcTimeTotal;
 };
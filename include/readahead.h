@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "readseek.h"
+
+// BufferPool lends out a fixed number of equally sized, page-aligned
+// buffers, so read-ahead can't use more memory than it was given.
+class BufferPool {
+public:
+  static constexpr size_t ALIGNMENT = 4096;
+
+  BufferPool(size_t numBuffers, size_t bufferSize);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+
+  size_t bufferSize() const { return BufferSize; }
+
+  size_t available() const;
+
+  // blocks until a buffer is free
+  uint8_t* acquire();
+  void release(uint8_t* buf);
+
+private:
+  const size_t BufferSize;
+
+  mutable std::mutex Mutex;
+  std::condition_variable Freed;
+  std::vector<uint8_t*> Free;
+  std::vector<uint8_t*> All;
+};
+
+// ReadAheadStream wraps an open stream which an I/O thread reads ahead of
+// its consumer, into buffers from a BufferPool. Reading is sequential; a
+// seek outside the current buffer stops the read-ahead, and from then on
+// the wrapped stream is read directly, reopened on the consumer's thread.
+// The I/O thread closes the stream it read.
+class ReadAheadStream: public ReadSeek {
+public:
+  ReadAheadStream(std::unique_ptr<ReadSeek> inner, BufferPool& pool);
+  virtual ~ReadAheadStream();
+
+  // Returns the work of an I/O thread: filling buffers from the wrapped
+  // stream until it ends or the consumer stops wanting them. It may run
+  // after this object is gone.
+  std::function<void()> filler();
+
+  virtual bool open(void) override { return true; }
+  virtual void close(void) override;
+
+  virtual uint64_t getID() const override { return ID; }
+
+  virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override;
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override;
+
+  virtual size_t tellg() const override { return Pos; }
+  virtual size_t seek(size_t pos) override;
+
+  virtual size_t size(void) const override { return Size; }
+
+  virtual std::unique_ptr<ReadSeek> reopen() const override;
+
+  virtual bool cheapToReread() const override { return CheapToReread; }
+
+private:
+  struct Block {
+    uint8_t* Buf;
+    uint64_t Offset;
+    size_t Len;
+  };
+
+  struct State;
+
+  // stops the read-ahead and gives back its buffers
+  void stop();
+
+  // stops the read-ahead and reopens the wrapped stream for this thread
+  void goDirect();
+
+  std::shared_ptr<State> Shared;
+
+  const uint64_t ID;
+  const size_t Size;
+  const bool CheapToReread; // as the wrapped stream
+
+  Block Cur;
+  size_t Pos;
+  bool Direct;
+};
@@ -2,8 +2,12 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <vector>
 
+#include "fileidentity.h"
+
 class ReadSeek {
 public:
   virtual ~ReadSeek() {}
@@ -15,8 +19,43 @@ public:
 
   virtual int64_t read(size_t len, std::vector<uint8_t>& buf) = 0;
 
+  // Reads up to len bytes without copying them into a caller-owned buffer.
+  // On return, buf points at the data, which remains valid until the next
+  // call to read(), readView(), seek(), or close().
+  virtual int64_t readView(size_t len, const uint8_t*& buf) {
+    const int64_t ret = read(len, ViewBuf);
+    buf = ViewBuf.data();
+    return ret;
+  }
+
   virtual size_t tellg() const = 0;
   virtual size_t seek(size_t pos) = 0;
 
   virtual size_t size(void) const = 0;
+
+  // Returns an unopened stream over the same data which can be read
+  // independently of this one, e.g. on another thread, or nullptr if
+  // that isn't supported.
+  virtual std::unique_ptr<ReadSeek> reopen() const { return nullptr; }
+
+  // Whether reading the data again costs little, e.g., because it's in
+  // memory or the page cache, rather than decompressed from an image again
+  virtual bool cheapToReread() const { return true; }
+
+  // Set by the reader which made the stream, if it can identify the file
+  // across runs
+  const std::optional<FileIdentity>& identity() const { return Identity; }
+  void setIdentity(const FileIdentity& id) { Identity = id; }
+
+  // Set by the reader, if it knows where the stream's data begins in its
+  // image
+  const std::optional<uint64_t>& diskOffset() const { return DiskOffset; }
+  void setDiskOffset(uint64_t off) { DiskOffset = off; }
+
+protected:
+  std::vector<uint8_t> ViewBuf; // backs the default readView()
+
+private:
+  std::optional<FileIdentity> Identity;
+  std::optional<uint64_t> DiskOffset;
 };
@@ -2,8 +2,15 @@
 
 #include "readseek.h"
 #include "tsk.h"
+#include "tskhandlepool.h"
 
+class AsyncReader;
+
+#include <algorithm>
+#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
 
 class ReadSeekBuf: public ReadSeek {
 public:
@@ -17,12 +24,15 @@ public:
   virtual uint64_t getID() const override { return 0; }
 
   virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override;
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override;
 
   virtual size_t tellg() const override { return Pos; }
   virtual size_t seek(size_t pos) override { return (Pos = (pos < Buf.size() ? pos: Buf.size())); }
 
   virtual size_t size(void) const override { return Buf.size(); }
 
+  virtual std::unique_ptr<ReadSeek> reopen() const override { return std::make_unique<ReadSeekBuf>(Buf); }
+
 private:
   std::vector<uint8_t> Buf;
 
@@ -56,11 +66,130 @@ private:
 
 //*******************************************************************
 
+// ReadSeekMMap opens its file lazily, in open(), so that batches of streams
+// don't hold file descriptors. Regular files of at least MMAP_THRESHOLD
+// bytes are memory-mapped and read in place; anything smaller, or which
+// can't be mapped, is read through a ReadSeekFile instead. Touching a
+// mapped page past the end of a file which shrank raises SIGBUS, so the
+// size is checked before every view, and a file found to have shrunk is
+// read through a ReadSeekFile from there on. A file truncated while a
+// view of it is in use can still raise SIGBUS; read inputs which may be
+// changing with ReadSeekAsync.
+class ReadSeekMMap: public ReadSeek {
+public:
+  static constexpr size_t MMAP_THRESHOLD = 1 << 20;
+
+  // size is the file's size as listed, until open() finds it
+  ReadSeekMMap(const std::string& path, uint64_t id, uint64_t size = 0);
+  virtual ~ReadSeekMMap() { close(); }
+
+  virtual bool open(void) override;
+  virtual void close(void) override;
+
+  virtual uint64_t getID() const override { return ID; }
+
+  virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override;
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override;
+
+  virtual size_t tellg() const override;
+  virtual size_t seek(size_t pos) override;
+
+  virtual size_t size(void) const override;
+
+  virtual std::unique_ptr<ReadSeek> reopen() const override { return std::make_unique<ReadSeekMMap>(Path, ID, size()); }
+
+  bool isMapped() const { return Map != nullptr; }
+
+private:
+  // whether the mapped file is now shorter than the view to be handed out
+  bool shrank(size_t end) const;
+  // switches from the mapping to reading the descriptor, at Pos
+  bool fallBack();
+
+  std::string Path;
+  uint64_t ID;
+
+  int Fd; // kept open while mapped, for checking the size
+  const uint8_t* Map;
+  size_t Size, Pos;
+
+  std::unique_ptr<ReadSeekFile> Fallback;
+};
+
+//*******************************************************************
+
+// ReadSeekAsync reads ahead of its consumer, keeping up to QueueDepth
+// blocks in flight through the calling thread's AsyncReader, and lends
+// out completed blocks from readView(). Like ReadSeekMMap, it doesn't
+// touch the file until open(). An open stream may only be read on the
+// thread which opened it, whose reader queues its reads; other threads
+// reopen() it instead. It may be closed, or destroyed, on any thread,
+// which waits out the reads in flight.
+class ReadSeekAsync: public ReadSeek {
+public:
+  ReadSeekAsync(const std::string& path, uint64_t id, unsigned queueDepth, size_t blockSize = 1 << 20);
+  virtual ~ReadSeekAsync() { close(); }
+
+  virtual bool open(void) override;
+  virtual void close(void) override;
+
+  virtual uint64_t getID() const override { return ID; }
+
+  virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override;
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override;
+
+  virtual size_t tellg() const override { return Pos; }
+  virtual size_t seek(size_t pos) override { return (Pos = std::min(pos, Size)); }
+
+  virtual size_t size(void) const override { return Size; }
+
+  virtual std::unique_ptr<ReadSeek> reopen() const override {
+    return std::make_unique<ReadSeekAsync>(Path, ID, QueueDepth, BlockSize);
+  }
+
+private:
+  struct Block {
+    std::vector<uint8_t> Buf;
+    uint64_t Offset;
+    int64_t  Len;
+    uint64_t Ticket;
+  };
+
+  void fill(); // queue reads until QueueDepth are in flight
+  void retire(Block& b); // waits for b's read, then recycles its buffer
+
+  void checkOwner() const; // throws unless on the thread which opened this
+
+  std::string Path;
+  uint64_t ID;
+  unsigned QueueDepth;
+  size_t BlockSize;
+
+  int Fd;
+  size_t Size, Pos;
+  uint64_t NextOffset; // where the next queued read starts
+
+  std::shared_ptr<AsyncReader> Reader; // Owner's
+  std::thread::id Owner;
+
+  std::deque<Block> InFlight;
+  Block Cur;
+  bool HaveCur;
+
+  std::vector<std::vector<uint8_t>> FreeBufs;
+};
+
+//*******************************************************************
+
 struct TSK_FS_ATTR;
 
+// ReadSeekTSK borrows a handle of the file system from the pool in open()
+// and gives it back in close(), so open streams are read in parallel and
+// a handle is only used by one stream at a time. A stream may be read
+// from any thread, one at a time.
 class ReadSeekTSK: public ReadSeek {
 public:
-  ReadSeekTSK(const std::shared_ptr<TSK_FS_INFO>& fs, uint64_t inum);
+  ReadSeekTSK(const std::shared_ptr<TskHandlePool>& handles, TSK_OFF_T fsOffset, TSK_FS_TYPE_ENUM fsType, uint64_t inum);
   virtual ~ReadSeekTSK() {}
 
   virtual bool open(void) override;
@@ -70,15 +199,24 @@ public:
 
   virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override;
 
-  virtual size_t tellg() const override { return 0; }
+  virtual size_t tellg() const override { return Pos; }
   virtual size_t seek(size_t pos) override;
 
   virtual size_t size(void) const override;
 
+  virtual std::unique_ptr<ReadSeek> reopen() const override;
+
+  // only if the file's blocks are likely still in the image cache
+  virtual bool cheapToReread() const override;
+
 private:
-  std::shared_ptr<TSK_FS_INFO> Fs;
+  std::shared_ptr<TskHandlePool> Handles;
+  TSK_OFF_T FsOffset;
+  TSK_FS_TYPE_ENUM FsType;
   uint64_t Inum;
-  TSK_FS_FILE* FilePtr;
+
+  std::unique_ptr<TskHandlePool::Lease> Lease;
+  std::unique_ptr<TSK_FS_FILE, void(*)(TSK_FS_FILE*)> File; // gone before Lease
   uint64_t Pos;
 };
 
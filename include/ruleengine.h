@@ -1,15 +1,21 @@
 #pragma once
 
 #include "fsm.h"
+#include "hitneeds.h"
 #include "querybuilder.h"
 #include "rulereader.h"
 
 class LlamaDBConnection;
+struct ProgramHandle;
 
 class LlamaRuleEngine {
 public:
   LlamaRuleEngine();
   void writeRulesToDb(LlamaDBConnection& dbConn);
+
+  // Writes the patterns table, mapping the keyword indices of prog, which
+  // search hits refer to, to their patterns and rules
+  void writePatternsToDb(LlamaDBConnection& dbConn, ProgramHandle* prog);
   void createTables(LlamaDBConnection& dbConn);
 
   LgFsmHolder buildFsm();
@@ -17,9 +23,16 @@ public:
   bool read(const std::string& input, const std::string& source);
   uint64_t numRulesRead();
 
+  // SFHASH_HashAlgorithm flags for every hash named in a rule's hash section
+  uint64_t hashAlgs() const;
+
   const std::vector<std::string>& patternToRuleId() const { return PatternToRuleId; }
+
+  // Which hits can decide the grep conditions; call after buildFsm()
+  HitNeeds hitNeeds() const;
 private:
   std::vector<std::string> PatternToRuleId;
+  std::vector<std::pair<size_t, std::string_view>> KeywordPatterns; // rule index and pattern name, by keyword index
   std::string Input;
   RuleReader Reader;
   QueryBuilder Qb;
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "duckhash.h"
+#include "fileidentity.h"
+#include "llamaduck.h"
+
+struct ProgramHandle;
+
+struct ScanCacheRec {
+  static constexpr auto ColNames = {"ImageId",
+                                    "FsOffset",
+                                    "Addr",
+                                    "SeqNum",
+                                    "Filesize",
+                                    "Modified",
+                                    "HashAlgs",
+                                    "MD5",
+                                    "SHA1",
+                                    "SHA256",
+                                    "Blake3",
+                                    "Ssdeep"};
+
+  std::string ImageId;
+  uint64_t    FsOffset;
+  uint64_t    Addr;
+  uint64_t    SeqNum;
+  uint64_t    Filesize;
+  std::string Modified;
+  uint64_t    HashAlgs;
+
+  std::string MD5;
+  std::string SHA1;
+  std::string SHA256;
+  std::string Blake3;
+  std::string Ssdeep;
+};
+
+struct ScanCacheSearched {
+  static constexpr auto ColNames = {"ProgramId",
+                                    "Blake3"};
+
+  std::string ProgramId;
+  std::string Blake3;
+};
+
+// pattern ids are only meaningful for the same program
+struct ScanCacheHit {
+  static constexpr auto ColNames = {"ProgramId",
+                                    "pattern_id",
+                                    "start_offset",
+                                    "end_offset",
+                                    "file_hash",
+                                    "length"};
+
+  std::string ProgramId;
+  uint64_t pattern_id;
+  uint64_t start_offset;
+  uint64_t end_offset;
+  std::string file_hash;
+  uint64_t length;
+};
+
+struct ScanCacheOverflow {
+  static constexpr auto ColNames = {"ProgramId",
+                                    "pattern_id",
+                                    "file_hash",
+                                    "dropped"};
+
+  std::string ProgramId;
+  uint64_t pattern_id;
+  std::string file_hash;
+  uint64_t dropped;
+};
+
+// the identity of a whole image, kept so it needn't be computed every run
+struct ScanCacheImage {
+  static constexpr auto ColNames = {"Path",
+                                    "Size",
+                                    "Modified",
+                                    "Device",
+                                    "Inode",
+                                    "ImageId"};
+
+  std::string Path;
+  uint64_t    Size;
+  uint64_t    Modified; // in ns
+  uint64_t    Device;
+  uint64_t    Inode;
+  std::string ImageId;
+};
+
+// ScanCache carries the hashes and search hits of earlier runs over to a
+// rerun on the same evidence. Files are matched by their FileIdentity and
+// the identity of the evidence, so their hashes are reused outright; their
+// contents are searched again only if the compiled lightgrep program and
+// rule ids have changed. The cache is a DuckDB file, which is attached to
+// the output database as "scan_cache" for the duration of the run.
+// Anything else affecting which hits are kept, such as the hit limits, must
+// be part of the program identity.
+class ScanCache {
+public:
+  struct Entry {
+    uint64_t HashAlgs;
+    HashRec  Hashes;
+  };
+
+  // the evidence to identify with imageIdentity()
+  struct Evidence {
+    std::string Path;
+  };
+
+  // Attaches the cache at path, creating it if need be, and loads what's
+  // known about the evidence imageId
+  ScanCache(duckdb_connection& conn, const std::string& path, const std::string& imageId, const std::string& programId);
+
+  // As above, for the evidence at input. An image's identity is kept in
+  // the cache with its path, size, mtime, and inode, and computed again
+  // only if any of them change, e.g., when the image is moved.
+  ScanCache(duckdb_connection& conn, const std::string& path, const Evidence& input, const std::string& programId);
+
+  // The file's cached hashes, if they include all of hashAlgs
+  const Entry* find(const FileIdentity& id, uint64_t hashAlgs) const;
+
+  // Whether content was searched by the same program in an earlier run;
+  // if so, finish() copies its hits
+  bool wasSearched(const std::string& blake3);
+
+  // Records a file of this run. If searched, its content's hits are settled,
+  // whether or not it was actually searched.
+  void add(const FileIdentity& id, uint64_t hashAlgs, const HashRec& hashes, bool searched);
+
+  // Copies the reused hits into search_hits and search_hits_overflow, saves
+  // this run's files and hits to the cache, and detaches it
+  void finish(duckdb_connection& conn);
+
+  size_t numCachedFiles() const { return Files.size(); }
+
+  const std::string& imageId() const { return ImageId; }
+
+  // Identifies an image by a digest of all of it, so that images which
+  // differ anywhere get different identities, and copies the same one.
+  // Only the first segment of a split image is read; an E01's holds the
+  // acquisition's unique set identifier. Directories, whose contents may
+  // change, are identified by their path.
+  static std::string imageIdentity(const std::string& input);
+
+  static std::string programIdentity(ProgramHandle* prog, const std::vector<std::string>& patternToRuleId,
+                                     const std::vector<uint64_t>& searchSettings);
+
+private:
+  struct IdentityHash {
+    size_t operator()(const FileIdentity& id) const;
+  };
+
+  void attach(duckdb_connection& conn, const std::string& path);
+  void load(duckdb_connection& conn);
+
+  // imageIdentity(), kept in the attached cache
+  static std::string imageIdentity(duckdb_connection& conn, const std::string& input);
+
+  std::string ImageId;
+  std::string ProgramId;
+
+  // loaded by the constructor, and read-only after that
+  std::unordered_map<FileIdentity, Entry, IdentityHash> Files;
+  std::unordered_set<std::string> Searched;
+
+  std::mutex Mutex; // guards the rest
+  std::unordered_set<std::string> Reused;
+  std::unordered_set<std::string> NewlySearched;
+  DBBatch<ScanCacheRec> Current;
+};
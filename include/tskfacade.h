@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 
 #include "tsk.h"
 
@@ -21,6 +22,10 @@ public:
 
   virtual void populateAttrs(TSK_FS_FILE* file) const;
 
+  // the image offset of the first allocated run of the file's default
+  // attribute, if it isn't resident
+  virtual std::optional<uint64_t> firstDataOffset(TSK_FS_FILE* file) const;
+
   virtual bool walk(
     TSK_IMG_INFO* info,
     std::function<TSK_FILTER_ENUM(const TSK_VS_INFO*)> vs_cb,
@@ -29,6 +34,18 @@ public:
     std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)> file_cb
   );
 
+  // walks only the file system at off, which it opens for itself
+  virtual bool walkFs(
+    TSK_IMG_INFO* info,
+    TSK_OFF_T off,
+    TSK_FS_TYPE_ENUM type,
+    std::function<TSK_FILTER_ENUM(TSK_FS_INFO*)> fs_cb,
+    std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)> file_cb
+  );
+
+  // calls file_cb with each entry of the directory inum, without recursing
+  virtual bool listDir(TSK_FS_INFO* fs, TSK_INUM_T inum, std::function<void(TSK_FS_FILE*)> file_cb) const;
+
   virtual jsoncons::json convertImg(const TSK_IMG_INFO& img) const;
 
   virtual jsoncons::json convertVS(const TSK_VS_INFO& vs) const;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tsk.h"
+
+class BlockCache;
+class MemoryBudget;
+class TskFacade;
+class TskImgCache;
+
+// TskHandlePool lends out handles of an image and its file systems, so
+// that threads reading files don't share TSK handles. A handle is lent to
+// one user at a time, and given back for the next when the lease ends;
+// up to maxIdle handles are kept for reuse, and the rest closed. Each open
+// handle is charged to the memory budget, if given one. The images share
+// a BlockCache, if given one, so a block decompressed through one handle
+// is there for the others. Leases must end before the pool is destroyed.
+class TskHandlePool {
+  struct Handles;
+
+public:
+  // what an open image handle holds, roughly, beyond the shared cache,
+  // e.g., libewf's chunk cache
+  static constexpr uint64_t HANDLE_BYTES = 4 << 20;
+
+  // A handle on loan, given back when the lease is destroyed
+  class Lease {
+  public:
+    Lease(TskHandlePool& pool, std::unique_ptr<Handles> h);
+    Lease(Lease&& other);
+    ~Lease();
+
+    Lease(const Lease&) = delete;
+
+    // the file system at off on this handle, opened on first use, or
+    // nullptr if it can't be opened
+    TSK_FS_INFO* fs(TSK_OFF_T off, TSK_FS_TYPE_ENUM type);
+
+    // opens inum on this handle's file system at off
+    std::unique_ptr<TSK_FS_FILE, void(*)(TSK_FS_FILE*)> openFile(TSK_OFF_T off, TSK_FS_TYPE_ENUM type, TSK_INUM_T inum);
+
+  private:
+    TskHandlePool* Pool;
+    std::unique_ptr<Handles> H;
+  };
+
+  TskHandlePool(
+    const std::string& imgPath,
+    const std::shared_ptr<const TskFacade>& tsk,
+    const std::shared_ptr<BlockCache>& cache,
+    size_t maxIdle = 1
+  );
+  ~TskHandlePool();
+
+  TskHandlePool(const TskHandlePool&) = delete;
+
+  // for charging open handles, which are charged from then on
+  void setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget);
+
+  // lends an idle handle, or a new one if none is idle
+  Lease checkout();
+
+  // the cache shared by the images, if any
+  const std::shared_ptr<BlockCache>& cache() const { return Cache; }
+
+  // the number of open handles, lent or idle
+  size_t size() const;
+
+  // the number of idle handles
+  size_t idle() const;
+
+private:
+  void giveBack(std::unique_ptr<Handles> h);
+
+  // called as handles open and close their images
+  void opened();
+  void closed();
+
+  const std::string ImgPath;
+  std::shared_ptr<const TskFacade> Tsk;
+  std::shared_ptr<BlockCache> Cache;
+  const size_t MaxIdle;
+
+  mutable std::mutex Mutex;
+  std::vector<std::unique_ptr<Handles>> Idle;
+  size_t Open;
+  std::shared_ptr<MemoryBudget> Budget;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+
+#include "tsk.h"
+
+class BlockCache;
+
+// TskImgCache puts a BlockCache between TSK and an image's backend, e.g.,
+// libewf, by swapping the read function of the image's TSK_IMG_INFO. TSK
+// keeps its own small cache above it. The read function is put back when
+// the TskImgCache is destroyed, which must happen before the image is
+// closed.
+class TskImgCache {
+public:
+  TskImgCache(TSK_IMG_INFO* img, const std::shared_ptr<BlockCache>& cache);
+  ~TskImgCache();
+
+  TskImgCache(const TskImgCache&) = delete;
+
+  BlockCache& cache() { return *Cache; }
+
+private:
+  using ReadFn = ssize_t (*)(TSK_IMG_INFO*, TSK_OFF_T, char*, size_t);
+
+  static ssize_t cachedRead(TSK_IMG_INFO* img, TSK_OFF_T off, char* buf, size_t len);
+
+  TSK_IMG_INFO* const Img;
+  const ReadFn BackendRead;
+  std::shared_ptr<BlockCache> Cache;
+};
@@ -2,6 +2,7 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stack>
 #include <unordered_map>
 #include <vector>
@@ -11,21 +12,36 @@
 #include "direntstack.h"
 #include "filerecord.h"
 #include "hex.h"
+#include "inodeclaims.h"
 #include "inputreader.h"
 #include "recordhasher.h"
 #include "readseek.h"
 #include "tskimgassembler.h"
 #include "tskreaderhelper.h"
+#include "tskimgcache.h"
 #include "util.h"
 
 class BlockSequence;
 class InputHandler;
 class OutputHandler;
 class TimestampGetter;
+class TskFacade;
+class TskHandlePool;
 
 class TskReader: public InputReader {
 public:
-  TskReader(const std::string& imgPath);
+  // With walkThreads > 1, each file system's directories are walked by
+  // that many threads, which hand subdirectories to idle ones. Reads of
+  // the image go through a cache of imageCacheSize bytes, if any. Up to
+  // fsThreads file systems are walked at once, sharing the walkThreads.
+  // The image is read through tsk, if given, for testing.
+  TskReader(
+    const std::string& imgPath,
+    unsigned int walkThreads = 1,
+    uint64_t imageCacheSize = 0,
+    unsigned int fsThreads = 1,
+    const std::shared_ptr<TskFacade>& tsk = nullptr
+  );
 
   virtual ~TskReader();
 
@@ -40,34 +56,75 @@ public:
 
   virtual bool startReading() override;
 
+  // charges the handles lent for reading files; call after open()
+  virtual void setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget) override;
+
 private:
-  // callbacks
+  // a file system found in the image
+  struct FsLocation {
+    TSK_OFF_T Offset;
+    TSK_FS_TYPE_ENUM Type;
+  };
+
+  // The state of the walk of one file system, or of a subtree of it, with
+  // paths under basePath. Each walk has its own handler, if the handler
+  // can be forked, so walks can run concurrently.
+  struct FsWalk {
+    FsWalk(const std::shared_ptr<InputHandler>& in, const std::string& basePath = "");
+    ~FsWalk();
+
+    std::shared_ptr<InputHandler> Input;
+    std::unique_ptr<TimestampGetter> Tsg;
+    std::shared_ptr<InodeClaims> Claims; // shared by the walks of one file system
+    RecordHasher RecHasher;
+    DirentStack Dirents;
+  };
+
+  // callbacks for finding the file systems, which are walked afterwards
   TSK_FILTER_ENUM filterVs(const TSK_VS_INFO* vs_info);
   TSK_FILTER_ENUM filterVol(const TSK_VS_PART_INFO* vs_part);
   TSK_FILTER_ENUM filterFs(TSK_FS_INFO* fs_info);
-  TSK_RETVAL_ENUM processFile(TSK_FS_FILE* fs_file, const char* /* path */);
 
-  bool addToBatch(TSK_FS_FILE* fs_file);
+  // walks one file system into walk's handler, with a handle of its own,
+  // split across up to threads threads
+  bool walkFs(const FsLocation& loc, FsWalk& walk, unsigned int threads);
+
+  // the directories of a file system waiting to be walked
+  struct DirQueue;
+
+  // walks the directories of the file system concurrently, each thread
+  // on its own handle, into walk's handler and its forks
+  bool walkSplit(const FsLocation& loc, FsWalk& walk, const std::vector<std::shared_ptr<InputHandler>>& forks);
+
+  // lists the directory inum into walk, walking its subdirectories or
+  // queueing them for idle threads; ancestors are the directories above
+  bool walkDir(TSK_FS_INFO* fs, TSK_INUM_T inum, std::vector<TSK_INUM_T>& ancestors, FsWalk& walk, DirQueue& queue);
+
+  // pushes the dirents left on the stack at the end of a walk
+  void finishWalk(FsWalk& walk);
+
+  // callbacks for walking a file system
+  void startFs(TSK_FS_INFO* fs_info, FsWalk& walk);
+  bool addToBatch(TSK_FS_FILE* fs_file, FsWalk& walk);
 
   std::shared_ptr<BlockSequence> makeBlockSequence(TSK_FS_FILE* fs_file);
   std::unique_ptr<ReadSeek> makeReadSeek(TSK_FS_FILE* fs_file);
 
   std::string ImgPath;
+  const unsigned int WalkThreads;
+  const unsigned int FsThreads;
   std::unique_ptr<TSK_IMG_INFO, void(*)(TSK_IMG_INFO*)> Img;
-  std::unordered_map<TSK_OFF_T, std::shared_ptr<TSK_FS_INFO>> Fs;
+  const uint64_t ImageCacheSize;
+  std::unique_ptr<TskImgCache> ImgCache; // gone before Img
+  std::shared_ptr<TskHandlePool> Handles; // for reading files
+  std::unordered_map<TSK_OFF_T, std::shared_ptr<TSK_FS_INFO>> Fs; // under FsMutex
+  std::mutex FsMutex;
 
   std::shared_ptr<InputHandler> Input;
 
-  std::unique_ptr<TskFacade> Tsk;
+  std::shared_ptr<TskFacade> Tsk;
   TskImgAssembler Asm;
-  std::unique_ptr<TimestampGetter> Tsg;
-
-  std::vector<bool> InodeTracker;
-
-  RecordHasher RecHasher;
-  DirentStack Dirents;
 
-  uint64_t CurFsOffset;
-  uint64_t CurFsBlockSize;
+  std::vector<FsLocation> FileSystems; // in the order found
 };
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <optional>
 
 #include "tsk.h"
 
@@ -9,6 +10,11 @@
 #include "inodeandblocktracker.h"
 
 namespace TskReaderHelper {
+  // the image offset of the attribute's first run with data on disk, if it
+  // has one; resident attributes, and ones with only sparse or filler runs,
+  // e.g., of deleted files whose runs are gone, don't
+  std::optional<uint64_t> firstDataOffset(const TSK_FS_ATTR& attr, uint64_t fsOffset, uint64_t blockSize);
+
 /*  void handleRuns(
     const TSK_FS_ATTR& a,
     uint64_t fsOffset,
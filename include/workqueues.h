@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// WorkQueues holds a queue of tasks for each worker, ordered by priority,
+// highest first. A worker takes from its own queue and, once that's empty,
+// steals from its peers', so each queue's lock is rarely contended.
+// Thieves also take the highest priority task; when priority is cost, a
+// task left behind a busy owner would otherwise hold up the end of a run.
+template <class T>
+class WorkQueues {
+public:
+  explicit WorkQueues(size_t numWorkers): Queues(numWorkers), Pending(0) {}
+
+  WorkQueues(const WorkQueues&) = delete;
+
+  size_t numWorkers() const { return Queues.size(); }
+
+  // tasks queued and not yet taken
+  size_t pending() const { return Pending.load(); }
+
+  void push(size_t worker, uint64_t priority, T&& task) {
+    Queue& q = Queues[worker];
+    std::lock_guard<std::mutex> lock(q.Mutex);
+    q.Tasks.emplace(priority, std::move(task));
+    ++Pending;
+  }
+
+  // Takes the highest priority task from worker's queue, or failing that, from
+  // the next peer's queue with any
+  bool pop(size_t worker, T& task) {
+    for (size_t i = 0; i < Queues.size(); ++i) {
+      if (take(Queues[(worker + i) % Queues.size()], task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Queue {
+    std::mutex Mutex;
+    std::multimap<uint64_t, T, std::greater<uint64_t>> Tasks;
+  };
+
+  bool take(Queue& q, T& task) {
+    std::lock_guard<std::mutex> lock(q.Mutex);
+    if (q.Tasks.empty()) {
+      return false;
+    }
+    task = std::move(q.Tasks.begin()->second);
+    q.Tasks.erase(q.Tasks.begin());
+    --Pending;
+    return true;
+  }
+
+  std::vector<Queue> Queues;
+  std::atomic<size_t> Pending;
+};
@@ -0,0 +1,189 @@
+#include "asyncreader.h"
+
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+#include "boost_asio.h"
+
+namespace {
+  boost::asio::thread_pool& ioPool(unsigned queueDepth) {
+    // shared by all the thread pool readers; sized on first use so that
+    // every worker can have queueDepth reads going at once
+    static boost::asio::thread_pool pool(
+      std::min(256u, std::max(1u, queueDepth) * std::max(1u, std::thread::hardware_concurrency()))
+    );
+    return pool;
+  }
+
+  int64_t readAt(int fd, uint64_t offset, uint8_t* buf, size_t len) {
+#if !defined(_WIN32)
+    size_t total = 0;
+    while (total < len) {
+      const ssize_t ret = pread(fd, buf + total, len - total, offset + total);
+      if (ret < 0) {
+        return -1;
+      }
+      else if (ret == 0) {
+        break;
+      }
+      total += ret;
+    }
+    return total;
+#else
+    return -1;
+#endif
+  }
+}
+
+class ThreadPoolAsyncReader: public AsyncReader {
+public:
+  ThreadPoolAsyncReader(unsigned queueDepth): Pool(ioPool(queueDepth)), NextTicket(0) {}
+
+  virtual ~ThreadPoolAsyncReader() {
+    // the pool threads write into caller buffers, so don't leave any behind
+    for (auto& p : Pending) {
+      p.second.wait();
+    }
+  }
+
+  virtual uint64_t submit(int fd, uint64_t offset, uint8_t* buf, size_t len) override {
+    auto promise = std::make_shared<std::promise<int64_t>>();
+    uint64_t ticket;
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      ticket = NextTicket++;
+      Pending.emplace(ticket, promise->get_future());
+    }
+    boost::asio::post(Pool, [=]() {
+      promise->set_value(readAt(fd, offset, buf, len));
+    });
+    return ticket;
+  }
+
+  virtual int64_t wait(uint64_t ticket) override {
+    std::future<int64_t> result;
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      auto itr = Pending.find(ticket);
+      if (itr == Pending.end()) {
+        return -1;
+      }
+      result = std::move(itr->second);
+      Pending.erase(itr);
+    }
+    return result.get();
+  }
+
+  virtual const char* name() const override { return "threadpool"; }
+
+private:
+  boost::asio::thread_pool& Pool;
+
+  std::mutex Mutex;
+  uint64_t NextTicket;
+  std::unordered_map<uint64_t, std::future<int64_t>> Pending;
+};
+
+#if defined(HAVE_LIBURING)
+class UringAsyncReader: public AsyncReader {
+public:
+  UringAsyncReader(): Ring(), Initialized(false), NextTicket(0), InFlight(0) {}
+
+  virtual ~UringAsyncReader() {
+    if (Initialized) {
+      while (InFlight) {
+        reap();
+      }
+      io_uring_queue_exit(&Ring);
+    }
+  }
+
+  bool init(unsigned queueDepth) {
+    return (Initialized = io_uring_queue_init(std::max(1u, queueDepth), &Ring, 0) == 0);
+  }
+
+  virtual uint64_t submit(int fd, uint64_t offset, uint8_t* buf, size_t len) override {
+    std::lock_guard<std::mutex> lock(Mutex);
+    io_uring_sqe* sqe = io_uring_get_sqe(&Ring);
+    while (!sqe) {
+      // submission queue is full; make room by finishing something
+      reap();
+      sqe = io_uring_get_sqe(&Ring);
+    }
+    const uint64_t ticket = NextTicket++;
+    io_uring_prep_read(sqe, fd, buf, len, offset);
+    sqe->user_data = ticket;
+    io_uring_submit(&Ring);
+    ++InFlight;
+    return ticket;
+  }
+
+  virtual int64_t wait(uint64_t ticket) override {
+    // reaping blocks other threads, but only until the next completion
+    std::lock_guard<std::mutex> lock(Mutex);
+    auto itr = Done.find(ticket);
+    while (itr == Done.end()) {
+      if (!InFlight) {
+        return -1;
+      }
+      reap();
+      itr = Done.find(ticket);
+    }
+    const int64_t ret = itr->second;
+    Done.erase(itr);
+    return ret;
+  }
+
+  virtual const char* name() const override { return "io_uring"; }
+
+private:
+  void reap() {
+    io_uring_cqe* cqe = nullptr;
+    if (io_uring_wait_cqe(&Ring, &cqe) == 0 && cqe) {
+      Done[cqe->user_data] = cqe->res < 0 ? -1 : cqe->res;
+      io_uring_cqe_seen(&Ring, cqe);
+      --InFlight;
+    }
+  }
+
+  std::mutex Mutex; // the ring isn't thread-safe
+  io_uring Ring;
+  bool Initialized;
+
+  uint64_t NextTicket;
+  unsigned InFlight;
+  std::unordered_map<uint64_t, int64_t> Done;
+};
+#endif
+
+std::unique_ptr<AsyncReader> AsyncReader::create(unsigned queueDepth) {
+#if defined(HAVE_LIBURING)
+  // io_uring can be compiled in yet disabled by the kernel or a seccomp
+  // policy, as in many containers, so fall back if setup fails
+  auto uring = std::make_unique<UringAsyncReader>();
+  if (uring->init(queueDepth)) {
+    return uring;
+  }
+#endif
+  return createThreadPool(queueDepth);
+}
+
+std::unique_ptr<AsyncReader> AsyncReader::createThreadPool(unsigned queueDepth) {
+  return std::make_unique<ThreadPoolAsyncReader>(queueDepth);
+}
+
+std::shared_ptr<AsyncReader> AsyncReader::local(unsigned queueDepth) {
+  thread_local std::shared_ptr<AsyncReader> reader(create(queueDepth));
+  return reader;
+}
@@ -2,15 +2,15 @@
 
 #include "filescheduler.h"
 #include "duckinode.h"
-
-namespace {
-  const unsigned int BATCH_SIZE = 5000;
-}
+#include "metrics.h"
 
 BatchHandler::BatchHandler(std::shared_ptr<FileScheduler> sink):
   Sink(sink),
-  CurDents(new DirentBatch()),
-  CurInodes(new InodeBatch()),
+  Sizer(),
+  Start(std::chrono::steady_clock::now()),
+  CurBytes(0),
+  CurDents(Sink->newDirentBatch()),
+  CurInodes(Sink->newInodeBatch()),
   CurStreams(new std::vector<std::unique_ptr<ReadSeek>>())
 {
 }
@@ -21,22 +21,44 @@ void BatchHandler::push(const Dirent& d) {
 
 void BatchHandler::push(const Inode& i) {
   CurInodes->add(i);
+  CurBytes += i.Filesize;
 }
 
 void BatchHandler::push(std::unique_ptr<ReadSeek> stream) {
   CurStreams->push_back(std::move(stream));
+  // a huge directory would otherwise make a huge batch
+  if (Sizer.overfull(CurBytes, CurInodes->size())) {
+    flush();
+  }
 }
 
 void BatchHandler::maybeFlush() {
-  if (CurInodes->size() > BATCH_SIZE) {
+  if (Sizer.full(CurBytes, CurInodes->size())) {
     flush();
   }
 }
 
+std::shared_ptr<InputHandler> BatchHandler::fork() {
+  return std::make_shared<BatchHandler>(Sink);
+}
+
 void BatchHandler::flush() {
-  Sink->scheduleFileBatch(*CurDents, *CurInodes, CurStreams);
-  CurDents->clear();
-  CurInodes->clear();
+  if (!CurDents->size() && !CurInodes->size() && CurStreams->empty()) {
+    // e.g., a forked handler, flushed once its walk is done, then destroyed
+    return;
+  }
+
+  const Metrics& m = Metrics::global();
+  Sizer.observe(
+    m.count(Metrics::BYTES_READ), m.count(Metrics::FILES),
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count()
+  );
+  CurBytes = 0;
+
+  // the batches are handed over, and empty ones, likely recycled, taken
+  Sink->scheduleFileBatch(std::move(CurDents), std::move(CurInodes), CurStreams);
+  CurDents = Sink->newDirentBatch();
+  CurInodes = Sink->newInodeBatch();
   CurStreams.reset(new std::vector<std::unique_ptr<ReadSeek>>());
 }
 
@@ -0,0 +1,54 @@
+#include "batchsizer.h"
+
+#include <algorithm>
+
+namespace {
+  // weight of the newest sample in the moving averages
+  const double ALPHA = 0.3;
+
+  double smooth(double avg, double sample) {
+    return avg ? avg + ALPHA * (sample - avg) : sample;
+  }
+}
+
+BatchSizer::BatchSizer(double targetSeconds):
+  TargetSeconds(targetSeconds),
+  Started(false),
+  LastBytes(0),
+  LastFiles(0),
+  LastTime(0),
+  ByteRate(0),
+  FileRate(0),
+  MaxFiles(INITIAL_FILES),
+  MaxBytes(INITIAL_BYTES)
+{
+}
+
+void BatchSizer::observe(uint64_t bytesDone, uint64_t filesDone, double now) {
+  if (!Started) {
+    Started = true;
+    LastBytes = bytesDone;
+    LastFiles = filesDone;
+    LastTime = now;
+    return;
+  }
+
+  const double elapsed = now - LastTime;
+  if (elapsed < MIN_SAMPLE_INTERVAL) {
+    return;
+  }
+  if (filesDone == LastFiles && bytesDone == LastBytes) {
+    // nothing has finished yet, which says more about the pipeline
+    // filling than about throughput, so wait for a real sample
+    return;
+  }
+
+  ByteRate = smooth(ByteRate, (bytesDone - LastBytes) / elapsed);
+  FileRate = smooth(FileRate, (filesDone - LastFiles) / elapsed);
+  LastBytes = bytesDone;
+  LastFiles = filesDone;
+  LastTime = now;
+
+  MaxBytes = std::clamp(uint64_t(ByteRate * TargetSeconds), MIN_BYTES, MAX_BYTES);
+  MaxFiles = std::clamp(size_t(FileRate * TargetSeconds), MIN_FILES, MAX_FILES);
+}
@@ -0,0 +1,86 @@
+#include "blockcache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "metrics.h"
+
+BlockCache::BlockCache(uint64_t capacity, size_t blockSize):
+  BlockSize(blockSize),
+  BlocksPerShard(std::max<uint64_t>(1, capacity / blockSize / NUM_SHARDS)),
+  Shards(),
+  Hits(0),
+  Misses(0),
+  Evictions(0)
+{
+}
+
+BlockCache::Stats BlockCache::stats() const {
+  Stats ret;
+  ret.Hits = Hits.load();
+  ret.Misses = Misses.load();
+  ret.Evictions = Evictions.load();
+  return ret;
+}
+
+BlockCache::Data BlockCache::block(uint64_t index, const Fill& fill) {
+  Shard& shard = shardOf(index);
+  {
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+    const auto it = shard.Index.find(index);
+    if (it != shard.Index.end()) {
+      shard.Lru.splice(shard.Lru.begin(), shard.Lru, it->second);
+      ++Hits;
+      Metrics::global().add(Metrics::IMAGE_CACHE_HITS);
+      return it->second->second;
+    }
+  }
+
+  // Read without the lock, so other blocks of the shard can be had
+  // meanwhile. Two threads missing the same block both read it, and the
+  // first one in keeps it.
+  ++Misses;
+  Metrics::global().add(Metrics::IMAGE_CACHE_MISSES);
+  auto data = std::make_shared<std::vector<uint8_t>>(BlockSize);
+  const int64_t n = fill(index * BlockSize, data->data(), BlockSize);
+  if (n < 0) {
+    return nullptr;
+  }
+  data->resize(n);
+
+  std::lock_guard<std::mutex> lock(shard.Mutex);
+  const auto [it, added] = shard.Index.try_emplace(index);
+  if (!added) {
+    return it->second->second;
+  }
+  shard.Lru.emplace_front(index, std::move(data));
+  it->second = shard.Lru.begin();
+  if (shard.Lru.size() > BlocksPerShard) {
+    shard.Index.erase(shard.Lru.back().first);
+    shard.Lru.pop_back();
+    ++Evictions;
+  }
+  return shard.Lru.front().second;
+}
+
+int64_t BlockCache::read(uint64_t off, uint8_t* buf, size_t len, const Fill& fill) {
+  size_t done = 0;
+  while (done < len) {
+    const uint64_t pos = off + done;
+    const size_t within = pos % BlockSize;
+    const Data data = block(pos / BlockSize, fill);
+    if (!data) {
+      return done ? int64_t(done) : -1;
+    }
+    if (data->size() <= within) {
+      break; // past the end of the image
+    }
+    const size_t n = std::min(len - done, data->size() - within);
+    std::memcpy(buf + done, data->data() + within, n);
+    done += n;
+    if (data->size() < BlockSize) {
+      break; // the last block
+    }
+  }
+  return done;
+}
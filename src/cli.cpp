@@ -1,19 +1,74 @@
 #include "cli.h"
 
+#include <algorithm>
+#include <cctype>
 #include <filesystem>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
 #include <thread>
 
+#include <hasher/common.h>
+
 #include "throw.h"
 
 namespace po = boost::program_options;
 
+namespace {
+  // a number of bytes, with an optional K, M, G, or T suffix
+  uint64_t sizeFromString(const std::string& str, const std::string& opt) {
+    const std::string err = "'" + str + "' is not a valid option for " + opt;
+    size_t end = 0;
+    uint64_t size = 0;
+    try {
+      size = std::stoull(str, &end);
+    }
+    catch (const std::exception&) {
+      throw std::invalid_argument(err);
+    }
+    if (str[0] == '-') {
+      throw std::invalid_argument(err);
+    }
+
+    const std::string suffix = str.substr(end);
+    static const std::string units = "KMGT";
+    if (!suffix.empty()) {
+      const size_t shift = units.find(std::toupper(suffix[0]));
+      if (shift == std::string::npos || suffix.size() > 1 || size > UINT64_MAX >> (10 * (shift + 1))) {
+        throw std::invalid_argument(err);
+      }
+      size <<= 10 * (shift + 1);
+    }
+    return size;
+  }
+
+  uint64_t hashAlgFromName(const std::string& name) {
+    if (name == "md5") {
+      return SFHASH_MD5;
+    }
+    else if (name == "sha1") {
+      return SFHASH_SHA_1;
+    }
+    else if (name == "sha256") {
+      return SFHASH_SHA_2_256;
+    }
+    else if (name == "blake3") {
+      return SFHASH_BLAKE3;
+    }
+    else if (name == "fuzzy") {
+      return SFHASH_FUZZY;
+    }
+    return 0;
+  }
+}
+
 Cli::Cli() : All(), Opts(new Options) {
   // Command selection options
   po::options_description commands("Command selection -- in precedence order");
   commands.add_options()("help,h", "Display this help message")(
-      "version,V", "Print version information and exit");
+      "version,V", "Print version information and exit")(
+      "build-known-hashes", po::value<std::string>(&KnownHashesAlgSelect)->value_name("ALG"),
+      "Write the hex digests listed one per line in INPUT_FILE to OUTPUT as a known hash set (md5|sha1|sha256|blake3)");
 
   po::options_description ioOpts("Input/Output Options");
   ioOpts.add_options()
@@ -36,7 +91,66 @@ Cli::Cli() : All(), Opts(new Options) {
         po::value<unsigned int>(&Opts->NumThreads)
         ->default_value(std::thread::hardware_concurrency())
         ->value_name("THREADS"),
-        "Number of worker threads to use")
+        "Number of worker threads to use for hashing and searching")
+      ("io-threads",
+        po::value<unsigned int>(&Opts->IoThreads)
+        ->default_value(0)
+        ->value_name("THREADS"),
+        "Number of threads reading files ahead of the workers, for high-latency storage (0 to read on the workers)")
+      ("hashes",
+        po::value<std::string>(&HashesSelect)
+        ->default_value("md5,sha1,sha256,blake3,fuzzy")
+        ->value_name("ALGS"),
+        "Comma-separated hashes to compute for every file (md5|sha1|sha256|blake3|fuzzy); blake3 and any hashes used by rules are always computed")
+      ("known-hashes",
+        po::value<std::string>(&Opts->KnownHashes)
+        ->value_name("KNOWN_SET"),
+        "Known hash set, made with --build-known-hashes; files in it are hashed but not searched, except in images without enough --image-cache to read them twice, where they are searched as they are hashed")
+      ("scan-cache",
+        po::value<std::string>(&Opts->ScanCache)
+        ->value_name("CACHE_FILE"),
+        "Reuse hashes and search hits for unchanged files from earlier runs, and save this run's; created if missing")
+      ("all-hits",
+        po::bool_switch(&Opts->AllHits),
+        "Record every search hit in a file, rather than stopping its search once the hits decide every rule's grep condition")
+      ("max-hits-per-pattern",
+        po::value<uint64_t>(&Opts->MaxHitsPerPattern)
+        ->default_value(0)
+        ->value_name("HITS"),
+        "Most hits to keep for each pattern in a file (0 for no limit); dropped hits are counted in search_hits_overflow")
+      ("max-hits-per-file",
+        po::value<uint64_t>(&Opts->MaxHitsPerFile)
+        ->default_value(0)
+        ->value_name("HITS"),
+        "Most hits to keep for each file (0 for no limit); dropped hits are counted in search_hits_overflow")
+      ("io-queue-depth",
+        po::value<unsigned int>(&Opts->IoQueueDepth)
+        ->default_value(0)
+        ->value_name("DEPTH"),
+        "Reads to keep in flight per file for directory inputs, using io_uring where available (0 to read synchronously)")
+      ("image-cache",
+        po::value<std::string>(&ImageCacheSelect)
+        ->default_value("256M")
+        ->value_name("SIZE"),
+        "Memory for caching blocks read from images, shared by all threads, in bytes or with a K, M, G, or T suffix (0 for none); saves decompressing E01 chunks again. Counts against --memory-limit, and defaults to no more than a quarter of it")
+      ("walk-threads",
+        po::value<unsigned int>(&Opts->WalkThreads)
+        ->default_value(1)
+        ->value_name("THREADS"),
+        "Threads to walk the file systems in an image with, splitting them by directory (1 to walk each whole); up to --num-threads file systems are walked at once")
+      ("disk-order",
+        po::bool_switch(&Opts->DiskOrder),
+        "Read queued files in order of where their data starts in the image, rather than largest first; faster on spinning disks and compressed images")
+      ("memory-limit",
+        po::value<std::string>(&MemoryLimitSelect)
+        ->default_value("0")
+        ->value_name("SIZE"),
+        "Memory to let batches in flight take, roughly, in bytes or with a K, M, G, or T suffix (0 for no limit); reading waits and results are flushed early to stay within it")
+      ("progress-interval",
+        po::value<unsigned int>(&Opts->ProgressInterval)
+        ->default_value(10)
+        ->value_name("SECONDS"),
+        "Seconds between progress lines on stderr (0 for none); a full report is written to metrics.json in the output directory")
       ("keywords-file,k",
         po::value<std::vector<std::string>>(&Opts->KeyFiles)
         ->composing()
@@ -59,6 +173,10 @@ std::shared_ptr<Options> Cli::parse(int argc, const char* const argv[]) const {
 
   Opts->Command = figureOutCommand(optsMap);
   Opts->OutputCodec = figureOutCodec();
+  Opts->HashAlgs = figureOutHashes();
+  Opts->KnownHashesAlg = Opts->Command == "build-known-hashes" ? figureOutKnownHashesAlg() : 0;
+  Opts->MemoryLimit = figureOutMemoryLimit();
+  Opts->ImageCacheSize = figureOutImageCacheSize(optsMap);
 
   validateOpts();
 
@@ -85,13 +203,16 @@ std::string Cli::figureOutCommand(
   if (optsMap.count("version")) {
     return "version";
   }
-  // default is "search"; check required args
+  // the rest need both output and input; default is "search"
   if (optsMap.count("output") == 0) {
     throw std::invalid_argument("No output file was specified");
   }
   if (optsMap.count("input") == 0) {
     throw std::invalid_argument("No input file/directory was specified");
   }
+  if (optsMap.count("build-known-hashes")) {
+    return "build-known-hashes";
+  }
   return "search";
 }
 
@@ -120,12 +241,52 @@ Codec Cli::figureOutCodec() const {
   throw std::invalid_argument("'" + CodecSelect + "' is not a valid option for --codec");
 }
 
+uint64_t Cli::figureOutHashes() const {
+  uint64_t algs = 0;
+  std::istringstream in(HashesSelect);
+  std::string alg;
+  while (std::getline(in, alg, ',')) {
+    const uint64_t a = hashAlgFromName(alg);
+    if (!a) {
+      throw std::invalid_argument("'" + alg + "' is not a valid option for --hashes");
+    }
+    algs |= a;
+  }
+  return algs;
+}
+
+uint64_t Cli::figureOutKnownHashesAlg() const {
+  const uint64_t alg = hashAlgFromName(KnownHashesAlgSelect);
+  if (!alg || alg == SFHASH_FUZZY) {
+    throw std::invalid_argument("'" + KnownHashesAlgSelect + "' is not a valid option for --build-known-hashes");
+  }
+  return alg;
+}
+
+uint64_t Cli::figureOutMemoryLimit() const {
+  return sizeFromString(MemoryLimitSelect, "--memory-limit");
+}
+
+uint64_t Cli::figureOutImageCacheSize(const boost::program_options::variables_map& optsMap) const {
+  const uint64_t size = sizeFromString(ImageCacheSelect, "--image-cache");
+  // the cache comes out of the memory limit, so the default leaves most
+  // of a small limit to the pipeline
+  if (optsMap["image-cache"].defaulted() && Opts->MemoryLimit) {
+    return std::min(size, Opts->MemoryLimit / 4);
+  }
+  return size;
+}
+
 void Cli::validateOpts() const {
   if (!Opts->RuleFile.empty()) {
     THROW_IF(!std::filesystem::exists(Opts->RuleFile), "Rule file " + Opts->RuleFile + " not found.");
     THROW_IF(!std::filesystem::is_regular_file(Opts->RuleFile), "Rule file " + Opts->RuleFile + " is not a file.");
   }
 
+  if (!Opts->KnownHashes.empty()) {
+    THROW_IF(!std::filesystem::is_regular_file(Opts->KnownHashes), "Known hash set " + Opts->KnownHashes + " not found.");
+  }
+
   if (!Opts->RuleDir.empty()) {
     THROW_IF(!std::filesystem::exists(Opts->RuleDir), "Rule directory " + Opts->RuleDir + " not found.");
     THROW_IF(!std::filesystem::is_directory(Opts->RuleDir), "Rule directory " + Opts->RuleDir + " is not a directory.");
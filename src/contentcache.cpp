@@ -0,0 +1,52 @@
+#include "contentcache.h"
+
+#include <cstring>
+
+size_t ContentCache::DigestHash::operator()(const Digest& d) const {
+  // the digest is already uniformly distributed
+  size_t h;
+  std::memcpy(&h, d.data(), sizeof(h));
+  return h;
+}
+
+bool ContentCache::insert(const Digest& digest) {
+  Shard& s = shard(DigestHash()(digest));
+  std::lock_guard<std::mutex> lock(s.Mutex);
+  return s.Digests.insert(digest).second;
+}
+
+bool ContentCache::contains(const Digest& digest) const {
+  const Shard& s = shard(DigestHash()(digest));
+  std::lock_guard<std::mutex> lock(s.Mutex);
+  return s.Digests.find(digest) != s.Digests.end();
+}
+
+void ContentCache::addFingerprint(uint64_t fp) {
+  Shard& s = shard(fp);
+  std::lock_guard<std::mutex> lock(s.Mutex);
+  s.Fingerprints.insert(fp);
+}
+
+bool ContentCache::hasFingerprint(uint64_t fp) const {
+  const Shard& s = shard(fp);
+  std::lock_guard<std::mutex> lock(s.Mutex);
+  return s.Fingerprints.find(fp) != s.Fingerprints.end();
+}
+
+size_t ContentCache::size() const {
+  size_t ret = 0;
+  for (const Shard& s : Shards) {
+    std::lock_guard<std::mutex> lock(s.Mutex);
+    ret += s.Digests.size();
+  }
+  return ret;
+}
+
+uint64_t ContentCache::fingerprint(uint64_t size, const uint8_t* prefix, size_t len) {
+  // FNV-1a over the prefix, seeded with the size
+  uint64_t h = 14695981039346656037ull ^ size;
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ prefix[i]) * 1099511628211ull;
+  }
+  return h;
+}
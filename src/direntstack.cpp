@@ -2,6 +2,11 @@
 #include "hex.h"
 #include "recordhasher.h"
 
+void DirentStack::reset(const std::string& basePath) {
+  Stack = std::stack<Element>();
+  Path = basePath;
+}
+
 bool DirentStack::empty() const {
   return Stack.empty();
 }
@@ -5,20 +5,35 @@
 #include "hex.h"
 #include "inputhandler.h"
 #include "outputhandler.h"
+#include "readseek_impl.h"
 
 #include <filesystem>
 #include <iostream>
 
 namespace fs = std::filesystem;
 
-DirReader::DirReader(const std::string& path):
+DirReader::DirReader(const std::string& path, unsigned int ioQueueDepth):
   Root(path),
+  IoQueueDepth(ioQueueDepth),
   Input(),
   RecHasher(),
-  Dirents(RecHasher)
+  Dirents(RecHasher),
+  PathHasher(),
+  NextAddr(1)
 {
 }
 
+uint64_t DirReader::pathAddr(const std::string& path) {
+  // std::hash differs between standard libraries, so the BLAKE3 of the
+  // path is used instead, read little-endian
+  const FieldHash h = PathHasher.hash(path);
+  uint64_t ret = 0;
+  for (size_t i = 0; i < sizeof(ret); ++i) {
+    ret |= uint64_t(h.hash[i]) << (8 * i);
+  }
+  return ret;
+}
+
 void DirReader::setInputHandler(const std::shared_ptr<InputHandler>& in) {
   Input = in;
 }
@@ -92,7 +107,32 @@ void DirReader::handleFile(const fs::directory_entry& de) {
     Input->maybeFlush();
   }
 
-  Input->push(Conv.convertStdFsDEtoDirent(de));
+  Dirent dirent = Conv.convertStdFsDEtoDirent(de);
+  if (DirUtils::fileType(de) == fs::file_type::regular) {
+    // there are no inode numbers to speak of, so number the files ourselves
+    Inode inode = Conv.convertStdFsDEtoInode(de);
+    inode.Addr = dirent.MetaAddr = NextAddr++;
+    inode.Filesize = DirUtils::fileSize(de);
+    Input->push(inode);
+    std::unique_ptr<ReadSeek> stream;
+#if !defined(_WIN32)
+    if (IoQueueDepth) {
+      stream = std::make_unique<ReadSeekAsync>(p.string(), inode.Addr, IoQueueDepth);
+    }
+    else
+#endif
+    {
+      stream = std::make_unique<ReadSeekMMap>(p.string(), inode.Addr, inode.Filesize);
+    }
+    // our inode numbers depend on the walk, so the path stands in for them
+    std::error_code err;
+    const auto mtime = de.last_write_time(err).time_since_epoch().count();
+    stream->setIdentity(FileIdentity{
+      0, pathAddr(path), 0, inode.Filesize, std::to_string(mtime)
+    });
+    Input->push(std::move(stream));
+  }
+  Input->push(dirent);
 /*
   Input->push({
     Conv.convertMeta(de),
@@ -1,109 +1,494 @@
 #include "filescheduler.h"
 
+#include <algorithm>
+#include <atomic>
+
 #include "direntbatch.h"
 #include "filerecord.h"
 #include "duckinode.h"
+#include "metrics.h"
 #include "options.h"
 #include "outputhandler.h"
 #include "processor.h"
+#include "throw.h"
+
+namespace {
+  uint64_t budgetFor(const Options& opts) {
+    if (!opts.MemoryLimit) {
+      return 0;
+    }
+    // the read-ahead buffers and the image cache are allocated whole
+    const uint64_t readAhead = uint64_t(opts.IoThreads) * FileScheduler::READ_AHEAD_BUFFERS * FileScheduler::READ_AHEAD_BLOCK;
+    const uint64_t setAside = readAhead + opts.ImageCacheSize;
+    THROW_IF(setAside >= opts.MemoryLimit, "The memory limit is too small for the read-ahead buffers and the image cache");
+    return opts.MemoryLimit - setAside;
+  }
+}
+
+struct FileScheduler::LargeFileJob {
+  LargeFileJob(std::unique_ptr<ReadSeek> stream, uint64_t size, size_t numSegments, const std::shared_ptr<SFHASH_Hasher>& hasher):
+    Stream(std::move(stream)), Size(size), SegmentHits(numSegments), SegmentDropped(numSegments), Hasher(hasher),
+    Mutex(), Data(numSegments), Read(numSegments, false), NextQueued(0), NextHashed(0), Hashing(false), Failed(false) {}
+
+  size_t numSegments() const { return SegmentHits.size(); }
 
+  uint64_t segmentBegin(size_t i) const { return i * SEGMENT_SIZE; }
+  uint64_t segmentEnd(size_t i) const { return std::min(segmentBegin(i) + SEGMENT_SIZE, Size); }
+
+  std::unique_ptr<ReadSeek> Stream; // closed; each segment is read through a stream of its own
+  const uint64_t Size; // as of when Stream was open
+  std::vector<std::vector<LG_SearchHit>> SegmentHits;
+  std::vector<std::vector<uint64_t>> SegmentDropped; // hits dropped by the hit limits, by keyword index
+  std::shared_ptr<SFHASH_Hasher> Hasher; // used by one thread at a time, with Hashing set
+
+  std::mutex Mutex;
+  std::vector<std::vector<uint8_t>> Data; // segments read, until hashed, under Mutex
+  std::vector<bool> Read; // under Mutex
+  size_t NextQueued; // under Mutex
+  size_t NextHashed; // under Mutex
+  bool Hashing; // under Mutex
+  bool Failed; // a segment read short, under Mutex
+};
 
 FileScheduler::FileScheduler(LlamaDB& db,
                              boost::asio::thread_pool& pool,
                              const std::shared_ptr<Processor>& protoProc,
                              const std::shared_ptr<Options>& opts)
-    : DBConn(db), Pool(pool), Strand(Pool.get_executor()),
-      ProcMutex(), ProcCV() {
-  for (unsigned int i = 0; i < opts->NumThreads; ++i) {
-    Processors.push_back(protoProc->clone());
+    : Budget(std::make_shared<MemoryBudget>(budgetFor(*opts))),
+      DirentBatches(MAX_POOLED_BATCHES), InodeBatches(MAX_POOLED_BATCHES),
+      DBConn(db), DirentAppender(DBConn.get(), "dirent"), InodeAppender(DBConn.get(), "inode"),
+      Pool(pool), IngestStrand(Pool.get_executor()), Strand(Pool.get_executor()),
+      Workers(), Files(std::max(1u, opts->NumThreads)), NextQueue(0), DiskOrder(opts->DiskOrder),
+      WorkerMutex(), Active(Files.numWorkers(), false), RoomCV(), RoomWaiters(0), Unscheduled(0),
+      ReadBuffers(), Ready(), ReaderCV(), InputDone(false), Stopping(false), ReadersRunning(opts->IoThreads),
+      PoolGuard(), Readers(),
+      LargeProc(protoProc->clone()), LargeProcMutex(),
+      MaxLargeJobs(std::max<size_t>(1, Files.numWorkers() / SEGMENTS_IN_FLIGHT)), LargeJobs(0),
+      Segments(), SegmentsQueued(0) {
+  for (size_t i = 0; i < Files.numWorkers(); ++i) {
+    Workers.push_back(protoProc->clone());
+    Workers.back()->setMemoryBudget(Budget);
+  }
+  if (opts->IoThreads) {
+    PoolGuard.emplace(boost::asio::make_work_guard(Pool));
+    for (size_t r = 0; r < opts->IoThreads; ++r) {
+      ReadBuffers.push_back(std::make_unique<BufferPool>(READ_AHEAD_BUFFERS, READ_AHEAD_BLOCK));
+    }
+    for (size_t r = 0; r < opts->IoThreads; ++r) {
+      Readers.emplace_back(&FileScheduler::runReader, this, r);
+    }
   }
 }
 
-void FileScheduler::scheduleFileBatch(const DirentBatch& dirents,
-                                      const InodeBatch& inodes,
+FileScheduler::~FileScheduler() {
+  {
+    // normally the readers are done already, but not if the run failed
+    std::lock_guard<std::mutex> lock(WorkerMutex);
+    InputDone = Stopping = true;
+  }
+  ReaderCV.notify_all();
+  RoomCV.notify_all();
+  for (auto& t : Readers) {
+    t.join();
+  }
+}
+
+void FileScheduler::finish() {
+  // after every batch already posted to the strand
+  boost::asio::post(Strand, [this]() {
+    {
+      std::lock_guard<std::mutex> lock(WorkerMutex);
+      InputDone = true;
+    }
+    ReaderCV.notify_all();
+  });
+}
+
+void FileScheduler::scheduleFileBatch(std::unique_ptr<DirentBatch> dirents,
+                                      std::unique_ptr<InodeBatch> inodes,
                                       const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams)
 {
-  // here we copy the batches in the lambda capture, so that the passed-in batches
-  // can be reused by the caller while the scheduler does its work on a separate thread
-  auto dPtr = std::make_shared<DirentBatch>(dirents);
-  auto iPtr = std::make_shared<InodeBatch>(inodes);
+  // The batches and the queued files are charged to the budget until
+  // they're ingested and processed, respectively. The reader waits here
+  // for the pipeline to drain if they don't fit.
+  const uint64_t entryBytes = dirents->bytes() + inodes->bytes();
+  {
+    Metrics::Latency waitTime(Metrics::MEMORY_WAIT_NS);
+    Budget->acquire(entryBytes + streams->size() * STREAM_BYTES);
+  }
+  {
+    // Bounding the queues adds back pressure here too, as the reader can't
+    // get far ahead of the workers. The files of batches not yet dealt out
+    // count as queued. This waits on the reader's thread, not on the pool,
+    // whose threads are needed to make room.
+    Metrics::Latency waitTime(Metrics::QUEUE_WAIT_NS);
+    std::unique_lock<std::mutex> lock(WorkerMutex);
+    const size_t maxQueued = MAX_QUEUED_PER_WORKER * Files.numWorkers();
+    ++RoomWaiters;
+    RoomCV.wait(lock, [&]() { return Files.pending() + Unscheduled < maxQueued || Stopping; });
+    --RoomWaiters;
+    Unscheduled += streams->size();
+  }
+
+  Metrics::global().add(Metrics::BATCHES_QUEUED);
+  // the metadata goes in on a strand of its own, so the files can be
+  // dispatched without waiting for it; then the batches go back to the
+  // reader, empty
+  boost::asio::post(
+    IngestStrand,
+    [this, dirents = std::move(dirents), inodes = std::move(inodes), entryBytes]() mutable {
+      ingestEntries(*dirents, *inodes, entryBytes);
+      DirentBatches.give(std::move(dirents));
+      InodeBatches.give(std::move(inodes));
+    }
+  );
   boost::asio::post(
     Strand,
     [=]() {
-      performScheduling(*dPtr, *iPtr, streams);
+      performScheduling(streams);
     }
   );
 }
 
 double FileScheduler::getProcessorTime() {
   double ret = 0;
-  for (auto& p : Processors) {
+  for (auto& p : Workers) {
     ret += p->getProcessorTime();
   }
+  ret += LargeProc->getProcessorTime();
   return ret;
 }
 
-void FileScheduler::performScheduling(DirentBatch& dirents,
-                                      InodeBatch& inodes,
-                                      const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams)
-{
-  std::string tmpDents = "_temp_dirent";
-  std::string tmpInodes = "_temp_inode";
-  //std::string batchTbl = "_temp_batch_" + randomNumString();
-
-  DBType<Dirent>::createTable(DBConn.get(), tmpDents);
-  DBType<Inode>::createTable(DBConn.get(), tmpInodes);
-
-  LlamaDBAppender dAppender(DBConn.get(), tmpDents);
-  LlamaDBAppender iAppender(DBConn.get(), tmpInodes);
-
-  dirents.copyToDB(dAppender.get());
-  dAppender.flush();
-  inodes.copyToDB(iAppender.get());
-  iAppender.flush();
-
-  duckdb_result result;
-  auto state = duckdb_query(DBConn.get(), "INSERT INTO dirent SELECT * FROM _temp_dirent;", &result);
-  THROW_IF(state == DuckDBError, "Error inserting into dirent table");
-  state = duckdb_query(DBConn.get(), "INSERT INTO inode SELECT * FROM _temp_inode;", &result);
-  THROW_IF(state == DuckDBError, "Error inserting into inode table");
-
-  state = duckdb_query(DBConn.get(), "DROP TABLE _temp_dirent;", &result);
-  THROW_IF(state == DuckDBError, "Error dropping _temp_dirent table");
-  state = duckdb_query(DBConn.get(), "DROP TABLE _temp_inode;", &result);
-  THROW_IF(state == DuckDBError, "Error dropping _temp_inode table");
-
-  // post for multithreaded processing
-  auto proc = popProc(); // blocks
-  boost::asio::post(Pool, [=]() {
-    for (auto& stream : *streams) {
-      if (stream->open()) {
-        proc->process(*stream);
-        stream->close();
+void FileScheduler::performScheduling(const std::shared_ptr<std::vector<std::unique_ptr<ReadSeek>>>& streams) {
+  // The files are dealt out round-robin, so every worker gets a share of
+  // the large ones, which it'll start on first. In disk order, each worker
+  // instead sweeps forward through the image alongside the others.
+  for (auto& stream : *streams) {
+    const uint64_t p = priority(*stream, DiskOrder);
+    Files.push(NextQueue, p, std::move(stream));
+    NextQueue = (NextQueue + 1) % Files.numWorkers();
+  }
+  Metrics::global().add(Metrics::BATCHES_DONE);
+
+  std::lock_guard<std::mutex> lock(WorkerMutex);
+  Unscheduled -= streams->size();
+  if (Readers.empty()) {
+    wakeWorkers();
+  }
+  else {
+    ReaderCV.notify_all();
+  }
+}
+
+void FileScheduler::wakeWorkers() {
+  const bool haveFiles = !Segments.empty() || (Readers.empty() ? Files.pending() : !Ready.empty());
+  for (size_t w = 0; w < Workers.size() && haveFiles; ++w) {
+    if (!Active[w]) {
+      Active[w] = true;
+      boost::asio::post(Pool, [this, w]() { runWorker(w); });
+    }
+  }
+}
+
+void FileScheduler::madeRoom() {
+  if (RoomWaiters) {
+    // holding the lock ensures the readers are already waiting
+    std::lock_guard<std::mutex> lock(WorkerMutex);
+    RoomCV.notify_all();
+  }
+}
+
+bool FileScheduler::takeSegment(std::function<void()>& task) {
+  if (!SegmentsQueued) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(WorkerMutex);
+  if (Segments.empty()) {
+    return false;
+  }
+  task = std::move(Segments.front());
+  Segments.pop_front();
+  --SegmentsQueued;
+  return true;
+}
+
+bool FileScheduler::takeFile(size_t w, std::unique_ptr<ReadSeek>& stream) {
+  if (Readers.empty()) {
+    if (Files.pop(w, stream)) {
+      madeRoom();
+      return true;
+    }
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(WorkerMutex);
+  if (Ready.empty()) {
+    return false;
+  }
+  stream = std::move(Ready.front());
+  Ready.pop_front();
+  ReaderCV.notify_all();
+  return true;
+}
+
+void FileScheduler::runReader(size_t r) {
+  const size_t maxReady = MAX_READY_PER_WORKER * Workers.size();
+  std::unique_ptr<ReadSeek> stream;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(WorkerMutex);
+      ReaderCV.wait(lock, [this]() { return Files.pending() || InputDone; });
+      if (!Files.pending() || Stopping) {
+        // InputDone, and nothing left to read
+        if (--ReadersRunning == 0) {
+          PoolGuard.reset();
+        }
+        return;
       }
     }
-    proc->flush();
-    this->pushProc(proc);
-  });
+    if (!Files.pop(r % Files.numWorkers(), stream)) {
+      continue; // another reader got there first
+    }
+    madeRoom();
+
+    std::function<void()> fill;
+    stream = readAhead(r, std::move(stream), fill);
+    {
+      // Ready is first come, first served, so a stream holding this
+      // reader's buffers is always taken before the one it's filling
+      std::unique_lock<std::mutex> lock(WorkerMutex);
+      ReaderCV.wait(lock, [&]() { return Ready.size() < maxReady || Stopping; });
+      Ready.push_back(std::move(stream));
+      wakeWorkers();
+    }
+    if (fill) {
+      fill();
+    }
+  }
+}
+
+std::unique_ptr<ReadSeek> FileScheduler::readAhead(size_t r, std::unique_ptr<ReadSeek> stream, std::function<void()>& fill) {
+  // cached files mostly aren't read, and large files are read in segments
+  if (LargeProc->isCached(*stream) || !stream->open()) {
+    return stream;
+  }
+  if (stream->size() >= LARGE_FILE_SIZE) {
+    stream->close();
+    return stream;
+  }
+  auto ra = std::make_unique<ReadAheadStream>(std::move(stream), *ReadBuffers[r]);
+  fill = ra->filler();
+  return ra;
+}
+
+uint64_t FileScheduler::priority(const ReadSeek& stream, bool diskOrder) {
+  if (diskOrder) {
+    // The queued files make the reorder window. Files without an offset,
+    // e.g., resident ones, are read with their metadata, so go first.
+    return stream.diskOffset() ? ~*stream.diskOffset() : UINT64_MAX;
+  }
+  // the size isn't known until a stream is open, but the reader may have
+  // recorded it
+  return stream.identity() ? stream.identity()->Filesize : stream.size();
+}
+
+void FileScheduler::runWorker(size_t w) {
+  Processor& proc = *Workers[w];
+  std::unique_ptr<ReadSeek> stream;
+  std::function<void()> segment;
+  size_t unflushed = 0;
+  while (true) {
+    while (true) {
+      // segments go first, as their buffers are held until hashed
+      if (takeSegment(segment)) {
+        segment();
+        continue;
+      }
+      if (!takeFile(w, stream)) {
+        break;
+      }
+      processStream(proc, stream);
+      if (stream) {
+        // a large file's job gives the charge back once it's recorded
+        stream.reset();
+        Budget->release(STREAM_BYTES);
+      }
+      proc.chargeMemory();
+      if (++unflushed >= FLUSH_FILES) {
+        proc.flush();
+        unflushed = 0;
+      }
+    }
+    proc.flush();
+    unflushed = 0;
+
+    // files queued before this are seen here, and after it by whoever
+    // queued them, who then restarts this worker
+    std::lock_guard<std::mutex> lock(WorkerMutex);
+    if (Segments.empty() && (Readers.empty() ? !Files.pending() : Ready.empty())) {
+      Active[w] = false;
+      return;
+    }
+  }
+}
+
+void FileScheduler::processStream(Processor& proc, std::unique_ptr<ReadSeek>& stream) {
+  if (stream->open()) {
+    // cached files needn't be read at all, unless their content was
+    // never searched, so they're left to proc
+    if (stream->size() >= LARGE_FILE_SIZE && !proc.isCached(*stream) && processLargeFile(stream)) {
+      return;
+    }
+    proc.process(*stream);
+    stream->close();
+  }
+}
+
+void FileScheduler::ingestEntries(DirentBatch& dirents, InodeBatch& inodes, uint64_t charged) {
+  {
+    Metrics::Latency ingestTime(Metrics::INGEST_NS);
+    dirents.copyToDB(DirentAppender.get());
+    DirentAppender.flush();
+    inodes.copyToDB(InodeAppender.get());
+    InodeAppender.flush();
+  }
+  Budget->release(charged);
 }
 
-std::shared_ptr<Processor> FileScheduler::popProc() {
-  // Having a fixed number of Processor objects adds back pressure to
-  // FileScheduler here -- it cannot dispatch more batches beyond the
-  // size of the Processor pool.
-  std::unique_lock<std::mutex> lock(ProcMutex);
-  while (Processors.empty()) {
-    // Releases mutex inside wait(), but reacquires before returning
-    ProcCV.wait(lock);
+bool FileScheduler::processLargeFile(std::unique_ptr<ReadSeek>& stream) {
+  if (!std::unique_ptr<ReadSeek>(stream->reopen())) {
+    return false;
   }
-  auto batterUp = Processors.back();
-  Processors.pop_back();
-  return batterUp;
+
+  // At the cap, this thread helps with the segments of the large files in
+  // flight until one is done. If they're all taken, it's quicker to read
+  // this file here than to wait.
+  std::function<void()> segment;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(WorkerMutex);
+      if (LargeJobs < MaxLargeJobs) {
+        ++LargeJobs;
+        break;
+      }
+    }
+    if (!takeSegment(segment)) {
+      return false;
+    }
+    segment();
+  }
+
+  // Every segment is read through a stream of its own, since a stream may
+  // hold a handle for as long as it's open, so this one is closed here.
+  const uint64_t size = stream->size();
+  stream->close();
+  const size_t numSegments = (size + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+  queueSegments(std::make_shared<LargeFileJob>(std::move(stream), size, numSegments, LargeProc->makeHasher()));
+  return true;
 }
 
-void FileScheduler::pushProc(const std::shared_ptr<Processor>& proc) {
-  std::unique_lock<std::mutex> lock(ProcMutex);
-  Processors.push_back(proc);
-  ProcCV.notify_one();
+void FileScheduler::queueSegments(const std::shared_ptr<LargeFileJob>& job) {
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(job->Mutex);
+    while (job->NextQueued < job->numSegments() && job->NextQueued < job->NextHashed + SEGMENTS_IN_FLIGHT) {
+      const size_t i = job->NextQueued++;
+      std::shared_ptr<ReadSeek> r(job->Stream->reopen());
+      tasks.emplace_back([this, job, i, r]() {
+        const uint64_t beg = job->segmentBegin(i);
+        const uint64_t end = job->segmentEnd(i);
+        // held until hashed; the in-flight segments are few enough that
+        // they needn't wait for room
+        Budget->charge(end - beg);
+        std::vector<uint8_t> data;
+        if (r && r->open()) {
+          job->SegmentHits[i] = LargeProc->searchSegment(*r, beg, end, SEGMENT_OVERLAP, &job->SegmentDropped[i], &data);
+          r->close();
+        }
+        hashSegments(job, i, std::move(data));
+      });
+    }
+  }
+  if (!tasks.empty()) {
+    std::lock_guard<std::mutex> lock(WorkerMutex);
+    for (auto& task : tasks) {
+      Segments.push_back(std::move(task));
+    }
+    SegmentsQueued += tasks.size();
+    wakeWorkers();
+  }
 }
 
+void FileScheduler::hashSegments(const std::shared_ptr<LargeFileJob>& job, size_t i, std::vector<uint8_t>&& data) {
+  std::unique_lock<std::mutex> lock(job->Mutex);
+  job->Data[i] = std::move(data);
+  job->Read[i] = true;
+  if (job->Hashing) {
+    // the thread at it gets to this one, too
+    return;
+  }
+  job->Hashing = true;
+  while (job->NextHashed < job->numSegments() && job->Read[job->NextHashed]) {
+    const size_t h = job->NextHashed;
+    const uint64_t len = job->segmentEnd(h) - job->segmentBegin(h);
+    std::vector<uint8_t> piece(std::move(job->Data[h]));
+    const bool failed = job->Failed || piece.size() != len;
+    lock.unlock();
+
+    if (!failed) {
+      LargeProc->hashPiece(job->Hasher.get(), piece);
+    }
+    piece = std::vector<uint8_t>();
+    Budget->release(len);
+
+    lock.lock();
+    job->Failed = failed;
+    ++job->NextHashed;
+    lock.unlock();
+    // there's room for another segment to be read
+    queueSegments(job);
+    lock.lock();
+  }
+  job->Hashing = false;
+  const bool finished = job->NextHashed == job->numSegments();
+  lock.unlock();
+  if (finished) {
+    finishLargeFile(*job);
+  }
+}
+
+void FileScheduler::finishLargeFile(LargeFileJob& job) {
+  SFHASH_HashValues hashes{};
+  if (job.Failed) {
+    // a segment couldn't be read whole, so the hashes are of what a pass
+    // over the whole file reads, as for any other file
+    std::unique_ptr<ReadSeek> r(job.Stream->reopen());
+    if (r && r->open()) {
+      hashes = LargeProc->hashStream(*r);
+      r->close();
+    }
+  }
+  else {
+    sfhash_get_hashes(job.Hasher.get(), &hashes);
+  }
+
+  std::vector<LG_SearchHit> hits;
+  std::vector<uint64_t> dropped;
+  for (size_t i = 0; i < job.SegmentHits.size(); ++i) {
+    hits.insert(hits.end(), job.SegmentHits[i].begin(), job.SegmentHits[i].end());
+    dropped.resize(std::max(dropped.size(), job.SegmentDropped[i].size()), 0);
+    for (size_t k = 0; k < job.SegmentDropped[i].size(); ++k) {
+      dropped[k] += job.SegmentDropped[i][k];
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(LargeProcMutex);
+    LargeProc->addFile(*job.Stream, hashes, std::move(hits), dropped);
+    LargeProc->flush();
+  }
+  {
+    std::lock_guard<std::mutex> lock(WorkerMutex);
+    --LargeJobs;
+  }
+  Budget->release(STREAM_BYTES);
+}
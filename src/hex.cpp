@@ -12,3 +12,31 @@ std::string hexEncode(const void* b, const void* e) {
   return hexEncode(b, static_cast<const uint8_t*>(e) -
                       static_cast<const uint8_t*>(b));
 }
+
+namespace {
+  int hexVal(char c) {
+    if ('0' <= c && c <= '9') {
+      return c - '0';
+    }
+    c |= 0x20;
+    if ('a' <= c && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    return -1;
+  }
+}
+
+bool hexDecode(const std::string& hex, void* buf, size_t size) {
+  if (hex.size() != 2 * size) {
+    return false;
+  }
+  uint8_t* out = static_cast<uint8_t*>(buf);
+  for (size_t i = 0; i < size; ++i) {
+    const int hi = hexVal(hex[2 * i]), lo = hexVal(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+    out[i] = (hi << 4) | lo;
+  }
+  return true;
+}
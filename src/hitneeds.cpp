@@ -0,0 +1,270 @@
+#include "hitneeds.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "parser.h"
+
+namespace {
+  bool compare(uint64_t n, uint64_t op, uint64_t v) {
+    switch (op) {
+      case LlamaOp::EQUAL_EQUAL: return n == v;
+      case LlamaOp::NOT_EQUAL: return n != v;
+      case LlamaOp::GREATER_THAN: return n > v;
+      case LlamaOp::GREATER_THAN_EQUAL: return n >= v;
+      case LlamaOp::LESS_THAN: return n < v;
+      case LlamaOp::LESS_THAN_EQUAL: return n <= v;
+      default: return false;
+    }
+  }
+}
+
+HitNeeds::HitNeeds(const std::vector<Rule>& rules, const LlamaParser& parser,
+                   const std::vector<std::pair<size_t, std::string_view>>& keywordPatterns)
+{
+  // number each rule's patterns, in the order lightgrep has them
+  std::vector<std::unordered_map<std::string_view, size_t>> patternIds(rules.size());
+  for (const auto& [rule, name] : keywordPatterns) {
+    auto it = patternIds[rule].find(name);
+    if (it == patternIds[rule].end()) {
+      it = patternIds[rule].emplace(name, PatternRule.size()).first;
+      PatternRule.push_back(rule);
+    }
+    KeywordPattern.push_back(it->second);
+  }
+  PatternQualifiers.resize(PatternRule.size());
+
+  for (size_t r = 0; r < rules.size(); ++r) {
+    std::vector<size_t> rulePatterns;
+    std::vector<std::string_view> ruleNames;
+    for (const auto& [name, id] : patternIds[r]) {
+      ruleNames.push_back(name);
+      rulePatterns.push_back(id);
+    }
+    RuleGreps.push_back(!rulePatterns.empty());
+    RuleRoots.push_back(rules[r].Grep.Condition ?
+      compile(rules[r].Grep.Condition, parser, rulePatterns, ruleNames) : NO_COND);
+  }
+
+  Initial.Counts.assign(PatternRule.size(), 0);
+  Initial.Qualified.assign(NumQualifiers, false);
+  Initial.Settled.assign(rules.size(), false);
+  Initial.Unsettled = rules.size();
+  for (size_t r = 0; r < rules.size(); ++r) {
+    settle(Initial, r);
+  }
+}
+
+size_t HitNeeds::compile(const std::shared_ptr<Node>& node, const LlamaParser& parser, const std::vector<size_t>& rulePatterns,
+                         const std::vector<std::string_view>& ruleNames)
+{
+  Cond cond;
+  if (node->Type == NodeType::BOOL) {
+    cond.Type = std::static_pointer_cast<BoolNode>(node)->Operation == BoolNode::Op::AND ? Cond::AND : Cond::OR;
+    cond.Left = compile(node->Left, parser, rulePatterns, ruleNames);
+    cond.Right = compile(node->Right, parser, rulePatterns, ruleNames);
+    Conds.push_back(cond);
+    return Conds.size() - 1;
+  }
+
+  const Function& func = std::static_pointer_cast<FuncNode>(node)->Value;
+  if (func.Operator != SIZE_MAX) {
+    const LlamaTokenType opType = parser.Tokens[func.Operator].Type;
+    cond.Op = opType == LlamaTokenType::EQUAL ? uint64_t(LlamaOp::EQUAL_EQUAL) : toLlamaOp(opType);
+    cond.Value = std::stoull(std::string(parser.lexemeAt(func.Value)));
+  }
+
+  auto patternId = [&](std::string_view name) {
+    auto it = std::find(ruleNames.begin(), ruleNames.end(), name);
+    // a pattern that isn't in the patterns section never has hits
+    return it == ruleNames.end() ? SIZE_MAX : rulePatterns[it - ruleNames.begin()];
+  };
+
+  if (func.Name == "offset" || func.Name == "length") {
+    cond.Type = func.Args.size() > 1 ? Cond::NEVER : func.Name == "offset" ? Cond::OFFSET : Cond::LENGTH;
+    const size_t id = patternId(func.Args[0]);
+    if (cond.Type != Cond::NEVER && id != SIZE_MAX) {
+      cond.Qualifier = NumQualifiers++;
+      PatternQualifiers[id].push_back(Conds.size());
+    }
+  }
+  else {
+    cond.Type = func.Name == "any" ? Cond::ANY :
+                func.Name == "all" ? Cond::ALL :
+                func.Name == "count" ? Cond::COUNT : Cond::COUNT_HAS_HITS;
+    if (func.Args.empty()) {
+      cond.Patterns = rulePatterns;
+    }
+    else {
+      for (const std::string_view& arg : func.Args) {
+        cond.Patterns.push_back(patternId(arg));
+      }
+    }
+  }
+  Conds.push_back(cond);
+  return Conds.size() - 1;
+}
+
+HitNeeds::Truth HitNeeds::eval(const State& state, size_t c) const {
+  const Cond& cond = Conds[c];
+  auto count = [&state](size_t id) {
+    return id == SIZE_MAX ? 0 : state.Counts[id];
+  };
+
+  switch (cond.Type) {
+    case Cond::AND: {
+      const Truth l = eval(state, cond.Left);
+      const Truth r = eval(state, cond.Right);
+      return l == Truth::FALSE || r == Truth::FALSE ? Truth::FALSE :
+             l == Truth::TRUE && r == Truth::TRUE ? Truth::TRUE : Truth::UNKNOWN;
+    }
+    case Cond::OR: {
+      const Truth l = eval(state, cond.Left);
+      const Truth r = eval(state, cond.Right);
+      return l == Truth::TRUE || r == Truth::TRUE ? Truth::TRUE :
+             l == Truth::FALSE && r == Truth::FALSE ? Truth::FALSE : Truth::UNKNOWN;
+    }
+    case Cond::ANY:
+      return std::any_of(cond.Patterns.begin(), cond.Patterns.end(), [&](size_t id) { return count(id) > 0; }) ?
+        Truth::TRUE : Truth::UNKNOWN;
+    case Cond::ALL:
+      return std::all_of(cond.Patterns.begin(), cond.Patterns.end(), [&](size_t id) { return count(id) > 0; }) ?
+        Truth::TRUE : Truth::UNKNOWN;
+    case Cond::COUNT:
+    case Cond::COUNT_HAS_HITS: {
+      uint64_t n = 0;
+      if (cond.Type == Cond::COUNT) {
+        n = count(cond.Patterns[0]);
+      }
+      else {
+        n = std::count_if(cond.Patterns.begin(), cond.Patterns.end(), [&](size_t id) { return count(id) > 0; });
+      }
+      const bool now = compare(n, cond.Op, cond.Value);
+      if (cond.Type == Cond::COUNT_HAS_HITS && n == cond.Patterns.size()) {
+        return now ? Truth::TRUE : Truth::FALSE; // n can't grow any more
+      }
+      // n only grows, so some comparisons are bound to stay as they are
+      switch (cond.Op) {
+        case LlamaOp::GREATER_THAN:
+        case LlamaOp::GREATER_THAN_EQUAL:
+          return now ? Truth::TRUE : Truth::UNKNOWN;
+        case LlamaOp::LESS_THAN:
+        case LlamaOp::LESS_THAN_EQUAL:
+          return now ? Truth::UNKNOWN : Truth::FALSE;
+        case LlamaOp::EQUAL_EQUAL:
+          return n > cond.Value ? Truth::FALSE : Truth::UNKNOWN;
+        case LlamaOp::NOT_EQUAL:
+          return n > cond.Value ? Truth::TRUE : Truth::UNKNOWN;
+        default:
+          return Truth::UNKNOWN;
+      }
+    }
+    case Cond::OFFSET:
+    case Cond::LENGTH:
+      return cond.Qualifier < state.Qualified.size() && state.Qualified[cond.Qualifier] ? Truth::TRUE : Truth::UNKNOWN;
+    default:
+      return Truth::UNKNOWN;
+  }
+}
+
+HitNeeds::Reach HitNeeds::reach(size_t c) const {
+  const Cond& cond = Conds[c];
+  auto valid = [](size_t id) { return id != SIZE_MAX; };
+
+  switch (cond.Type) {
+    case Cond::AND: {
+      // false if either side is, true only if both are
+      const Reach l = reach(cond.Left);
+      const Reach r = reach(cond.Right);
+      return {l.True && r.True, l.False || r.False};
+    }
+    case Cond::OR: {
+      const Reach l = reach(cond.Left);
+      const Reach r = reach(cond.Right);
+      return {l.True || r.True, l.False && r.False};
+    }
+    case Cond::ANY:
+      return {std::any_of(cond.Patterns.begin(), cond.Patterns.end(), valid), false};
+    case Cond::ALL:
+      return {std::all_of(cond.Patterns.begin(), cond.Patterns.end(), valid), false};
+    case Cond::COUNT:
+    case Cond::COUNT_HAS_HITS: {
+      Reach ret{false, false};
+      switch (cond.Op) {
+        case LlamaOp::GREATER_THAN:
+        case LlamaOp::GREATER_THAN_EQUAL:
+        case LlamaOp::NOT_EQUAL:
+          ret.True = true;
+          break;
+        case LlamaOp::LESS_THAN:
+        case LlamaOp::LESS_THAN_EQUAL:
+        case LlamaOp::EQUAL_EQUAL:
+          ret.False = true;
+          break;
+        default:
+          break;
+      }
+      // once every pattern has hits, the count can't change
+      if (cond.Type == Cond::COUNT_HAS_HITS && std::all_of(cond.Patterns.begin(), cond.Patterns.end(), valid)) {
+        const bool full = compare(cond.Patterns.size(), cond.Op, cond.Value);
+        ret.True |= full;
+        ret.False |= !full;
+      }
+      return ret;
+    }
+    case Cond::OFFSET:
+    case Cond::LENGTH:
+      return {cond.Qualifier != SIZE_MAX, false};
+    default:
+      return {false, false};
+  }
+}
+
+bool HitNeeds::canSettle() const {
+  for (size_t r = 0; r < RuleRoots.size(); ++r) {
+    if (!RuleGreps[r]) {
+      continue;
+    }
+    if (RuleRoots[r] == NO_COND) {
+      return false;
+    }
+    const Reach can = reach(RuleRoots[r]);
+    if (!can.True && !can.False) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void HitNeeds::settle(State& state, size_t rule) const {
+  if (state.Settled[rule]) {
+    return;
+  }
+  // rules without patterns don't depend on hits at all
+  if (!RuleGreps[rule] || (RuleRoots[rule] != NO_COND && eval(state, RuleRoots[rule]) != Truth::UNKNOWN)) {
+    state.Settled[rule] = true;
+    --state.Unsettled;
+  }
+}
+
+void HitNeeds::reset(State& state) const {
+  state = Initial;
+}
+
+bool HitNeeds::addHit(State& state, const LG_SearchHit& hit) const {
+  if (hit.KeywordIndex >= KeywordPattern.size()) {
+    return state.settled();
+  }
+  const size_t id = KeywordPattern[hit.KeywordIndex];
+  ++state.Counts[id];
+  for (size_t c : PatternQualifiers[id]) {
+    const Cond& cond = Conds[c];
+    const uint64_t v = cond.Type == Cond::OFFSET ? hit.Start : hit.End - hit.Start;
+    if (compare(v, cond.Op, cond.Value)) {
+      state.Qualified[cond.Qualifier] = true;
+    }
+  }
+  settle(state, PatternRule[id]);
+  return state.settled();
+}
@@ -1,11 +1,12 @@
 #include "inputreader.h"
 
 #include "dirreader.h"
+#include "options.h"
 #include "tskreader.h"
 
 std::shared_ptr<InputReader>
-InputReader::createTSK(const std::string& imgName) {
-  auto ret = std::make_shared<TskReader>(imgName);
+InputReader::createTSK(const std::string& imgName, const Options& opts) {
+  auto ret = std::make_shared<TskReader>(imgName, opts.WalkThreads, opts.ImageCacheSize, opts.NumThreads);
   if (!ret->open()) {
     throw std::runtime_error("Couldn't open image " + imgName);
   }
@@ -13,8 +14,8 @@ InputReader::createTSK(const std::string& imgName) {
 }
 
 std::shared_ptr<InputReader>
-InputReader::createDir(const std::string & dir) {
+InputReader::createDir(const std::string & dir, const Options& opts) {
 // TODO: maybe throw on failure?
-  auto ret = std::make_shared<DirReader>(dir);
+  auto ret = std::make_shared<DirReader>(dir, opts.IoQueueDepth);
   return std::static_pointer_cast<InputReader>(ret);
 }
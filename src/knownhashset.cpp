@@ -0,0 +1,232 @@
+#include "knownhashset.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "hex.h"
+#include "throw.h"
+
+namespace {
+  const char MAGIC[8] = {'L', 'L', 'A', 'M', 'A', 'K', 'H', 'S'};
+  const uint32_t VERSION = 1;
+
+  const uint64_t BLOOM_BITS_PER_DIGEST = 16;
+  const uint32_t BLOOM_HASHES = 8;
+
+  struct Header {
+    char     Magic[8];
+    uint32_t Version;
+    uint32_t Alg;
+    uint64_t NumDigests;
+    uint64_t BloomBits;
+    uint32_t BloomHashes;
+    uint32_t DigestSize;
+  };
+
+  // digests are uniformly distributed, so their first 16 bytes make fine
+  // hash values for double hashing
+  void bloomHashes(const uint8_t* digest, uint64_t& h1, uint64_t& h2) {
+    std::memcpy(&h1, digest, sizeof(h1));
+    std::memcpy(&h2, digest + sizeof(h1), sizeof(h2));
+    h2 |= 1;
+  }
+}
+
+size_t KnownHashSet::digestSize(SFHASH_HashAlgorithm alg) {
+  switch (alg) {
+    case SFHASH_MD5:
+      return 16;
+    case SFHASH_SHA_1:
+      return 20;
+    case SFHASH_SHA_2_256:
+    case SFHASH_BLAKE3:
+      return 32;
+    default:
+      return 0;
+  }
+}
+
+uint64_t KnownHashSet::write(const std::string& path, SFHASH_HashAlgorithm alg, const std::vector<uint8_t>& digests) {
+  const size_t dsize = digestSize(alg);
+  THROW_IF(dsize == 0, "Hash algorithm " << alg << " can't be used for a known hash set");
+  THROW_IF(digests.size() % dsize, "Digest data isn't a whole number of digests");
+
+  const uint8_t* const d = digests.data();
+  std::vector<uint64_t> order(digests.size() / dsize);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [=](uint64_t a, uint64_t b) {
+    return std::memcmp(d + a * dsize, d + b * dsize, dsize) < 0;
+  });
+  order.erase(std::unique(order.begin(), order.end(), [=](uint64_t a, uint64_t b) {
+    return std::memcmp(d + a * dsize, d + b * dsize, dsize) == 0;
+  }), order.end());
+
+  uint64_t bloomBits = 64;
+  while (bloomBits < order.size() * BLOOM_BITS_PER_DIGEST) {
+    bloomBits <<= 1;
+  }
+  std::vector<uint8_t> bloom(bloomBits / 8, 0);
+  for (uint64_t i : order) {
+    uint64_t h1, h2;
+    bloomHashes(d + i * dsize, h1, h2);
+    for (uint32_t k = 0; k < BLOOM_HASHES; ++k) {
+      const uint64_t bit = (h1 + k * h2) & (bloomBits - 1);
+      bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+  }
+
+  Header hdr;
+  std::memcpy(hdr.Magic, MAGIC, sizeof(MAGIC));
+  hdr.Version = VERSION;
+  hdr.Alg = alg;
+  hdr.NumDigests = order.size();
+  hdr.BloomBits = bloomBits;
+  hdr.BloomHashes = BLOOM_HASHES;
+  hdr.DigestSize = dsize;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  THROW_IF(!out, "Could not open " << path << " for writing");
+  out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  out.write(reinterpret_cast<const char*>(bloom.data()), bloom.size());
+  for (uint64_t i : order) {
+    out.write(reinterpret_cast<const char*>(d + i * dsize), dsize);
+  }
+  THROW_IF(!out.flush(), "Error writing " << path);
+  return order.size();
+}
+
+uint64_t KnownHashSet::writeFromHexFile(const std::string& path, SFHASH_HashAlgorithm alg, const std::string& hexPath) {
+  const size_t dsize = digestSize(alg);
+  THROW_IF(dsize == 0, "Hash algorithm " << alg << " can't be used for a known hash set");
+
+  std::ifstream in(hexPath);
+  THROW_IF(!in, "Could not open " << hexPath);
+
+  std::vector<uint8_t> digests;
+  std::string line;
+  while (std::getline(in, line)) {
+    while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) {
+      line.pop_back();
+    }
+    const size_t start = digests.size();
+    digests.resize(start + dsize);
+    if (!hexDecode(line, digests.data() + start, dsize)) {
+      digests.resize(start);
+    }
+  }
+  return write(path, alg, digests);
+}
+
+KnownHashSet::Mapping::Mapping(const std::string& path):
+  Data(nullptr), Len(0), Owned()
+{
+#if !defined(_WIN32)
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  THROW_IF(fd < 0, "Could not open known hash set " << path);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED) {
+      // lookups are all over the place
+      madvise(p, st.st_size, MADV_RANDOM);
+      Data = static_cast<const uint8_t*>(p);
+      Len = st.st_size;
+    }
+  }
+  ::close(fd);
+#endif
+  if (!Data) {
+    std::ifstream in(path, std::ios::binary);
+    THROW_IF(!in, "Could not open known hash set " << path);
+    Owned.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    Data = Owned.data();
+    Len = Owned.size();
+  }
+}
+
+KnownHashSet::Mapping::~Mapping() {
+#if !defined(_WIN32)
+  if (Data && Owned.empty()) {
+    munmap(const_cast<uint8_t*>(Data), Len);
+  }
+#endif
+}
+
+KnownHashSet::KnownHashSet(const std::string& path):
+  File(path), Alg(SFHASH_MD5), DigestSize(0), NumDigests(0),
+  BloomBits(0), BloomHashes(0), Bloom(nullptr), Digests(nullptr)
+{
+  Header hdr;
+  THROW_IF(File.Len < sizeof(hdr), path << " is not a known hash set");
+  std::memcpy(&hdr, File.Data, sizeof(hdr));
+  THROW_IF(std::memcmp(hdr.Magic, MAGIC, sizeof(MAGIC)) || hdr.Version != VERSION,
+           path << " is not a known hash set");
+  Alg = static_cast<SFHASH_HashAlgorithm>(hdr.Alg);
+  DigestSize = hdr.DigestSize;
+  NumDigests = hdr.NumDigests;
+  BloomBits = hdr.BloomBits;
+  BloomHashes = hdr.BloomHashes;
+  THROW_IF(DigestSize == 0 || DigestSize != digestSize(Alg) || BloomBits < 64 || (BloomBits & (BloomBits - 1)) ||
+           File.Len != sizeof(hdr) + BloomBits / 8 + NumDigests * DigestSize,
+           path << " is a corrupt known hash set");
+  Bloom = File.Data + sizeof(hdr);
+  Digests = Bloom + BloomBits / 8;
+}
+
+bool KnownHashSet::bloomContains(const uint8_t* digest) const {
+  uint64_t h1, h2;
+  bloomHashes(digest, h1, h2);
+  for (uint32_t k = 0; k < BloomHashes; ++k) {
+    const uint64_t bit = (h1 + k * h2) & (BloomBits - 1);
+    if (!(Bloom[bit >> 3] & (1 << (bit & 7)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool KnownHashSet::contains(const uint8_t* digest) const {
+  if (!bloomContains(digest)) {
+    return false;
+  }
+  uint64_t lo = 0, hi = NumDigests;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    const int c = std::memcmp(Digests + mid * DigestSize, digest, DigestSize);
+    if (c < 0) {
+      lo = mid + 1;
+    }
+    else if (c > 0) {
+      hi = mid;
+    }
+    else {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool KnownHashSet::contains(const SFHASH_HashValues& h) const {
+  switch (Alg) {
+    case SFHASH_MD5:
+      return contains(h.Md5);
+    case SFHASH_SHA_1:
+      return contains(h.Sha1);
+    case SFHASH_SHA_2_256:
+      return contains(h.Sha2_256);
+    case SFHASH_BLAKE3:
+      return contains(h.Blake3);
+    default:
+      return false;
+  }
+}
@@ -2,6 +2,7 @@
 
 #include "batchhandler.h"
 #include "cli.h"
+#include "contentcache.h"
 #include "direntbatch.h"
 #include "duckinode.h"
 #include "duckhash.h"
@@ -9,9 +10,12 @@
 #include "filescheduler.h"
 #include "inputhandler.h"
 #include "inputreader.h"
+#include "knownhashset.h"
 #include "llamaduck.h"
+#include "metrics.h"
 #include "processor.h"
 #include "ruleengine.h"
+#include "scancache.h"
 #include "throw.h"
 #include "timer.h"
 
@@ -44,6 +48,18 @@ int Llama::run(int argc, const char* const argv[]) {
   else if ("version" == Opts->Command) {
     CliParser->printVersion(std::cout);
   }
+  else if ("build-known-hashes" == Opts->Command) {
+    try {
+      const uint64_t n = KnownHashSet::writeFromHexFile(
+        Opts->Output, static_cast<SFHASH_HashAlgorithm>(Opts->KnownHashesAlg), Opts->Input
+      );
+      std::cerr << "Wrote " << n << " known hashes to " << Opts->Output << '\n';
+    }
+    catch (const std::runtime_error &e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return -1;
+    }
+  }
   else if ("search" == Opts->Command) {
     Timer overall(&std::cerr, "Overall time: ");
     try {
@@ -67,20 +83,62 @@ void Llama::search() {
 
     LG_ProgramOptions opts{10};
     LgProg.reset(lg_create_program(RuleEngine.buildFsm().getFsm(), &opts), lg_destroy_program);
-    auto protoProc = std::make_shared<Processor>(&Db, LgProg, RuleEngine.patternToRuleId());
+    std::shared_ptr<const KnownHashSet> known;
+    if (!Opts->KnownHashes.empty()) {
+      known = std::make_shared<KnownHashSet>(Opts->KnownHashes);
+    }
+    std::shared_ptr<ScanCache> cache;
+    if (!Opts->ScanCache.empty()) {
+      cache = std::make_shared<ScanCache>(
+        DbConn.get(), Opts->ScanCache, ScanCache::Evidence{Opts->Input},
+        ScanCache::programIdentity(
+          LgProg.get(), RuleEngine.patternToRuleId(),
+          {Opts->AllHits, Opts->MaxHitsPerPattern, Opts->MaxHitsPerFile}
+        )
+      );
+    }
+    std::shared_ptr<const HitNeeds> needs;
+    if (!Opts->AllHits) {
+      needs = std::make_shared<HitNeeds>(RuleEngine.hitNeeds());
+      if (!needs->canSettle()) {
+        needs.reset();
+      }
+    }
+    auto protoProc = std::make_shared<Processor>(
+      &Db, LgProg, Opts->HashAlgs | RuleEngine.hashAlgs(), std::make_shared<ContentCache>(), known, cache, needs
+    );
+    protoProc->setHitLimits(Opts->MaxHitsPerPattern, Opts->MaxHitsPerFile);
     auto scheduler = std::make_shared<FileScheduler>(Db, Pool, protoProc, Opts);
     auto inh = std::shared_ptr<InputHandler>(new BatchHandler(scheduler));
 
     Input->setInputHandler(inh);
-
-    if (!Input->startReading()) {
-      std::cerr << "startReading returned an error" << std::endl;
+    Input->setMemoryBudget(scheduler->memoryBudget());
+
+    // the metrics are process-wide, so this run's are relative to these
+    const Metrics::Snapshot before = Metrics::global().snapshot();
+    {
+      Metrics::ProgressReporter progress(Metrics::global(), std::cerr, Opts->ProgressInterval);
+      if (!Input->startReading()) {
+        std::cerr << "startReading returned an error" << std::endl;
+      }
+      scheduler->finish();
+      Pool.join();
     }
-    Pool.join();
     std::cerr << "Hashing Time: " << scheduler->getProcessorTime() << "s\n";
+    if (const uint64_t over = scheduler->memoryBudget()->overReleased()) {
+      std::cerr << "Warning: the memory budget was released " << over << " bytes more than charged\n";
+    }
+
+    if (cache) {
+      cache->finish(DbConn.get());
+    }
 
     RuleEngine.writeRulesToDb(DbConn);
+    RuleEngine.writePatternsToDb(DbConn, LgProg.get());
     writeDB(outdir.string());
+
+    std::ofstream report(outdir / "metrics.json");
+    report << Metrics::toJson(Metrics::global().snapshot().since(before), searchTime.elapsed()) << '\n';
   }
   else {
     std::cerr << "init returned false!" << std::endl;
@@ -141,8 +199,8 @@ bool Llama::readpatterns(const std::vector<std::string>& keyFiles) {
 bool Llama::openInput(const std::string& input) {
 // FIXME: is_directory can throw
   Input = fs::is_directory(input) ?
-    InputReader::createDir(input) :
-    InputReader::createTSK(input);
+    InputReader::createDir(input, *Opts) :
+    InputReader::createTSK(input, *Opts);
   return bool(Input);
 }
 
@@ -0,0 +1,46 @@
+#include "memorybudget.h"
+
+MemoryBudget::MemoryBudget(uint64_t limit):
+  Limit(limit), Mutex(), Released(), Used(0), OverReleased(0)
+{
+}
+
+uint64_t MemoryBudget::used() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Used;
+}
+
+void MemoryBudget::acquire(uint64_t n) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  if (Limit) {
+    Released.wait(lock, [&]() { return !Used || Used + n <= Limit; });
+  }
+  Used += n;
+}
+
+void MemoryBudget::charge(uint64_t n) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Used += n;
+}
+
+void MemoryBudget::release(uint64_t n) {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (n > Used) {
+      OverReleased += n - Used;
+      n = Used;
+    }
+    Used -= n;
+  }
+  Released.notify_all();
+}
+
+uint64_t MemoryBudget::overReleased() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return OverReleased;
+}
+
+bool MemoryBudget::over() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Limit && Used > Limit;
+}
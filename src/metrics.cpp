@@ -0,0 +1,216 @@
+#include "metrics.h"
+
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+#include "jsoncons_wrapper.h"
+
+namespace {
+  std::atomic<uint64_t> NextId(0);
+
+  size_t bucketOf(uint64_t v) {
+    return v ? std::min<size_t>(64 - __builtin_clzll(v), Metrics::NUM_BUCKETS - 1) : 0;
+  }
+
+  std::string humanBytes(double b) {
+    static const char* const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    size_t u = 0;
+    while (b >= 1024 && u + 1 < std::size(units)) {
+      b /= 1024;
+      ++u;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << b << ' ' << units[u];
+    return out.str();
+  }
+
+  double millis(uint64_t nanos) {
+    return nanos / 1e6;
+  }
+}
+
+Metrics::Metrics(): Id(NextId++), SlotsMutex(), Slots() {}
+
+Metrics& Metrics::global() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::Slot& Metrics::slot() {
+  // a thread almost always uses the same Metrics, so its last slot is
+  // cached; ids aren't reused, so a stale entry is never found
+  thread_local uint64_t cachedId = UINT64_MAX;
+  thread_local Slot* cached = nullptr;
+  thread_local std::unordered_map<uint64_t, Slot*> mine;
+  if (cachedId != Id) {
+    Slot*& s = mine[Id];
+    if (!s) {
+      std::lock_guard<std::mutex> lock(SlotsMutex);
+      Slots.push_back(std::make_unique<Slot>());
+      s = Slots.back().get();
+    }
+    cached = s;
+    cachedId = Id;
+  }
+  return *cached;
+}
+
+void Metrics::record(Histogram h, uint64_t nanos) {
+  Slot& s = slot();
+  bump(s.Buckets[h][bucketOf(nanos)], 1);
+  bump(s.Sums[h], nanos);
+  if (nanos > s.Maxes[h].load(std::memory_order_relaxed)) {
+    s.Maxes[h].store(nanos, std::memory_order_relaxed);
+  }
+}
+
+Metrics::Snapshot Metrics::snapshot() const {
+  Snapshot snap;
+  std::lock_guard<std::mutex> lock(SlotsMutex);
+  for (const auto& s : Slots) {
+    for (size_t c = 0; c < NUM_COUNTERS; ++c) {
+      snap.Counters[c] += s->Counters[c].load(std::memory_order_relaxed);
+    }
+    for (size_t h = 0; h < NUM_HISTOGRAMS; ++h) {
+      HistogramSnapshot& hist = snap.Histograms[h];
+      for (size_t b = 0; b < NUM_BUCKETS; ++b) {
+        const uint64_t n = s->Buckets[h][b].load(std::memory_order_relaxed);
+        hist.Buckets[b] += n;
+        hist.Count += n;
+      }
+      hist.Sum += s->Sums[h].load(std::memory_order_relaxed);
+      hist.Max = std::max(hist.Max, s->Maxes[h].load(std::memory_order_relaxed));
+    }
+  }
+  return snap;
+}
+
+Metrics::Snapshot Metrics::Snapshot::since(const Snapshot& earlier) const {
+  Snapshot ret(*this);
+  for (size_t c = 0; c < NUM_COUNTERS; ++c) {
+    ret.Counters[c] -= earlier.Counters[c];
+  }
+  for (size_t h = 0; h < NUM_HISTOGRAMS; ++h) {
+    HistogramSnapshot& hist = ret.Histograms[h];
+    hist.Count -= earlier.Histograms[h].Count;
+    hist.Sum -= earlier.Histograms[h].Sum;
+    for (size_t b = 0; b < NUM_BUCKETS; ++b) {
+      hist.Buckets[b] -= earlier.Histograms[h].Buckets[b];
+    }
+  }
+  return ret;
+}
+
+uint64_t Metrics::count(Counter c) const {
+  uint64_t ret = 0;
+  std::lock_guard<std::mutex> lock(SlotsMutex);
+  for (const auto& s : Slots) {
+    ret += s->Counters[c].load(std::memory_order_relaxed);
+  }
+  return ret;
+}
+
+uint64_t Metrics::HistogramSnapshot::percentile(double p) const {
+  const uint64_t rank = p * Count;
+  uint64_t seen = 0;
+  for (size_t b = 0; b < NUM_BUCKETS; ++b) {
+    seen += Buckets[b];
+    if (seen > rank || (seen == Count && Buckets[b])) {
+      return std::min(b ? (uint64_t(1) << b) - 1 : 0, Max);
+    }
+  }
+  return Max;
+}
+
+const char* Metrics::name(Counter c) {
+  static const char* const names[] = {"files", "bytes_read", "read_errors", "hits", "batches_queued", "batches_done", "image_cache_hits", "image_cache_misses"};
+  return names[c];
+}
+
+const char* Metrics::name(Histogram h) {
+  static const char* const names[] = {"read", "hash", "search", "ingest", "queue_wait", "memory_wait", "flush"};
+  return names[h];
+}
+
+std::string Metrics::progressLine(const Snapshot& cur, const Snapshot& prev, double interval) {
+  const uint64_t bytes = cur.Counters[BYTES_READ] - prev.Counters[BYTES_READ];
+  std::ostringstream out;
+  out << "Progress: " << cur.Counters[FILES] << " files, "
+      << humanBytes(cur.Counters[BYTES_READ]) << " read ("
+      << humanBytes(interval > 0 ? bytes / interval : 0) << "/s), "
+      << cur.Counters[HITS] << " hits, "
+      << cur.pendingBatches() << " batches pending";
+
+  // where the time went since the last line
+  out << std::fixed << std::setprecision(1) << "; busy s:";
+  for (size_t h = 0; h < NUM_HISTOGRAMS; ++h) {
+    const uint64_t nanos = cur.Histograms[h].Sum - prev.Histograms[h].Sum;
+    out << ' ' << name(Histogram(h)) << ' ' << nanos / 1e9;
+  }
+  return out.str();
+}
+
+std::string Metrics::toJson(const Snapshot& snap, double elapsed) {
+  jsoncons::json counters(jsoncons::json_object_arg);
+  for (size_t c = 0; c < NUM_COUNTERS; ++c) {
+    counters[name(Counter(c))] = snap.Counters[c];
+  }
+
+  jsoncons::json histograms(jsoncons::json_object_arg);
+  for (size_t h = 0; h < NUM_HISTOGRAMS; ++h) {
+    const HistogramSnapshot& hist = snap.Histograms[h];
+    histograms[name(Histogram(h))] = jsoncons::json(
+      jsoncons::json_object_arg,
+      {
+        {"count", hist.Count},
+        {"total_ms", millis(hist.Sum)},
+        {"mean_ms", hist.Count ? millis(hist.Sum) / hist.Count : 0.0},
+        {"p50_ms", millis(hist.percentile(0.5))},
+        {"p90_ms", millis(hist.percentile(0.9))},
+        {"p99_ms", millis(hist.percentile(0.99))},
+        {"max_ms", millis(hist.Max)}
+      }
+    );
+  }
+
+  jsoncons::json report(
+    jsoncons::json_object_arg,
+    {
+      {"elapsed_seconds", elapsed},
+      {"bytes_per_second", elapsed > 0 ? snap.Counters[BYTES_READ] / elapsed : 0.0},
+      {"counters", counters},
+      {"histograms", histograms}
+    }
+  );
+  return report.as<std::string>();
+}
+
+Metrics::ProgressReporter::ProgressReporter(const Metrics& metrics, std::ostream& out, unsigned int interval):
+  Source(metrics), Out(out), Interval(interval), Mutex(), Stop(), Stopping(false), Thread()
+{
+  if (Interval) {
+    Thread = std::thread(&ProgressReporter::run, this);
+  }
+}
+
+Metrics::ProgressReporter::~ProgressReporter() {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Stopping = true;
+  }
+  Stop.notify_one();
+  if (Thread.joinable()) {
+    Thread.join();
+  }
+}
+
+void Metrics::ProgressReporter::run() {
+  Snapshot prev = Source.snapshot();
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (!Stop.wait_for(lock, std::chrono::seconds(Interval), [this]() { return Stopping; })) {
+    Snapshot cur = Source.snapshot();
+    Out << progressLine(cur, prev, Interval) << std::endl;
+    prev = cur;
+  }
+}
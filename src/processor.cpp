@@ -1,89 +1,570 @@
 #include "processor.h"
 
-#include <hasher/api.h>
+#include <algorithm>
 
 #include <lightgrep/api.h>
 
 #include "blocksequence.h"
+#include "contentcache.h"
 #include "filerecord.h"
+#include "hex.h"
+#include "knownhashset.h"
+#include "memorybudget.h"
+#include "metrics.h"
 #include "outputhandler.h"
 #include "readseek.h"
+#include "scancache.h"
 #include "timer.h"
 
 namespace {
   const LG_ContextOptions ctxOpts{0, 0};
 
-  void hashFile(SFHASH_Hasher* hasher, ReadSeek& stream, std::vector<unsigned char>& buf, SFHASH_HashValues& hashes) {
-    stream.seek(0);
-    sfhash_reset_hasher(hasher);
-    size_t bytesRead = 0;
-    do {
-      bytesRead = stream.read(1 << 20, buf);
-      if (bytesRead > 0) {
-        sfhash_update_hasher(hasher, buf.data(), buf.data() + bytesRead);
+  // reading, hashing, and searching, timed for the pipeline metrics
+
+  // returns the bytes read, 0 at the end, or -1 on an error, which is
+  // counted; the file is then processed as far as it was read
+  int64_t timedRead(ReadSeek& stream, size_t len, const uint8_t*& buf) {
+    Metrics::Latency t(Metrics::READ_NS);
+    const int64_t bytesRead = stream.readView(len, buf);
+    if (bytesRead > 0) {
+      Metrics::global().add(Metrics::BYTES_READ, bytesRead);
+    }
+    else if (bytesRead < 0) {
+      Metrics::global().add(Metrics::READ_ERRORS);
+    }
+    return bytesRead;
+  }
+
+  void timedHash(SFHASH_Hasher* hasher, const uint8_t* beg, const uint8_t* end) {
+    Metrics::Latency t(Metrics::HASH_NS);
+    sfhash_update_hasher(hasher, beg, end);
+  }
+
+  void timedSearch(LG_HCONTEXT ctx, const char* beg, const char* end, uint64_t offset,
+                   void* userData, LG_HITCALLBACK_FN callback)
+  {
+    Metrics::Latency t(Metrics::SEARCH_NS);
+    lg_search(ctx, beg, end, offset, userData, callback);
+  }
+
+  void handleSearchHit(void* userData, const LG_SearchHit* const hit) {
+    reinterpret_cast<Processor*>(userData)->collectHit(hit);
+  }
+
+  struct SegmentHits {
+    uint64_t Beg, End;
+    std::vector<LG_SearchHit> Hits;
+
+    // A pattern's first hits in the file are among its first hits in each
+    // segment, so capping them per segment keeps every hit the per-pattern
+    // limit would. The per-file cap only bounds a segment's memory; both
+    // limits are applied again when the segments are merged. A segment's
+    // per-file count includes hits that the merge drops by pattern, so a
+    // file may keep fewer hits than a serial search would.
+    uint64_t MaxPerPattern, MaxPerFile;
+    std::vector<uint64_t> Counts;
+    std::vector<uint64_t>* Dropped;
+  };
+
+  void handleSegmentHit(void* userData, const LG_SearchHit* const hit) {
+    auto seg = reinterpret_cast<SegmentHits*>(userData);
+    // hits starting in the overlap belong to the neighboring segments
+    if (seg->Beg <= hit->Start && hit->Start < seg->End) {
+      if ((seg->MaxPerPattern && seg->Counts[hit->KeywordIndex] >= seg->MaxPerPattern) ||
+          (seg->MaxPerFile && seg->Hits.size() >= seg->MaxPerFile))
+      {
+        if (seg->Dropped) {
+          ++(*seg->Dropped)[hit->KeywordIndex];
+        }
+        return;
       }
-    } while (bytesRead > 0);
-    sfhash_get_hashes(hasher, &hashes);
+      ++seg->Counts[hit->KeywordIndex];
+      seg->Hits.push_back(*hit);
+    }
   }
 }
 
-Processor::Processor(LlamaDB* db, const std::shared_ptr<ProgramHandle>& prog, const std::vector<std::string>& patternToRuleId):
-  PatternToRuleId(patternToRuleId),
+const uint64_t Processor::DEFAULT_HASH_ALGS = SFHASH_MD5 | SFHASH_SHA_1 | SFHASH_SHA_2_256 | SFHASH_BLAKE3 | SFHASH_FUZZY;
+
+Processor::Processor(LlamaDB* db, const std::shared_ptr<ProgramHandle>& prog,
+                     uint64_t hashAlgs, const std::shared_ptr<ContentCache>& seen,
+                     const std::shared_ptr<const KnownHashSet>& known,
+                     const std::shared_ptr<ScanCache>& cache,
+                     const std::shared_ptr<const HitNeeds>& needs):
   Db(db),
   DbConn(*db),
   HashAppender(DbConn.get(), "hash"),
   SearchHitAppender(DbConn.get(), "search_hits"),
+  OverflowAppender(DbConn.get(), "search_hits_overflow"),
   LgProg(prog),
   Ctx(prog.get() ? lg_create_context(prog.get(), &ctxOpts) : nullptr, lg_destroy_context),
-  Hasher(sfhash_create_hasher(SFHASH_MD5 | SFHASH_SHA_1 | SFHASH_SHA_2_256 | SFHASH_BLAKE3 | SFHASH_FUZZY), sfhash_destroy_hasher),
+  HashAlgs(hashAlgs | SFHASH_BLAKE3 | (known ? known->algorithm() : 0)),
+  Hasher(sfhash_create_hasher(HashAlgs), sfhash_destroy_hasher),
+  Seen(seen),
+  Known(known),
+  Cache(cache),
+  Needs(needs),
+  MaxHitsPerPattern(0),
+  MaxHitsPerFile(0),
+  FileHitCount(0),
+  Coalescing(false),
   HashRecord(),
   Hashes(std::make_unique<HashBatch>()),
   SearchHits(std::make_unique<DBBatch<SearchHit>>()),
+  Overflows(std::make_unique<DBBatch<SearchHitOverflow>>()),
+  Budget(),
+  Charged(0),
   ProcTimeTotal(0)
 {
-  Buf.reserve(1 << 20);
+  const size_t numPatterns = prog ? lg_prog_pattern_count(prog.get()) : 0;
+  PatternHitCounts.assign(numPatterns, 0);
+  DroppedHits.assign(numPatterns, 0);
 }
 
 std::shared_ptr<Processor> Processor::clone() const {
-  return std::make_shared<Processor>(Db, LgProg, PatternToRuleId);
+  auto ret = std::make_shared<Processor>(Db, LgProg, HashAlgs, Seen, Known, Cache, Needs);
+  ret->setHitLimits(MaxHitsPerPattern, MaxHitsPerFile);
+  ret->setMemoryBudget(Budget);
+  return ret;
+}
+
+void Processor::setHitLimits(uint64_t perPattern, uint64_t perFile) {
+  MaxHitsPerPattern = perPattern;
+  MaxHitsPerFile = perFile;
+}
+
+void Processor::setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget) {
+  Budget = budget;
+}
+
+uint64_t Processor::batchBytes() const {
+  return Coalesced.size() + Hashes->bytes() + SearchHits->bytes() + Overflows->bytes();
+}
+
+void Processor::chargeMemory() {
+  if (!Budget) {
+    return;
+  }
+  const uint64_t held = batchBytes();
+  if (held > Charged) {
+    Budget->charge(held - Charged);
+  }
+  else {
+    Budget->release(Charged - held);
+  }
+  Charged = held;
+  if (Charged && Budget->over()) {
+    flush();
+  }
 }
 
 void Processor::process(ReadSeek& stream) {
+  if (processCached(stream)) {
+    return;
+  }
+
+  if (Ctx && stream.size() <= SMALL_FILE_SIZE) {
+    coalesce(stream);
+    return;
+  }
+
+  if (Ctx && Known && stream.cheapToReread()) {
+    // Known files are skipped, so everything is hashed first, and only
+    // unknown files are read again to search them.
+    hashThenSearch(stream);
+    return;
+  }
+
+  uint64_t fp = 0;
+  if (Ctx && Seen) {
+    const uint8_t* prefix = nullptr;
+    stream.seek(0);
+    const int64_t len = timedRead(stream, ContentCache::PREFIX_SIZE, prefix);
+    fp = ContentCache::fingerprint(stream.size(), prefix, std::max(len, int64_t(0)));
+    if (Seen->hasFingerprint(fp)) {
+      // probably a duplicate, so hash first and skip the search if it is
+      hashThenSearch(stream);
+      return;
+    }
+  }
+
+  // Each block is read once and fed to both the hasher and lightgrep. Hits
+  // are held in FileHits until the file's hash is known, since the hash
+  // is part of every search hit record, and since the hits of known files
+  // read here are dropped. Those are files which are costly to read twice,
+  // e.g., from compressed images without the cache to hold them, so they
+  // are searched needlessly rather than decompressed twice.
   SFHASH_HashValues h;
   {
     Timer procTime;
-    hashFile(Hasher.get(), stream, Buf, h);
+    sfhash_reset_hasher(Hasher.get());
+    if (Ctx) {
+      lg_reset_context(Ctx.get());
+    }
+    if (Needs) {
+      Needs->reset(NeedsState);
+    }
+    resetHitCounts();
+    int64_t bytesRead = 0;
+    uint64_t offset = 0;
+    const uint8_t* buf = nullptr;
+    stream.seek(0);
+    while ((bytesRead = timedRead(stream, 1 << 20, buf)) > 0) {
+      timedHash(Hasher.get(), buf, buf + bytesRead);
+      // the rest of the file is still hashed once the rules are decided
+      if (Ctx && !searchSettled()) {
+        timedSearch(Ctx.get(), (const char*)buf, (const char*)buf + bytesRead, offset, (void*)this, handleSearchHit);
+      }
+      offset += bytesRead;
+    }
+
+    if (Ctx) {
+      lg_closeout_search(Ctx.get(), (void*)this, handleSearchHit);
+    }
+    sfhash_get_hashes(Hasher.get(), &h);
     ProcTimeTotal += procTime.elapsed();
   }
-  HashRecord.set(h, stream.getID());
+  if (Ctx && Seen) {
+    Seen->addFingerprint(fp);
+  }
+  if (Ctx && (Known || Seen) && !shouldSearch(h)) {
+    FileHits.clear();
+    resetHitCounts();
+  }
+  recordFile(h, stream);
+}
 
-  // write hash record to database
-  Hashes->add(HashRecord);
+bool Processor::isCached(const ReadSeek& stream) const {
+  return Cache && stream.identity() && Cache->find(*stream.identity(), HashAlgs);
+}
+
+bool Processor::processCached(ReadSeek& stream) {
+  const ScanCache::Entry* cached = Cache && stream.identity() ? Cache->find(*stream.identity(), HashAlgs) : nullptr;
+  if (!cached) {
+    return false;
+  }
+  SFHASH_HashValues h{};
+  cached->Hashes.get(h);
+  recordFile(h, stream);
+  // the hits of content searched by the same rules are copied from the cache
+  if (Ctx && shouldSearch(h)) {
+    search(stream);
+  }
+  return true;
+}
 
+void Processor::hashThenSearch(ReadSeek& stream) {
+  Timer procTime;
+  SFHASH_HashValues h;
+  hashAll(Hasher.get(), stream, h);
+  recordFile(h, stream);
+  if (shouldSearch(h)) {
+    search(stream);
+  }
+  ProcTimeTotal += procTime.elapsed();
+}
+
+bool Processor::shouldSearch(const SFHASH_HashValues& h) {
+  if (Known && Known->contains(h)) {
+    return false;
+  }
+  ContentCache::Digest digest;
+  std::copy(std::begin(h.Blake3), std::end(h.Blake3), digest.begin());
+  const bool isNew = !Seen || Seen->insert(digest);
+  return isNew && !(Cache && Cache->wasSearched(hexEncode(h.Blake3, sizeof(h.Blake3))));
+}
+
+void Processor::coalesce(ReadSeek& stream) {
+  SFHASH_HashValues h;
+  const uint64_t base = Coalesced.size();
   {
     Timer procTime;
-    search(stream);
+    sfhash_reset_hasher(Hasher.get());
+    int64_t bytesRead = 0;
+    const uint8_t* buf = nullptr;
+    stream.seek(0);
+    while ((bytesRead = timedRead(stream, 1 << 20, buf)) > 0) {
+      timedHash(Hasher.get(), buf, buf + bytesRead);
+      Coalesced.insert(Coalesced.end(), buf, buf + bytesRead);
+    }
+    sfhash_get_hashes(Hasher.get(), &h);
     ProcTimeTotal += procTime.elapsed();
   }
+  recordFile(h, stream);
+  if (shouldSearch(h)) {
+    CoalescedFiles.push_back(CoalescedFile{base, Coalesced.size() - base, HashRecord.Blake3});
+  }
+  else {
+    Coalesced.resize(base);
+  }
+
+  if (Coalesced.size() >= COALESCE_SIZE) {
+    searchCoalesced();
+  }
+}
+
+void Processor::searchCoalesced() {
+  if (CoalescedFiles.empty()) {
+    return;
+  }
+  Timer procTime;
+  const char* const data = reinterpret_cast<const char*>(Coalesced.data());
+  // hits are held back from the limits until it's known whose they are
+  Coalescing = true;
+  lg_reset_context(Ctx.get());
+  timedSearch(Ctx.get(), data, data + Coalesced.size(), 0, (void*)this, handleSearchHit);
+  lg_closeout_search(Ctx.get(), (void*)this, handleSearchHit);
+
+  std::vector<LG_SearchHit> hits;
+  hits.swap(FileHits);
+
+  auto fileAt = [this](uint64_t offset) {
+    // empty files share their Base with the next file, so take the last match
+    auto it = std::upper_bound(CoalescedFiles.begin(), CoalescedFiles.end(), offset,
+      [](uint64_t off, const CoalescedFile& f) { return off < f.Base; });
+    return size_t(it - CoalescedFiles.begin()) - 1;
+  };
+
+  // A hit crossing a file boundary is suppressed, but it may have consumed
+  // real hits in the files it touches, so those files are searched again
+  // on their own.
+  std::vector<bool> research(CoalescedFiles.size(), false);
+  for (const LG_SearchHit& hit : hits) {
+    const size_t first = fileAt(hit.Start);
+    const CoalescedFile& f = CoalescedFiles[first];
+    if (hit.End > f.Base + f.Len) {
+      const size_t last = fileAt(hit.End - 1);
+      std::fill(research.begin() + first, research.begin() + last + 1, true);
+    }
+  }
+
+  std::vector<std::vector<LG_SearchHit>> fileHits(CoalescedFiles.size());
+  for (LG_SearchHit hit : hits) {
+    const size_t i = fileAt(hit.Start);
+    if (!research[i]) {
+      const CoalescedFile& f = CoalescedFiles[i];
+      hit.Start -= f.Base;
+      hit.End -= f.Base;
+      fileHits[i].push_back(hit);
+    }
+  }
+
+  for (size_t i = 0; i < CoalescedFiles.size(); ++i) {
+    const CoalescedFile& f = CoalescedFiles[i];
+    if (research[i]) {
+      lg_reset_context(Ctx.get());
+      timedSearch(Ctx.get(), data + f.Base, data + f.Base + f.Len, 0, (void*)this, handleSearchHit);
+      lg_closeout_search(Ctx.get(), (void*)this, handleSearchHit);
+      fileHits[i].swap(FileHits);
+      FileHits.clear();
+    }
+    resetHitCounts();
+    for (const LG_SearchHit& hit : fileHits[i]) {
+      if (admitHit(hit)) {
+        addToSearchHitBatch(&hit, f.Blake3);
+      }
+    }
+    recordOverflow(f.Blake3);
+  }
+  Coalescing = false;
+
+  Coalesced.clear();
+  CoalescedFiles.clear();
+  ProcTimeTotal += procTime.elapsed();
+}
+
+void Processor::recordFile(const SFHASH_HashValues& h, const ReadSeek& stream) {
+  HashRecord.set(h, stream.getID(), HashAlgs);
+  Metrics::global().add(Metrics::FILES);
+
+  // write hash record to database
+  Hashes->add(HashRecord);
+
+  if (Cache && stream.identity()) {
+    // known content isn't searched, so its hits can't be vouched for
+    Cache->add(*stream.identity(), HashAlgs, HashRecord, Ctx && !(Known && Known->contains(h)));
+  }
+
+  addFileHitsToBatch();
+}
+
+void Processor::addFile(const ReadSeek& stream, const SFHASH_HashValues& h, std::vector<LG_SearchHit>&& hits,
+                        const std::vector<uint64_t>& dropped)
+{
+  FileHits.clear();
+  resetHitCounts();
+  // if not, the search was already underway, but the hits aren't wanted
+  if (shouldSearch(h)) {
+    for (const LG_SearchHit& hit : hits) {
+      if (admitHit(hit)) {
+        FileHits.push_back(hit);
+      }
+    }
+    for (uint32_t k = 0; k < dropped.size(); ++k) {
+      if (dropped[k]) {
+        if (!PatternHitCounts[k] && !DroppedHits[k]) {
+          HitPatterns.push_back(k);
+        }
+        DroppedHits[k] += dropped[k];
+      }
+    }
+  }
+  recordFile(h, stream);
+}
+
+std::vector<LG_SearchHit> Processor::searchSegment(ReadSeek& stream, uint64_t beg, uint64_t end, uint64_t overlap,
+                                                   std::vector<uint64_t>* dropped, std::vector<uint8_t>* data) const
+{
+  SegmentHits seg{beg, end, {}, MaxHitsPerPattern, MaxHitsPerFile, std::vector<uint64_t>(PatternHitCounts.size(), 0), dropped};
+  if (dropped) {
+    dropped->assign(PatternHitCounts.size(), 0);
+  }
+  if (data) {
+    data->clear();
+    data->reserve(end - beg);
+  }
+  std::shared_ptr<ContextHandle> ctx;
+  if (LgProg) {
+    ctx.reset(lg_create_context(LgProg.get(), &ctxOpts), lg_destroy_context);
+  }
+  else if (!data) {
+    return seg.Hits;
+  }
+  // without a program, only the data is read
+  const uint64_t stop = ctx ? end + overlap : end;
+  uint64_t offset = stream.seek(ctx && beg > overlap ? beg - overlap : beg);
+  const uint8_t* buf = nullptr;
+  while (offset < stop) {
+    const int64_t bytesRead = timedRead(stream, std::min<uint64_t>(1 << 20, stop - offset), buf);
+    if (bytesRead <= 0) {
+      break;
+    }
+    if (data && offset + bytesRead > beg && offset < end) {
+      // just the part in [beg, end)
+      const uint64_t from = std::max(beg, offset) - offset;
+      const uint64_t to = std::min<uint64_t>(end, offset + bytesRead) - offset;
+      data->insert(data->end(), buf + from, buf + to);
+    }
+    if (ctx) {
+      timedSearch(ctx.get(), (const char*)buf, (const char*)buf + bytesRead, offset, (void*)&seg, handleSegmentHit);
+    }
+    offset += bytesRead;
+  }
+  if (ctx) {
+    lg_closeout_search(ctx.get(), (void*)&seg, handleSegmentHit);
+  }
+  return seg.Hits;
+}
+
+SFHASH_HashValues Processor::hashStream(ReadSeek& stream) const {
+  auto hasher = makeHasher();
+  SFHASH_HashValues h;
+  hashAll(hasher.get(), stream, h);
+  return h;
+}
+
+std::shared_ptr<SFHASH_Hasher> Processor::makeHasher() const {
+  return std::shared_ptr<SFHASH_Hasher>(sfhash_create_hasher(HashAlgs), sfhash_destroy_hasher);
+}
+
+void Processor::hashPiece(SFHASH_Hasher* hasher, const std::vector<uint8_t>& piece) const {
+  timedHash(hasher, piece.data(), piece.data() + piece.size());
+}
+
+void Processor::hashAll(SFHASH_Hasher* hasher, ReadSeek& stream, SFHASH_HashValues& h) const {
+  sfhash_reset_hasher(hasher);
+  int64_t bytesRead = 0;
+  const uint8_t* buf = nullptr;
+  stream.seek(0);
+  while ((bytesRead = timedRead(stream, 1 << 20, buf)) > 0) {
+    timedHash(hasher, buf, buf + bytesRead);
+  }
+  sfhash_get_hashes(hasher, &h);
 }
 
 void Processor::flush(void) {
+  searchCoalesced();
   if (Hashes->size()) {
+    Metrics::Latency flushTime(Metrics::FLUSH_NS);
     Hashes->copyToDB(HashAppender.get());
     SearchHits->copyToDB(SearchHitAppender.get());
+    Overflows->copyToDB(OverflowAppender.get());
     HashAppender.flush();
     SearchHitAppender.flush();
+    OverflowAppender.flush();
+    Hashes->clear();
+    SearchHits->clear();
+    Overflows->clear();
+  }
+  if (Budget && Charged) {
+    Budget->release(Charged);
+    Charged = 0;
   }
 }
 
-void handleSearchHit(void* userData, const LG_SearchHit* const hit) {
-  reinterpret_cast<Processor*>(userData)->addToSearchHitBatch(hit);
+void Processor::collectHit(const LG_SearchHit* const hit) {
+  if (Needs) {
+    Needs->addHit(NeedsState, *hit);
+  }
+  // dropping hits here keeps a pathological file from using up memory
+  if (Coalescing || admitHit(*hit)) {
+    FileHits.push_back(*hit);
+  }
+}
+
+bool Processor::admitHit(const LG_SearchHit& hit) {
+  if (!MaxHitsPerPattern && !MaxHitsPerFile) {
+    return true;
+  }
+  const uint32_t k = hit.KeywordIndex;
+  if (!PatternHitCounts[k] && !DroppedHits[k]) {
+    HitPatterns.push_back(k);
+  }
+  if ((MaxHitsPerPattern && PatternHitCounts[k] >= MaxHitsPerPattern) ||
+      (MaxHitsPerFile && FileHitCount >= MaxHitsPerFile))
+  {
+    ++DroppedHits[k];
+    return false;
+  }
+  ++PatternHitCounts[k];
+  ++FileHitCount;
+  return true;
+}
+
+void Processor::resetHitCounts() {
+  for (uint32_t k : HitPatterns) {
+    PatternHitCounts[k] = 0;
+    DroppedHits[k] = 0;
+  }
+  HitPatterns.clear();
+  FileHitCount = 0;
+}
+
+void Processor::recordOverflow(const std::string& fileHash) {
+  for (uint32_t k : HitPatterns) {
+    if (DroppedHits[k]) {
+      Overflows->add(SearchHitOverflow{k, fileHash, DroppedHits[k]});
+    }
+  }
+  resetHitCounts();
+}
+
+void Processor::addFileHitsToBatch() {
+  for (const LG_SearchHit& hit : FileHits) {
+    addToSearchHitBatch(&hit);
+  }
+  FileHits.clear();
+  recordOverflow(HashRecord.Blake3);
 }
 
 void Processor::addToSearchHitBatch(const LG_SearchHit* const hit) {
-  LG_PatternInfo* info = lg_prog_pattern_info(LgProg.get(), hit->KeywordIndex);
-  std::string pat(info->Pattern);
-  SearchHits->add(SearchHit{pat, hit->Start, hit->End, PatternToRuleId[hit->KeywordIndex], HashRecord.Blake3, hit->End - hit->Start});
+  addToSearchHitBatch(hit, HashRecord.Blake3);
+}
+
+void Processor::addToSearchHitBatch(const LG_SearchHit* const hit, const std::string& fileHash) {
+  // the pattern and rule are looked up once, in the patterns table
+  SearchHits->add(SearchHit{hit->KeywordIndex, hit->Start, hit->End, fileHash, hit->End - hit->Start});
+  Metrics::global().add(Metrics::HITS);
 }
 
 void Processor::search(ReadSeek& rs) {
@@ -91,16 +572,20 @@ void Processor::search(ReadSeek& rs) {
     return;
   }
   lg_reset_context(Ctx.get());
-  size_t bytesRead = 0;
+  if (Needs) {
+    Needs->reset(NeedsState);
+  }
+  resetHitCounts();
+  int64_t bytesRead = 0;
   uint64_t offset = 0;
+  const uint8_t* buf = nullptr;
   rs.seek(0);
-  do {
-      bytesRead = rs.read(1 << 20, Buf);
-      if (bytesRead > 0) {
-        lg_search(Ctx.get(), (char*)Buf.data(), (char*)Buf.data() + bytesRead, offset, (void*)this, handleSearchHit);
-      }
-      offset += bytesRead;
-    } while (bytesRead > 0);
+  // nothing more to read once the rules are decided
+  while (!searchSettled() && (bytesRead = timedRead(rs, 1 << 20, buf)) > 0) {
+    timedSearch(Ctx.get(), (const char*)buf, (const char*)buf + bytesRead, offset, (void*)this, handleSearchHit);
+    offset += bytesRead;
+  }
 
   lg_closeout_search(Ctx.get(), (void*)this, handleSearchHit);
+  addFileHitsToBatch();
 }
@@ -0,0 +1,231 @@
+#include "readahead.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#include "throw.h"
+
+BufferPool::BufferPool(size_t numBuffers, size_t bufferSize):
+  BufferSize(bufferSize), Mutex(), Freed(), Free(), All()
+{
+  // aligned_alloc wants a multiple of the alignment
+  const size_t allocSize = (bufferSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  for (size_t i = 0; i < numBuffers; ++i) {
+    uint8_t* buf = static_cast<uint8_t*>(std::aligned_alloc(ALIGNMENT, allocSize));
+    THROW_IF(!buf, "Could not allocate read-ahead buffer");
+    All.push_back(buf);
+  }
+  Free = All;
+}
+
+BufferPool::~BufferPool() {
+  for (uint8_t* buf : All) {
+    std::free(buf);
+  }
+}
+
+size_t BufferPool::available() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Free.size();
+}
+
+uint8_t* BufferPool::acquire() {
+  std::unique_lock<std::mutex> lock(Mutex);
+  Freed.wait(lock, [this]() { return !Free.empty(); });
+  uint8_t* buf = Free.back();
+  Free.pop_back();
+  return buf;
+}
+
+void BufferPool::release(uint8_t* buf) {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Free.push_back(buf);
+  }
+  Freed.notify_one();
+}
+
+//*******************************************************************
+
+struct ReadAheadStream::State {
+  State(std::unique_ptr<ReadSeek> inner, BufferPool& pool):
+    Inner(std::move(inner)), Pool(pool), Mutex(), Changed(), Blocks(),
+    Filling(true), Cancelled(false), Failed(false) {}
+
+  std::unique_ptr<ReadSeek> Inner;
+  BufferPool& Pool;
+
+  std::mutex Mutex;
+  std::condition_variable Changed;
+  std::deque<Block> Blocks; // filled and not yet consumed, in order
+  bool Filling; // until the filler returns, it owns Inner
+  bool Cancelled;
+  bool Failed;
+
+  void fill();
+};
+
+void ReadAheadStream::State::fill() {
+  const size_t bufSize = Pool.bufferSize();
+  uint64_t offset = Inner->seek(0);
+  bool done = false;
+  while (!done) {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (Cancelled) {
+        break;
+      }
+    }
+    uint8_t* buf = Pool.acquire();
+
+    size_t len = 0;
+    bool failed = false;
+    while (len < bufSize) {
+      const uint8_t* view = nullptr;
+      const int64_t n = Inner->readView(bufSize - len, view);
+      if (n <= 0) {
+        failed = n < 0;
+        done = true;
+        break;
+      }
+      std::memcpy(buf + len, view, n);
+      len += n;
+    }
+
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Cancelled || !len) {
+      Pool.release(buf);
+    }
+    else {
+      Blocks.push_back(Block{buf, offset, len});
+      offset += len;
+    }
+    Failed = failed;
+    done |= Cancelled;
+    Changed.notify_all();
+  }
+
+  // on the thread which opened it, which may be the only one allowed to
+  Inner->close();
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  Filling = false;
+  Changed.notify_all();
+}
+
+ReadAheadStream::ReadAheadStream(std::unique_ptr<ReadSeek> inner, BufferPool& pool):
+  Shared(),
+  ID(inner->getID()),
+  Size(inner->size()),
+  CheapToReread(inner->cheapToReread()),
+  Cur{nullptr, 0, 0},
+  Pos(0),
+  Direct(false)
+{
+  if (inner->identity()) {
+    setIdentity(*inner->identity());
+  }
+  if (inner->diskOffset()) {
+    setDiskOffset(*inner->diskOffset());
+  }
+  Shared = std::make_shared<State>(std::move(inner), pool);
+}
+
+ReadAheadStream::~ReadAheadStream() {
+  close();
+}
+
+std::function<void()> ReadAheadStream::filler() {
+  std::shared_ptr<State> s(Shared);
+  return [s]() { s->fill(); };
+}
+
+void ReadAheadStream::stop() {
+  // the filler may be waiting for this very buffer
+  if (Cur.Buf) {
+    Shared->Pool.release(Cur.Buf);
+    Cur.Buf = nullptr;
+  }
+  std::unique_lock<std::mutex> lock(Shared->Mutex);
+  Shared->Cancelled = true;
+  for (const Block& b : Shared->Blocks) {
+    Shared->Pool.release(b.Buf);
+  }
+  Shared->Blocks.clear();
+  Shared->Changed.wait(lock, [this]() { return !Shared->Filling; });
+}
+
+void ReadAheadStream::goDirect() {
+  stop();
+  // The filler has closed the wrapped stream. It's opened again on this
+  // thread, since a stream may be tied to the thread which opened it,
+  // e.g., to that thread's AsyncReader or TSK handles.
+  if (auto r = Shared->Inner->reopen()) {
+    Shared->Inner = std::move(r);
+  }
+  Shared->Failed = !Shared->Inner->open();
+  Direct = true;
+}
+
+void ReadAheadStream::close() {
+  if (Direct) {
+    Shared->Inner->close();
+  }
+  else {
+    stop();
+  }
+}
+
+int64_t ReadAheadStream::read(size_t len, std::vector<uint8_t>& buf) {
+  const uint8_t* view = nullptr;
+  const int64_t n = readView(len, view);
+  buf.assign(view, view + std::max(n, int64_t(0)));
+  return n;
+}
+
+int64_t ReadAheadStream::readView(size_t len, const uint8_t*& buf) {
+  if (Direct) {
+    if (Shared->Failed) {
+      return -1;
+    }
+    const int64_t n = Shared->Inner->readView(len, buf);
+    Pos += std::max(n, int64_t(0));
+    return n;
+  }
+
+  if (!Cur.Buf || Pos >= Cur.Offset + Cur.Len) {
+    if (Cur.Buf) {
+      Shared->Pool.release(Cur.Buf);
+      Cur.Buf = nullptr;
+    }
+    std::unique_lock<std::mutex> lock(Shared->Mutex);
+    Shared->Changed.wait(lock, [this]() { return !Shared->Blocks.empty() || !Shared->Filling; });
+    if (Shared->Blocks.empty()) {
+      return Shared->Failed ? -1 : 0;
+    }
+    Cur = Shared->Blocks.front();
+    Shared->Blocks.pop_front();
+  }
+
+  const size_t n = std::min(len, size_t(Cur.Offset + Cur.Len - Pos));
+  buf = Cur.Buf + (Pos - Cur.Offset);
+  Pos += n;
+  return n;
+}
+
+size_t ReadAheadStream::seek(size_t pos) {
+  if (!Direct) {
+    if ((Cur.Buf && Cur.Offset <= pos && pos <= Cur.Offset + Cur.Len) || (!Cur.Buf && pos == Pos)) {
+      // a rewind within the buffer, e.g., after peeking at a prefix
+      return (Pos = pos);
+    }
+    goDirect();
+  }
+  return (Pos = Shared->Inner->seek(pos));
+}
+
+std::unique_ptr<ReadSeek> ReadAheadStream::reopen() const {
+  return Shared->Inner->reopen();
+}
@@ -3,17 +3,34 @@
 #include <algorithm>
 #include <cstdio>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "asyncreader.h"
+#include "blockcache.h"
 #include "throw.h"
+#include "tskhandlepool.h"
 
 int64_t ReadSeekBuf::read(size_t len, std::vector<uint8_t>& buf) {
   if (Pos >= Buf.size()) {
     return 0;
   }
   size_t toRead = std::min(len, Buf.size() - Pos);
-  buf.resize(toRead);
-  for (size_t i = 0, cur = Pos; i < toRead; ++i, ++cur) {
-    buf[i] = Buf[cur];
+  buf.assign(Buf.begin() + Pos, Buf.begin() + Pos + toRead);
+  Pos += toRead;
+  return toRead;
+}
+
+int64_t ReadSeekBuf::readView(size_t len, const uint8_t*& buf) {
+  if (Pos >= Buf.size()) {
+    return 0;
   }
+  size_t toRead = std::min(len, Buf.size() - Pos);
+  buf = Buf.data() + Pos;
   Pos += toRead;
   return toRead;
 }
@@ -55,35 +72,313 @@ size_t ReadSeekFile::size(void) const {
 
 //*******************************************************************
 
-ReadSeekTSK::ReadSeekTSK(const std::shared_ptr<TSK_FS_INFO>& fs, uint64_t inum):
-  Fs(fs),
+ReadSeekMMap::ReadSeekMMap(const std::string& path, uint64_t id, uint64_t size):
+  Path(path), ID(id), Fd(-1), Map(nullptr), Size(size), Pos(0), Fallback()
+{}
+
+bool ReadSeekMMap::open(void) {
+  if (Map || Fallback) {
+    return true;
+  }
+  FILE* f = nullptr;
+#if !defined(_WIN32)
+  const int fd = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && size_t(st.st_size) >= MMAP_THRESHOLD) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      // we read front to back exactly once, so ask for aggressive readahead
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      Fd = fd;
+      Map = static_cast<const uint8_t*>(p);
+      Size = st.st_size;
+      Pos = 0;
+      return true;
+    }
+  }
+  // small, special, or unmappable file; hand the descriptor to stdio
+  f = fdopen(fd, "rb");
+  if (!f) {
+    ::close(fd);
+    return false;
+  }
+#else
+  f = std::fopen(Path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+#endif
+  Fallback.reset(new ReadSeekFile(std::shared_ptr<FILE>(f, std::fclose)));
+  Size = Fallback->size();
+  return true;
+}
+
+void ReadSeekMMap::close(void) {
+#if !defined(_WIN32)
+  if (Map) {
+    munmap(const_cast<uint8_t*>(Map), Size);
+  }
+  if (Fd >= 0) {
+    ::close(Fd);
+  }
+#endif
+  Fd = -1;
+  Map = nullptr;
+  Pos = 0;
+  if (Fallback) {
+    // the size stays as last seen
+    Size = Fallback->size();
+    Fallback.reset();
+  }
+}
+
+bool ReadSeekMMap::shrank(size_t end) const {
+#if !defined(_WIN32)
+  struct stat st;
+  return fstat(Fd, &st) != 0 || size_t(st.st_size) < end;
+#else
+  return false;
+#endif
+}
+
+bool ReadSeekMMap::fallBack() {
+#if !defined(_WIN32)
+  FILE* f = fdopen(Fd, "rb");
+  if (!f) {
+    return false;
+  }
+  munmap(const_cast<uint8_t*>(Map), Size);
+  Map = nullptr;
+  Fd = -1; // stdio's now
+  Fallback.reset(new ReadSeekFile(std::shared_ptr<FILE>(f, std::fclose)));
+  Fallback->seek(Pos);
+  return true;
+#else
+  return false;
+#endif
+}
+
+int64_t ReadSeekMMap::read(size_t len, std::vector<uint8_t>& buf) {
+  if (Fallback) {
+    return Fallback->read(len, buf);
+  }
+  const uint8_t* view = nullptr;
+  const int64_t ret = readView(len, view);
+  if (ret < 0) {
+    return ret;
+  }
+  buf.assign(view, view + ret);
+  return ret;
+}
+
+int64_t ReadSeekMMap::readView(size_t len, const uint8_t*& buf) {
+  if (Fallback) {
+    return Fallback->readView(len, buf);
+  }
+  if (Pos >= Size) {
+    return 0;
+  }
+  const size_t toRead = std::min(len, Size - Pos);
+  if (shrank(Pos + toRead)) {
+    // a file being written to, so the pages past its end are gone
+    return fallBack() ? Fallback->readView(len, buf) : -1;
+  }
+  buf = Map + Pos;
+  Pos += toRead;
+  return toRead;
+}
+
+size_t ReadSeekMMap::tellg() const {
+  return Fallback ? Fallback->tellg() : Pos;
+}
+
+size_t ReadSeekMMap::seek(size_t pos) {
+  if (Fallback) {
+    return Fallback->seek(pos);
+  }
+  return (Pos = std::min(pos, Size));
+}
+
+size_t ReadSeekMMap::size(void) const {
+  return Fallback ? Fallback->size() : Size;
+}
+
+//*******************************************************************
+
+ReadSeekAsync::ReadSeekAsync(const std::string& path, uint64_t id, unsigned queueDepth, size_t blockSize):
+  Path(path), ID(id), QueueDepth(std::max(1u, queueDepth)), BlockSize(blockSize),
+  Fd(-1), Size(0), Pos(0), NextOffset(0), Reader(nullptr), Owner(),
+  InFlight(), Cur(), HaveCur(false), FreeBufs()
+{}
+
+bool ReadSeekAsync::open(void) {
+  if (Fd >= 0) {
+    return true;
+  }
+#if !defined(_WIN32)
+  Fd = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(Fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(Fd);
+    Fd = -1;
+    return false;
+  }
+  posix_fadvise(Fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  Size = st.st_size;
+  Pos = NextOffset = 0;
+  Reader = AsyncReader::local(QueueDepth);
+  Owner = std::this_thread::get_id();
+  fill();
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ReadSeekAsync::close(void) {
+  if (Fd < 0) {
+    return;
+  }
+  // the reads in flight target our buffers, so they have to finish first
+  while (!InFlight.empty()) {
+    retire(InFlight.front());
+    InFlight.pop_front();
+  }
+  if (HaveCur) {
+    FreeBufs.push_back(std::move(Cur.Buf));
+    HaveCur = false;
+  }
+#if !defined(_WIN32)
+  ::close(Fd);
+#endif
+  Fd = -1;
+  Size = Pos = NextOffset = 0;
+  FreeBufs.clear();
+  Reader.reset();
+}
+
+void ReadSeekAsync::fill() {
+  while (InFlight.size() < QueueDepth && NextOffset < Size) {
+    Block b;
+    if (FreeBufs.empty()) {
+      b.Buf.resize(BlockSize);
+    }
+    else {
+      b.Buf = std::move(FreeBufs.back());
+      FreeBufs.pop_back();
+    }
+    b.Offset = NextOffset;
+    b.Len = 0;
+    b.Ticket = Reader->submit(Fd, NextOffset, b.Buf.data(), std::min(uint64_t(BlockSize), Size - NextOffset));
+    NextOffset += BlockSize;
+    InFlight.push_back(std::move(b));
+  }
+}
+
+void ReadSeekAsync::retire(Block& b) {
+  Reader->wait(b.Ticket);
+  FreeBufs.push_back(std::move(b.Buf));
+}
+
+void ReadSeekAsync::checkOwner() const {
+  THROW_IF(std::this_thread::get_id() != Owner, "ReadSeekAsync for " << Path << " used off the thread which opened it");
+}
+
+int64_t ReadSeekAsync::readView(size_t len, const uint8_t*& buf) {
+  if (Fd < 0 || Pos >= Size) {
+    return 0;
+  }
+  checkOwner();
+  if (!HaveCur || Pos < Cur.Offset || Pos >= Cur.Offset + Cur.Len) {
+    if (HaveCur) {
+      FreeBufs.push_back(std::move(Cur.Buf));
+      HaveCur = false;
+    }
+    // drop any reads a seek has made useless, then restart if need be
+    while (!InFlight.empty() &&
+           (Pos < InFlight.front().Offset || Pos >= InFlight.front().Offset + BlockSize)) {
+      retire(InFlight.front());
+      InFlight.pop_front();
+    }
+    if (InFlight.empty()) {
+      NextOffset = Pos;
+      fill();
+    }
+    Cur = std::move(InFlight.front());
+    InFlight.pop_front();
+    Cur.Len = Reader->wait(Cur.Ticket);
+    HaveCur = true;
+    fill();
+
+    if (Pos >= Cur.Offset + std::max(Cur.Len, int64_t(0))) {
+      // read error or the file shrank underneath us
+      return 0;
+    }
+  }
+  const size_t toRead = std::min(len, size_t(Cur.Offset + Cur.Len - Pos));
+  buf = Cur.Buf.data() + (Pos - Cur.Offset);
+  Pos += toRead;
+  return toRead;
+}
+
+int64_t ReadSeekAsync::read(size_t len, std::vector<uint8_t>& buf) {
+  buf.clear();
+  const uint8_t* view = nullptr;
+  int64_t n = 0;
+  while (buf.size() < len && (n = readView(len - buf.size(), view)) > 0) {
+    buf.insert(buf.end(), view, view + n);
+  }
+  return buf.size();
+}
+
+//*******************************************************************
+
+ReadSeekTSK::ReadSeekTSK(const std::shared_ptr<TskHandlePool>& handles, TSK_OFF_T fsOffset, TSK_FS_TYPE_ENUM fsType, uint64_t inum):
+  Handles(handles),
+  FsOffset(fsOffset),
+  FsType(fsType),
   Inum(inum),
-  FilePtr(nullptr),
+  Lease(),
+  File(nullptr, nullptr),
   Pos(0)
 {}
 
 bool ReadSeekTSK::open(void) {
-  if (!FilePtr) {
-    FilePtr = tsk_fs_file_open_meta(Fs.get(), nullptr, Inum);
-    if (!FilePtr) {
-      return false;
-    }
+  if (File) {
+    return true;
+  }
+  Lease = std::make_unique<TskHandlePool::Lease>(Handles->checkout());
+  File = Lease->openFile(FsOffset, FsType, Inum);
+  if (!File) {
+    Lease.reset();
+    return false;
   }
   return true;
 }
 
 void ReadSeekTSK::close(void) {
-  if (FilePtr) {
-    tsk_fs_file_close(FilePtr);
-    FilePtr = nullptr;
-  }
+  File.reset();
+  Lease.reset();
 }
 
 int64_t ReadSeekTSK::read(size_t len, std::vector<uint8_t>& buf) {
-  if (FilePtr && Pos < size_t(FilePtr->meta->size)) {
-    buf.resize(len);
-    auto bytesRead = tsk_fs_file_read(FilePtr, Pos, (char*)buf.data(), len, TSK_FS_FILE_READ_FLAG_NONE);
-    buf.resize(bytesRead);
+  if (File && Pos < size_t(File->meta->size)) {
+    // size the buffer once for what's left in the file; it only needs
+    // to shrink again on a short read
+    buf.resize(std::min(len, size_t(File->meta->size) - Pos));
+    auto bytesRead = tsk_fs_file_read(File.get(), Pos, (char*)buf.data(), buf.size(), TSK_FS_FILE_READ_FLAG_NONE);
+    if (bytesRead < 0) {
+      bytesRead = 0;
+    }
+    if (size_t(bytesRead) < buf.size()) {
+      buf.resize(bytesRead);
+    }
     Pos += bytesRead;
     return bytesRead;
   }
@@ -91,14 +386,24 @@ int64_t ReadSeekTSK::read(size_t len, std::vector<uint8_t>& buf) {
 }
 
 size_t ReadSeekTSK::seek(size_t pos) {
-  if (FilePtr) {
-    Pos = std::min(pos, size_t(FilePtr->meta->size));
+  if (File) {
+    Pos = std::min(pos, size_t(File->meta->size));
     return Pos;
   }
   return 0;
 }
 
 size_t ReadSeekTSK::size(void) const {
-  return FilePtr ? FilePtr->meta->size : 0;
+  return File ? File->meta->size : 0;
+}
+
+std::unique_ptr<ReadSeek> ReadSeekTSK::reopen() const {
+  return std::make_unique<ReadSeekTSK>(Handles, FsOffset, FsType, Inum);
+}
+
+bool ReadSeekTSK::cheapToReread() const {
+  // other threads' reads evict blocks meanwhile, so allow for them
+  const auto& cache = Handles->cache();
+  return cache && size() <= cache->capacity() / 4;
 }
 
@@ -32,27 +32,54 @@ void LlamaRuleEngine::writeRulesToDb(LlamaDBConnection& dbConn) {
   THROW_IF(state == DuckDBError, "Error inserting into rule matches table");
 }
 
+void LlamaRuleEngine::writePatternsToDb(LlamaDBConnection& dbConn, ProgramHandle* prog) {
+  if (!prog) {
+    return;
+  }
+  DBBatch<PatternRec> patterns;
+  const unsigned numPatterns = lg_prog_pattern_count(prog);
+  for (unsigned i = 0; i < numPatterns; ++i) {
+    const LG_PatternInfo* info = lg_prog_pattern_info(prog, i);
+    patterns.add(PatternRec{
+      i, info->Pattern, info->EncodingChain, i < PatternToRuleId.size() ? PatternToRuleId[i] : ""
+    });
+  }
+  LlamaDBAppender appender(dbConn.get(), "patterns");
+  patterns.copyToDB(appender.get());
+  THROW_IF(!appender.flush(), "Error inserting into patterns table");
+}
+
 void LlamaRuleEngine::createTables(LlamaDBConnection& dbConn) {
   DBType<RuleRec> ruleRec;
   THROW_IF(!ruleRec.createTable(dbConn.get(), "rules"), "Error creating rule table");
   DBType<RuleMatch> ruleMatch;
   THROW_IF(!ruleMatch.createTable(dbConn.get(), "rule_hits"), "Error creating rule hits table");
+  DBType<PatternRec> pattern;
+  THROW_IF(!pattern.createTable(dbConn.get(), "patterns"), "Error creating pattern table");
   DBType<SearchHit> searchHit;
   THROW_IF(!searchHit.createTable(dbConn.get(), "search_hits"), "Error creating search hit table");
+  DBType<SearchHitOverflow> overflow;
+  THROW_IF(!overflow.createTable(dbConn.get(), "search_hits_overflow"), "Error creating search hit overflow table");
 }
 
 LgFsmHolder LlamaRuleEngine::buildFsm() {
   LgFsmHolder fsm;
   FieldHash h;
-  for (const Rule& rule : Reader.getRules()) {
-    h = rule.getHash(Reader.getParser());
-    for (const auto& pPair : rule.Grep.Patterns.Patterns) {
+  const std::vector<Rule>& rules = Reader.getRules();
+  for (size_t r = 0; r < rules.size(); ++r) {
+    h = rules[r].getHash(Reader.getParser());
+    for (const auto& pPair : rules[r].Grep.Patterns.Patterns) {
       fsm.addPatterns(pPair, Reader.getParser(), h.to_string(), PatternToRuleId);
+      KeywordPatterns.resize(PatternToRuleId.size(), std::make_pair(r, pPair.first));
     }
   }
   return fsm;
 }
 
+HitNeeds LlamaRuleEngine::hitNeeds() const {
+  return HitNeeds(Reader.getRules(), Reader.getParser(), KeywordPatterns);
+}
+
 bool LlamaRuleEngine::read(const std::string& input, const std::string& source) {
   // Make a copy of the input and save as member to ensure input string lifetime
   // (since we're passing around `string_view`s)
@@ -60,6 +87,14 @@ bool LlamaRuleEngine::read(const std::string& input, const std::string& source)
   return Reader.read(Input, source);
 }
 
+uint64_t LlamaRuleEngine::hashAlgs() const {
+  uint64_t algs = 0;
+  for (const Rule& rule : Reader.getRules()) {
+    algs |= rule.Hash.HashAlgs;
+  }
+  return algs;
+}
+
 uint64_t LlamaRuleEngine::numRulesRead() {
   return Reader.getRules().size();
 }
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "scancache.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include <lightgrep/api.h>
+
+#include "fieldhasher.h"
+#include "throw.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+  void exec(duckdb_connection& conn, const std::string& query) {
+    duckdb_result result;
+    const auto state = duckdb_query(conn, query.c_str(), &result);
+    std::string err;
+    if (state == DuckDBError && duckdb_result_error(&result)) {
+      err = duckdb_result_error(&result);
+    }
+    duckdb_destroy_result(&result);
+    THROW_IF(state == DuckDBError, "Error in scan cache query '" << query << "': " << err);
+  }
+
+  std::string varchar(duckdb_result& result, uint64_t col, uint64_t row) {
+    char* v = duckdb_value_varchar(&result, col, row);
+    std::string ret(v ? v : "");
+    duckdb_free(v);
+    return ret;
+  }
+
+  std::string sqlQuote(const std::string& s) {
+    std::string ret("'");
+    for (char c : s) {
+      ret += c;
+      if (c == '\'') {
+        ret += c;
+      }
+    }
+    return ret + "'";
+  }
+
+  template<typename T>
+  void toTempTable(duckdb_connection& conn, const std::string& table, DBBatch<T>& batch) {
+    DBType<T>::createTable(conn, table);
+    LlamaDBAppender appender(conn, table);
+    batch.copyToDB(appender.get());
+    appender.flush();
+  }
+
+  DBBatch<ScanCacheSearched> searchedBatch(const std::string& programId, const std::unordered_set<std::string>& hashes) {
+    DBBatch<ScanCacheSearched> batch;
+    for (const std::string& h : hashes) {
+      batch.add(ScanCacheSearched{programId, h});
+    }
+    return batch;
+  }
+}
+
+size_t ScanCache::IdentityHash::operator()(const FileIdentity& id) const {
+  size_t h = std::hash<uint64_t>()(id.Addr);
+  h = h * 31 + std::hash<uint64_t>()(id.FsOffset);
+  h = h * 31 + std::hash<uint64_t>()(id.SeqNum);
+  h = h * 31 + std::hash<uint64_t>()(id.Filesize);
+  return h * 31 + std::hash<std::string>()(id.Modified);
+}
+
+ScanCache::ScanCache(duckdb_connection& conn, const std::string& path, const std::string& imageId, const std::string& programId):
+  ImageId(imageId), ProgramId(programId)
+{
+  attach(conn, path);
+  load(conn);
+}
+
+ScanCache::ScanCache(duckdb_connection& conn, const std::string& path, const Evidence& input, const std::string& programId):
+  ImageId(), ProgramId(programId)
+{
+  attach(conn, path);
+  ImageId = imageIdentity(conn, input.Path);
+  load(conn);
+}
+
+void ScanCache::attach(duckdb_connection& conn, const std::string& path) {
+  exec(conn, "ATTACH " + sqlQuote(path) + " AS scan_cache;");
+  // these fail harmlessly if the cache already has them
+  DBType<ScanCacheRec>::createTable(conn, "scan_cache.files");
+  DBType<ScanCacheSearched>::createTable(conn, "scan_cache.searched");
+  DBType<ScanCacheHit>::createTable(conn, "scan_cache.hits");
+  DBType<ScanCacheOverflow>::createTable(conn, "scan_cache.overflow");
+  DBType<ScanCacheImage>::createTable(conn, "scan_cache.images");
+}
+
+void ScanCache::load(duckdb_connection& conn) {
+  duckdb_result result;
+  std::string query = "SELECT FsOffset, Addr, SeqNum, Filesize, Modified, HashAlgs, MD5, SHA1, SHA256, Blake3, Ssdeep "
+                      "FROM scan_cache.files WHERE ImageId = " + sqlQuote(ImageId) + ";";
+  THROW_IF(duckdb_query(conn, query.c_str(), &result) == DuckDBError, "Error reading scan cache files");
+  for (uint64_t row = 0; row < duckdb_row_count(&result); ++row) {
+    Files.emplace(
+      FileIdentity{
+        duckdb_value_uint64(&result, 0, row),
+        duckdb_value_uint64(&result, 1, row),
+        duckdb_value_uint64(&result, 2, row),
+        duckdb_value_uint64(&result, 3, row),
+        varchar(result, 4, row)
+      },
+      Entry{
+        duckdb_value_uint64(&result, 5, row),
+        HashRec{0, varchar(result, 6, row), varchar(result, 7, row), varchar(result, 8, row),
+                   varchar(result, 9, row), varchar(result, 10, row)}
+      }
+    );
+  }
+  duckdb_destroy_result(&result);
+
+  query = "SELECT Blake3 FROM scan_cache.searched WHERE ProgramId = " + sqlQuote(ProgramId) + ";";
+  THROW_IF(duckdb_query(conn, query.c_str(), &result) == DuckDBError, "Error reading scan cache searches");
+  for (uint64_t row = 0; row < duckdb_row_count(&result); ++row) {
+    Searched.insert(varchar(result, 0, row));
+  }
+  duckdb_destroy_result(&result);
+}
+
+const ScanCache::Entry* ScanCache::find(const FileIdentity& id, uint64_t hashAlgs) const {
+  auto it = Files.find(id);
+  return it != Files.end() && (it->second.HashAlgs & hashAlgs) == hashAlgs ? &it->second : nullptr;
+}
+
+bool ScanCache::wasSearched(const std::string& blake3) {
+  if (Searched.find(blake3) == Searched.end()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(Mutex);
+  Reused.insert(blake3);
+  return true;
+}
+
+void ScanCache::add(const FileIdentity& id, uint64_t hashAlgs, const HashRec& hashes, bool searched) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Current.add(ScanCacheRec{
+    ImageId, id.FsOffset, id.Addr, id.SeqNum, id.Filesize, id.Modified, hashAlgs,
+    hashes.MD5, hashes.SHA1, hashes.SHA256, hashes.Blake3, hashes.Ssdeep
+  });
+  if (searched && Searched.find(hashes.Blake3) == Searched.end()) {
+    NewlySearched.insert(hashes.Blake3);
+  }
+}
+
+void ScanCache::finish(duckdb_connection& conn) {
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  auto reused = searchedBatch(ProgramId, Reused);
+  toTempTable(conn, "_scan_cache_reused", reused);
+  exec(conn, "INSERT INTO search_hits SELECT pattern_id, start_offset, end_offset, file_hash, length "
+             "FROM scan_cache.hits WHERE ProgramId = " + sqlQuote(ProgramId) + " "
+             "AND file_hash IN (SELECT Blake3 FROM _scan_cache_reused);");
+  exec(conn, "INSERT INTO search_hits_overflow SELECT pattern_id, file_hash, dropped "
+             "FROM scan_cache.overflow WHERE ProgramId = " + sqlQuote(ProgramId) + " "
+             "AND file_hash IN (SELECT Blake3 FROM _scan_cache_reused);");
+
+  auto fresh = searchedBatch(ProgramId, NewlySearched);
+  toTempTable(conn, "_scan_cache_new", fresh);
+  exec(conn, "INSERT INTO scan_cache.searched SELECT * FROM _scan_cache_new;");
+  exec(conn, "INSERT INTO scan_cache.hits SELECT " + sqlQuote(ProgramId) + ", * FROM search_hits "
+             "WHERE file_hash IN (SELECT Blake3 FROM _scan_cache_new);");
+  exec(conn, "INSERT INTO scan_cache.overflow SELECT " + sqlQuote(ProgramId) + ", * FROM search_hits_overflow "
+             "WHERE file_hash IN (SELECT Blake3 FROM _scan_cache_new);");
+
+  // the cache keeps only the latest run's files for each piece of evidence
+  toTempTable(conn, "_scan_cache_files", Current);
+  exec(conn, "DELETE FROM scan_cache.files WHERE ImageId = " + sqlQuote(ImageId) + ";");
+  exec(conn, "INSERT INTO scan_cache.files SELECT * FROM _scan_cache_files;");
+
+  exec(conn, "DROP TABLE _scan_cache_reused;");
+  exec(conn, "DROP TABLE _scan_cache_new;");
+  exec(conn, "DROP TABLE _scan_cache_files;");
+  exec(conn, "DETACH scan_cache;");
+}
+
+std::string ScanCache::imageIdentity(const std::string& input) {
+  FieldHasher hasher;
+  std::error_code err;
+  if (fs::is_directory(input, err)) {
+    hasher.hash_em(fs::absolute(input, err).lexically_normal().generic_string());
+  }
+  else {
+    std::ifstream in(input, std::ios::binary);
+    THROW_IF(!in, "Couldn't read " << input << " to identify it for the scan cache");
+    std::vector<char> buf(1 << 20);
+    while (in.read(buf.data(), buf.size()) || in.gcount()) {
+      hasher.hash_em(std::string_view(buf.data(), in.gcount()));
+    }
+  }
+  return hasher.get_hash().to_string();
+}
+
+std::string ScanCache::imageIdentity(duckdb_connection& conn, const std::string& input) {
+  std::error_code err;
+  struct stat st;
+  if (fs::is_directory(input, err) || stat(input.c_str(), &st) != 0) {
+    return imageIdentity(input);
+  }
+
+  const ScanCacheImage key{
+    fs::absolute(input, err).lexically_normal().generic_string(),
+    uint64_t(st.st_size),
+    uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+    uint64_t(st.st_dev),
+    uint64_t(st.st_ino),
+    ""
+  };
+  const std::string where = "WHERE Path = " + sqlQuote(key.Path);
+  const std::string query = "SELECT ImageId FROM scan_cache.images " + where +
+    " AND Size = " + std::to_string(key.Size) + " AND Modified = " + std::to_string(key.Modified) +
+    " AND Device = " + std::to_string(key.Device) + " AND Inode = " + std::to_string(key.Inode) + ";";
+  duckdb_result result;
+  THROW_IF(duckdb_query(conn, query.c_str(), &result) == DuckDBError, "Error reading scan cache images");
+  std::string ret = duckdb_row_count(&result) ? varchar(result, 0, 0) : "";
+  duckdb_destroy_result(&result);
+
+  if (ret.empty()) {
+    // read all of it, once for as long as it stays put
+    ret = imageIdentity(input);
+    exec(conn, "DELETE FROM scan_cache.images " + where + ";");
+    exec(conn, "INSERT INTO scan_cache.images VALUES (" + sqlQuote(key.Path) + ", " +
+               std::to_string(key.Size) + ", " + std::to_string(key.Modified) + ", " +
+               std::to_string(key.Device) + ", " + std::to_string(key.Inode) + ", " + sqlQuote(ret) + ");");
+  }
+  return ret;
+}
+
+std::string ScanCache::programIdentity(ProgramHandle* prog, const std::vector<std::string>& patternToRuleId,
+                                       const std::vector<uint64_t>& searchSettings)
+{
+  FieldHasher hasher;
+  if (prog) {
+    std::vector<char> buf(lg_program_size(prog));
+    lg_write_program(prog, buf.data());
+    hasher.hash_em(std::string_view(buf.data(), buf.size()));
+  }
+  for (const std::string& ruleId : patternToRuleId) {
+    hasher.hash_em(ruleId);
+  }
+  for (uint64_t setting : searchSettings) {
+    hasher.hash_em(setting);
+  }
+  return hasher.get_hash().to_string();
+}
@@ -2,6 +2,7 @@
 
 #include "tskautowrapper.h"
 #include "tskconversion.h"
+#include "tskreaderhelper.h"
 #include "tsktimestamps.h"
 #include "util.h"
 
@@ -28,6 +29,14 @@ void TskFacade::populateAttrs(TSK_FS_FILE* file) const {
   tsk_fs_file_attr_get_idx(file, 0);
 }
 
+std::optional<uint64_t> TskFacade::firstDataOffset(TSK_FS_FILE* file) const {
+  const TSK_FS_ATTR* attr = tsk_fs_file_attr_get(file);
+  if (!attr) {
+    return std::nullopt;
+  }
+  return TskReaderHelper::firstDataOffset(*attr, file->fs_info->offset, file->fs_info->block_size);
+}
+
 bool TskFacade::walk(
   TSK_IMG_INFO* info,
   std::function<TSK_FILTER_ENUM(const TSK_VS_INFO*)> vs_cb,
@@ -39,6 +48,37 @@ bool TskFacade::walk(
   return TskAutoWrapper(info, vs_cb, vol_cb, fs_cb, file_cb).findFilesInImg() == 0;
 }
 
+bool TskFacade::walkFs(
+  TSK_IMG_INFO* info,
+  TSK_OFF_T off,
+  TSK_FS_TYPE_ENUM type,
+  std::function<TSK_FILTER_ENUM(TSK_FS_INFO*)> fs_cb,
+  std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)> file_cb
+)
+{
+  return TskAutoWrapper(
+    info,
+    [](const TSK_VS_INFO*) { return TSK_FILTER_CONT; },
+    [](const TSK_VS_PART_INFO*) { return TSK_FILTER_CONT; },
+    fs_cb,
+    file_cb
+  ).findFilesInFs(off, type) == 0;
+}
+
+bool TskFacade::listDir(TSK_FS_INFO* fs, TSK_INUM_T inum, std::function<void(TSK_FS_FILE*)> file_cb) const {
+  auto dir = make_unique_del(tsk_fs_dir_open_meta(fs, inum), tsk_fs_dir_close);
+  if (!dir) {
+    return false;
+  }
+  for (size_t i = 0; i < tsk_fs_dir_getsize(dir.get()); ++i) {
+    auto file = make_unique_del(tsk_fs_dir_get(dir.get(), i), tsk_fs_file_close);
+    if (file) {
+      file_cb(file.get());
+    }
+  }
+  return true;
+}
+
 jsoncons::json TskFacade::convertImg(const TSK_IMG_INFO& img) const {
   return TskUtils::convertImg(img);
 }
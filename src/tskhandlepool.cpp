@@ -0,0 +1,162 @@
+#include "tskhandlepool.h"
+
+#include <unordered_map>
+
+#include "memorybudget.h"
+#include "tskfacade.h"
+#include "tskimgcache.h"
+
+struct TskHandlePool::Handles {
+  Handles(TskHandlePool& pool): Pool(pool), Img(nullptr, nullptr), ImgCache(), Fs() {}
+
+  ~Handles() {
+    Fs.clear();
+    ImgCache.reset();
+    if (Img) {
+      Img.reset();
+      Pool.closed();
+    }
+  }
+
+  TskHandlePool& Pool;
+  std::unique_ptr<TSK_IMG_INFO, void(*)(TSK_IMG_INFO*)> Img;
+  std::unique_ptr<TskImgCache> ImgCache; // gone before Img
+  std::unordered_map<TSK_OFF_T, std::unique_ptr<TSK_FS_INFO, void(*)(TSK_FS_INFO*)>> Fs; // gone before ImgCache
+};
+
+TskHandlePool::Lease::Lease(TskHandlePool& pool, std::unique_ptr<Handles> h):
+  Pool(&pool), H(std::move(h))
+{
+}
+
+TskHandlePool::Lease::Lease(Lease&& other):
+  Pool(other.Pool), H(std::move(other.H))
+{
+}
+
+TskHandlePool::Lease::~Lease() {
+  if (H) {
+    Pool->giveBack(std::move(H));
+  }
+}
+
+TSK_FS_INFO* TskHandlePool::Lease::fs(TSK_OFF_T off, TSK_FS_TYPE_ENUM type) {
+  if (!H->Img) {
+    if (!(H->Img = Pool->Tsk->openImg(Pool->ImgPath.c_str()))) {
+      return nullptr;
+    }
+    Pool->opened();
+    if (Pool->Cache) {
+      H->ImgCache = std::make_unique<TskImgCache>(H->Img.get(), Pool->Cache);
+    }
+  }
+
+  auto itr = H->Fs.find(off);
+  if (itr == H->Fs.end()) {
+    auto fs = Pool->Tsk->openFS(H->Img.get(), off, type);
+    if (!fs) {
+      return nullptr;
+    }
+    itr = H->Fs.emplace(off, std::move(fs)).first;
+  }
+  return itr->second.get();
+}
+
+std::unique_ptr<TSK_FS_FILE, void(*)(TSK_FS_FILE*)> TskHandlePool::Lease::openFile(TSK_OFF_T off, TSK_FS_TYPE_ENUM type, TSK_INUM_T inum) {
+  TSK_FS_INFO* fsInfo = fs(off, type);
+  if (!fsInfo) {
+    return {nullptr, nullptr};
+  }
+  return Pool->Tsk->openFile(fsInfo, inum);
+}
+
+TskHandlePool::TskHandlePool(
+  const std::string& imgPath,
+  const std::shared_ptr<const TskFacade>& tsk,
+  const std::shared_ptr<BlockCache>& cache,
+  size_t maxIdle
+):
+  ImgPath(imgPath),
+  Tsk(tsk),
+  Cache(cache),
+  MaxIdle(maxIdle),
+  Mutex(),
+  Idle(),
+  Open(0),
+  Budget()
+{
+}
+
+TskHandlePool::~TskHandlePool() {
+  // not under the lock, which closing takes
+  std::vector<std::unique_ptr<Handles>> idle;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    idle.swap(Idle);
+  }
+}
+
+void TskHandlePool::setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  if (Budget) {
+    Budget->release(Open * HANDLE_BYTES);
+  }
+  Budget = budget;
+  if (Budget) {
+    Budget->charge(Open * HANDLE_BYTES);
+  }
+}
+
+TskHandlePool::Lease TskHandlePool::checkout() {
+  std::unique_ptr<Handles> h;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (!Idle.empty()) {
+      h = std::move(Idle.back());
+      Idle.pop_back();
+    }
+  }
+  if (!h) {
+    h = std::make_unique<Handles>(*this);
+  }
+  return Lease(*this, std::move(h));
+}
+
+void TskHandlePool::giveBack(std::unique_ptr<Handles> h) {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    // a handle whose image didn't open isn't worth keeping
+    if (h->Img && Idle.size() < MaxIdle) {
+      Idle.push_back(std::move(h));
+      return;
+    }
+  }
+  // closed outside the lock
+  h.reset();
+}
+
+void TskHandlePool::opened() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  ++Open;
+  if (Budget) {
+    Budget->charge(HANDLE_BYTES);
+  }
+}
+
+void TskHandlePool::closed() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  --Open;
+  if (Budget) {
+    Budget->release(HANDLE_BYTES);
+  }
+}
+
+size_t TskHandlePool::size() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Open;
+}
+
+size_t TskHandlePool::idle() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Idle.size();
+}
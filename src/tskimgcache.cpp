@@ -0,0 +1,59 @@
+#include "tskimgcache.h"
+
+#include <algorithm>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "blockcache.h"
+#include "throw.h"
+
+namespace {
+  // TSK only passes the image to its read function, so that's how the
+  // cache is found
+  std::shared_mutex RegistryMutex;
+  std::unordered_map<const TSK_IMG_INFO*, TskImgCache*> Registry;
+}
+
+TskImgCache::TskImgCache(TSK_IMG_INFO* img, const std::shared_ptr<BlockCache>& cache):
+  Img(img), BackendRead(img->read), Cache(cache)
+{
+  std::unique_lock<std::shared_mutex> lock(RegistryMutex);
+  THROW_IF(!Registry.emplace(Img, this).second, "Image already has a cache");
+  Img->read = &TskImgCache::cachedRead;
+}
+
+TskImgCache::~TskImgCache() {
+  std::unique_lock<std::shared_mutex> lock(RegistryMutex);
+  Img->read = BackendRead;
+  Registry.erase(Img);
+}
+
+ssize_t TskImgCache::cachedRead(TSK_IMG_INFO* img, TSK_OFF_T off, char* buf, size_t len) {
+  TskImgCache* self = nullptr;
+  {
+    std::shared_lock<std::shared_mutex> lock(RegistryMutex);
+    self = Registry.at(img);
+  }
+  return self->Cache->read(
+    off, reinterpret_cast<uint8_t*>(buf), len,
+    [self](uint64_t blockOff, uint8_t* blockBuf, size_t blockLen) -> int64_t {
+      if (blockOff >= uint64_t(self->Img->size)) {
+        return 0;
+      }
+      // a short block is taken for the end of the image, so read it all
+      blockLen = std::min<uint64_t>(blockLen, self->Img->size - blockOff);
+      size_t got = 0;
+      while (got < blockLen) {
+        const ssize_t n = self->BackendRead(self->Img, blockOff + got, reinterpret_cast<char*>(blockBuf) + got, blockLen - got);
+        if (n < 0) {
+          return -1;
+        }
+        if (n == 0) {
+          break;
+        }
+        got += n;
+      }
+      return got;
+    }
+  );
+}
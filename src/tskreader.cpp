@@ -1,5 +1,13 @@
 #include "tskreader.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <thread>
+
+#include "blockcache.h"
 #include "blocksequence_impl.h"
 #include "inode.h"
 #include "inodeandblocktracker.h"
@@ -10,52 +18,340 @@
 
 #include "tskconversion.h"
 #include "tskfacade.h"
+#include "tskhandlepool.h"
 #include "tsktimestamps.h"
 
-TskReader::TskReader(const std::string& imgPath):
+TskReader::FsWalk::FsWalk(const std::shared_ptr<InputHandler>& in, const std::string& basePath):
+  Input(in), Tsg(), Claims(), RecHasher(), Dirents(RecHasher, basePath)
+{
+}
+
+TskReader::FsWalk::~FsWalk() {}
+
+TskReader::TskReader(
+  const std::string& imgPath,
+  unsigned int walkThreads,
+  uint64_t imageCacheSize,
+  unsigned int fsThreads,
+  const std::shared_ptr<TskFacade>& tsk
+):
   ImgPath(imgPath),
+  WalkThreads(std::max(1u, walkThreads)),
+  FsThreads(std::max(1u, fsThreads)),
   Img(nullptr, nullptr),
+  ImageCacheSize(imageCacheSize),
+  ImgCache(),
+  Handles(),
   Input(),
-  Tsk(new TskFacade),
+  Tsk(tsk ? tsk : std::make_shared<TskFacade>()),
   Asm(),
-  Tsg(nullptr),
-  RecHasher(),
-  Dirents(RecHasher)
+  FileSystems()
 {
 }
 
 TskReader::~TskReader() {}
 
 bool TskReader::open() {
-  return bool(Img = Tsk->openImg(ImgPath.c_str()));
+  if (!(Img = Tsk->openImg(ImgPath.c_str()))) {
+    return false;
+  }
+  std::shared_ptr<BlockCache> cache;
+  if (ImageCacheSize) {
+    cache = std::make_shared<BlockCache>(ImageCacheSize);
+    ImgCache = std::make_unique<TskImgCache>(Img.get(), cache);
+  }
+  // files are read and directories walked on handles lent by the pool,
+  // which share the cache; enough are kept for the threads doing either
+  Handles = std::make_shared<TskHandlePool>(ImgPath, Tsk, cache, std::max(WalkThreads, FsThreads));
+  return true;
+}
+
+void TskReader::setMemoryBudget(const std::shared_ptr<MemoryBudget>& budget) {
+  Handles->setMemoryBudget(budget);
 }
 
 bool TskReader::startReading() {
   Asm.addImage(Tsk->convertImg(*Img));
 
-  // tell TskAuto to start giving files to processFile
+  // find the file systems first, without walking them
   // std::cerr << "Image is " << getImageSize() << " bytes in size" << std::endl;
-  const bool ret = Tsk->walk(
+  FileSystems.clear();
+  if (!Tsk->walk(
     Img.get(),
     [this](const TSK_VS_INFO* vs_info) { return filterVs(vs_info); },
     [this](const TSK_VS_PART_INFO* vs_part) { return filterVol(vs_part); },
     [this](TSK_FS_INFO* fs_info) { return filterFs(fs_info); },
-    [this](TSK_FS_FILE* fs_file, const char* path) { return processFile(fs_file, path); }
-  );
+    [](TSK_FS_FILE*, const char*) { return TSK_OK; }
+  )) {
+    return false;
+  }
+//    Output->outputImage(Asm.dump());
 
-  if (ret) {
-    // wrap up the walk
-    while (!Dirents.empty()) {
-      Input->push(Dirents.pop());
+  // The file systems are walked by up to FsThreads threads at once, each
+  // with a fork of the handler, so multi-volume images aren't walked one
+  // volume at a time, nor images with dozens of them by dozens of threads.
+  // The walks share the WalkThreads for splitting file systems.
+  std::vector<std::shared_ptr<InputHandler>> ins{Input};
+  while (ins.size() < std::min<size_t>(FsThreads, FileSystems.size())) {
+    std::shared_ptr<InputHandler> in = Input->fork();
+    if (!in) {
+      // the handler can't be forked, so the walks take turns with it
+      break;
     }
-//    Output->outputImage(Asm.dump());
+    ins.push_back(in);
+  }
+  const unsigned int splitThreads = std::max<unsigned int>(1, WalkThreads / ins.size());
+
+  std::atomic<size_t> next(0);
+  std::vector<char> results(ins.size(), true);
+  std::vector<std::exception_ptr> errors(ins.size());
+  auto work = [&](size_t t) {
+    try {
+      for (size_t i = next++; i < FileSystems.size(); i = next++) {
+        FsWalk walk(ins[t]);
+        results[t] = walkFs(FileSystems[i], walk, splitThreads) && results[t];
+      }
+    }
+    catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < ins.size(); ++t) {
+    threads.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& t : threads) {
+    t.join();
+  }
 
+  bool ret = true;
+  for (size_t t = 0; t < ins.size(); ++t) {
+    if (errors[t]) {
+      std::rethrow_exception(errors[t]);
+    }
+    ret &= bool(results[t]);
+  }
+
+  if (ret) {
     // teardown
-    Input->flush();
+    for (auto& in : ins) {
+      in->flush();
+    }
+  }
+  return ret;
+}
+
+bool TskReader::walkFs(const FsLocation& loc, FsWalk& walk, unsigned int threads) {
+  walk.Claims.reset();
+
+  std::vector<std::shared_ptr<InputHandler>> forks;
+  for (unsigned int t = 1; t < threads; ++t) {
+    std::shared_ptr<InputHandler> in = walk.Input->fork();
+    if (!in) {
+      break;
+    }
+    forks.push_back(in);
+  }
+
+  const bool ret = forks.empty() ? Tsk->walkFs(
+    Img.get(), loc.Offset, loc.Type,
+    [&](TSK_FS_INFO* fs_info) {
+      startFs(fs_info, walk);
+      return TSK_FILTER_CONT;
+    },
+    [&](TSK_FS_FILE* fs_file, const char* /* path */) {
+      // std::cerr << "processFile " << path << "/" << fs_file->name->name << std::endl;
+      addToBatch(fs_file, walk);
+      return TSK_OK;
+    }
+  ) : walkSplit(loc, walk, forks);
+
+  if (ret) {
+    finishWalk(walk);
   }
   return ret;
 }
 
+namespace {
+  // whether TSK's recursive walk would descend into the entry; as in
+  // tsk_fs_dir_walk_recursive()
+  bool recursesInto(const TSK_FS_FILE& fs_file) {
+    return fs_file.name && fs_file.meta
+      && (TSK_FS_IS_DIR_NAME(fs_file.name->type) || fs_file.name->type == TSK_FS_NAME_TYPE_UNDEF)
+      && TSK_FS_IS_DIR_META(fs_file.meta->type)
+      && ((fs_file.name->flags & TSK_FS_NAME_FLAG_ALLOC)
+          || ((fs_file.name->flags & TSK_FS_NAME_FLAG_UNALLOC) && (fs_file.meta->flags & TSK_FS_META_FLAG_UNALLOC)))
+      && !TSK_FS_ISDOT(fs_file.name->name);
+  }
+}
+
+// A directory's subdirectories are walked by the thread listing it, as
+// TSK would, unless another thread is idle, when they're queued for it.
+// So large directories keep being split for as long as there are threads
+// to take their parts.
+struct TskReader::DirQueue {
+  struct Dir {
+    TSK_INUM_T Inum;
+    std::string Path;
+    std::vector<TSK_INUM_T> Ancestors;
+  };
+
+  // whether a thread is waiting for a directory
+  bool hungry() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Idle > Dirs.size();
+  }
+
+  void push(Dir&& dir) {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Dirs.push_back(std::move(dir));
+    }
+    Cv.notify_one();
+  }
+
+  // takes the next directory, or returns false once there are none and
+  // none can be queued, as no thread is walking
+  bool pop(Dir& dir) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    ++Idle;
+    Cv.wait(lock, [this]() { return !Dirs.empty() || !Busy; });
+    --Idle;
+    if (Dirs.empty()) {
+      return false;
+    }
+    dir = std::move(Dirs.front());
+    Dirs.pop_front();
+    ++Busy;
+    return true;
+  }
+
+  // called when done walking a directory taken by pop()
+  void done() {
+    bool finished;
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      finished = !--Busy && Dirs.empty();
+    }
+    if (finished) {
+      Cv.notify_all();
+    }
+  }
+
+  std::mutex Mutex;
+  std::condition_variable Cv;
+  std::deque<Dir> Dirs;
+  size_t Busy = 0;
+  size_t Idle = 0;
+};
+
+bool TskReader::walkSplit(const FsLocation& loc, FsWalk& walk, const std::vector<std::shared_ptr<InputHandler>>& forks) {
+  DirQueue queue;
+  {
+    TskHandlePool::Lease lease(Handles->checkout());
+    TSK_FS_INFO* fs = lease.fs(loc.Offset, loc.Type);
+    if (!fs) {
+      return false;
+    }
+    startFs(fs, walk);
+    queue.push(DirQueue::Dir{fs->root_inum, "", {}});
+  }
+
+  // every thread takes the next directory until there are none left, and
+  // reads the file system through a handle it borrows for the walk; the
+  // directories share the claims on inodes, as hard links may cross them
+  std::vector<std::shared_ptr<InputHandler>> ins(forks);
+  ins.push_back(walk.Input);
+  std::vector<char> results(ins.size(), true);
+  std::vector<std::exception_ptr> errors(ins.size());
+  auto work = [&](size_t t) {
+    TskHandlePool::Lease lease(Handles->checkout());
+    // one walk for every directory the thread takes
+    FsWalk sub(ins[t]);
+    sub.Claims = walk.Claims;
+    DirQueue::Dir dir;
+    while (queue.pop(dir)) {
+      try {
+        TSK_FS_INFO* fs = lease.fs(loc.Offset, loc.Type);
+        if (!fs) {
+          results[t] = false;
+        }
+        else {
+          if (!sub.Tsg) {
+            startFs(fs, sub);
+          }
+          sub.Dirents.reset(dir.Path);
+          // as in TSK's walk, only failing to list the root fails it
+          if (walkDir(fs, dir.Inum, dir.Ancestors, sub, queue) || !dir.Ancestors.empty()) {
+            finishWalk(sub);
+          }
+          else {
+            results[t] = false;
+          }
+        }
+      }
+      catch (...) {
+        errors[t] = std::current_exception();
+      }
+      queue.done();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < forks.size(); ++t) {
+    threads.emplace_back(work, t);
+  }
+  work(forks.size());
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  bool ret = true;
+  for (size_t t = 0; t < ins.size(); ++t) {
+    if (errors[t]) {
+      std::rethrow_exception(errors[t]);
+    }
+    ret &= bool(results[t]);
+  }
+  if (ret) {
+    for (auto& in : forks) {
+      in->flush();
+    }
+  }
+  return ret;
+}
+
+bool TskReader::walkDir(TSK_FS_INFO* fs, TSK_INUM_T inum, std::vector<TSK_INUM_T>& ancestors, FsWalk& walk, DirQueue& queue) {
+  ancestors.push_back(inum);
+  const bool ret = Tsk->listDir(fs, inum, [&](TSK_FS_FILE* fs_file) {
+    if (!addToBatch(fs_file, walk) || !recursesInto(*fs_file)) {
+      return;
+    }
+    const TSK_INUM_T sub = fs_file->meta->addr;
+    if (std::find(ancestors.begin(), ancestors.end(), sub) != ancestors.end()) {
+      // a loop, which TSK doesn't follow either
+      return;
+    }
+    if (queue.hungry()) {
+      queue.push(DirQueue::Dir{sub, walk.Dirents.top().Path, ancestors});
+    }
+    else {
+      // subdirectories which can't be listed are skipped, as by TSK
+      walkDir(fs, sub, ancestors, walk, queue);
+    }
+  });
+  ancestors.pop_back();
+  return ret;
+}
+
+void TskReader::finishWalk(FsWalk& walk) {
+  while (!walk.Dirents.empty()) {
+    walk.Input->push(walk.Dirents.pop());
+  }
+}
+
 TSK_FILTER_ENUM TskReader::filterVs(const TSK_VS_INFO* vs_info) {
   Asm.addVolumeSystem(Tsk->convertVS(*vs_info));
   return TSK_FILTER_CONT;
@@ -68,23 +364,21 @@ TSK_FILTER_ENUM TskReader::filterVol(const TSK_VS_PART_INFO* vs_part) {
 
 TSK_FILTER_ENUM TskReader::filterFs(TSK_FS_INFO* fs_info) {
   Asm.addFileSystem(Tsk->convertFS(*fs_info));
-  Tsg = Tsk->makeTimestampGetter(fs_info->ftype);
-//  Tracker->setInodeRange(fs_info->first_inum, fs_info->last_inum + 1);
-//  Tracker->setBlockRange(fs_info->first_block * fs_info->block_size, (fs_info->last_block + 1) * fs_info->block_size);
-  CurFsOffset = fs_info->offset;
-  CurFsBlockSize = fs_info->block_size;
-  InodeTracker.clear();
-  InodeTracker.resize(fs_info->last_inum - fs_info->first_inum, false);
-  return TSK_FILTER_CONT;
+  FileSystems.push_back(FsLocation{fs_info->offset, fs_info->ftype});
+  // walked later, by walkFs()
+  return TSK_FILTER_SKIP;
 }
 
-TSK_RETVAL_ENUM TskReader::processFile(TSK_FS_FILE* fs_file, const char* /* path */) {
-  // std::cerr << "processFile " << path << "/" << fs_file->name->name << std::endl;
-  addToBatch(fs_file);
-  return TSK_OK;
+void TskReader::startFs(TSK_FS_INFO* fs_info, FsWalk& walk) {
+  walk.Tsg = Tsk->makeTimestampGetter(fs_info->ftype);
+//  Tracker->setInodeRange(fs_info->first_inum, fs_info->last_inum + 1);
+//  Tracker->setBlockRange(fs_info->first_block * fs_info->block_size, (fs_info->last_block + 1) * fs_info->block_size);
+  if (!walk.Claims) {
+    walk.Claims = std::make_shared<InodeClaims>(fs_info->first_inum, fs_info->last_inum + 1);
+  }
 }
 
-bool TskReader::addToBatch(TSK_FS_FILE* fs_file) {
+bool TskReader::addToBatch(TSK_FS_FILE* fs_file, FsWalk& walk) {
   if (!fs_file || !fs_file->meta) {
     // TODO: Can we have a nonull fs_file->name in this case?
     // nothing to process
@@ -93,9 +387,9 @@ bool TskReader::addToBatch(TSK_FS_FILE* fs_file) {
     return false;
   }
   const TSK_FS_META& meta = *fs_file->meta;
-  if (!InodeTracker[meta.addr - fs_file->fs_info->first_inum]) {
+  if (walk.Claims->claim(meta.addr)) {
     Inode inode;
-    TskUtils::convertMetaToInode(meta, *Tsg, inode);
+    TskUtils::convertMetaToInode(meta, *walk.Tsg, inode);
 
     // handle the attrs
     Tsk->populateAttrs(fs_file);
@@ -106,24 +400,30 @@ bool TskReader::addToBatch(TSK_FS_FILE* fs_file) {
     // why on earth are we making this separate block sequence thing? it's goofy -- jls
     //Input->push({std::move(jmeta), makeBlockSequence(fs_file)});
 
-    Input->push(inode);
-    Input->push(makeReadSeek(fs_file));
-    InodeTracker[meta.addr - fs_file->fs_info->first_inum] = true;
+    walk.Input->push(inode);
+    auto stream = makeReadSeek(fs_file);
+    stream->setIdentity(FileIdentity{
+      uint64_t(fs_file->fs_info->offset), meta.addr, meta.seq, uint64_t(meta.size), inode.Modified
+    });
+    if (const auto off = Tsk->firstDataOffset(fs_file)) {
+      stream->setDiskOffset(*off);
+    }
+    walk.Input->push(std::move(stream));
   }
   // handle the name
   if (fs_file->name) {
     const TSK_INUM_T parentAddr =  fs_file->name->par_addr;
     Dirent dirent;
 
-    if (!Dirents.empty() && parentAddr != Dirents.top().MetaAddr) {
+    if (!walk.Dirents.empty() && parentAddr != walk.Dirents.top().MetaAddr) {
       do {
-        Input->push(Dirents.pop());
-      } while (!Dirents.empty() && parentAddr != Dirents.top().MetaAddr);
-      Input->maybeFlush();
+        walk.Input->push(walk.Dirents.pop());
+      } while (!walk.Dirents.empty() && parentAddr != walk.Dirents.top().MetaAddr);
+      walk.Input->maybeFlush();
     }
     // std::cerr << par_addr << " -> " << fs_file->meta->addr << '\n';
     TskUtils::convertNameToDirent("", *fs_file->name, dirent);
-    Dirents.push(std::move(dirent));
+    walk.Dirents.push(std::move(dirent));
   }
 
   return true;
@@ -133,6 +433,7 @@ std::shared_ptr<BlockSequence> TskReader::makeBlockSequence(TSK_FS_FILE* fs_file
   TSK_FS_INFO* their_fs = fs_file->fs_info;
 
   // open our own copy of the fs, since TskAuto closes the ones it opens
+  std::lock_guard<std::mutex> lock(FsMutex);
   auto [itr, absent] = Fs.try_emplace(their_fs->offset, nullptr);
   if (absent) {
     itr->second.reset(Tsk->openFS(Img.get(), their_fs->offset, their_fs->ftype).release(), tsk_fs_close);
@@ -148,16 +449,10 @@ std::shared_ptr<BlockSequence> TskReader::makeBlockSequence(TSK_FS_FILE* fs_file
 }
 
 std::unique_ptr<ReadSeek> TskReader::makeReadSeek(TSK_FS_FILE* fs_file) {
-  TSK_FS_INFO* their_fs = fs_file->fs_info;
-
-  // open our own copy of the fs, since TskAuto closes the ones it opens
-  auto [itr, absent] = Fs.try_emplace(their_fs->offset, nullptr);
-  if (absent) {
-    itr->second.reset(Tsk->openFS(Img.get(), their_fs->offset, their_fs->ftype).release(), tsk_fs_close);
-  }
+  // each file has a shared_ptr to the pool, so it can be opened on demand,
+  // on whichever thread reads it
   return std::make_unique<ReadSeekTSK>(
-    // each file has a shared_ptr to its fs, so it can be opened on demand
-    itr->second, fs_file->meta->addr
+    Handles, fs_file->fs_info->offset, fs_file->fs_info->ftype, fs_file->meta->addr
   );
 }
 
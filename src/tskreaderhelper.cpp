@@ -1,6 +1,17 @@
 #include "tskreaderhelper.h"
 
 namespace TskReaderHelper {
+  std::optional<uint64_t> firstDataOffset(const TSK_FS_ATTR& attr, uint64_t fsOffset, uint64_t blockSize) {
+    if (attr.flags & TSK_FS_ATTR_NONRES) {
+      for (const TSK_FS_ATTR_RUN* run = attr.nrd.run; run; run = run->next) {
+        if (!(run->flags & (TSK_FS_ATTR_RUN_FLAG_FILLER | TSK_FS_ATTR_RUN_FLAG_SPARSE))) {
+          return fsOffset + run->addr * blockSize;
+        }
+      }
+    }
+    return std::nullopt;
+  }
+
 /*  void handleRuns(
     const TSK_FS_ATTR& a,
     uint64_t fsOffset,
@@ -0,0 +1,108 @@
+#include <catch2/benchmark/catch_benchmark_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "blockcache.h"
+#include "llama.h"
+#include "metrics.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+  // stands in for decompressing an E01 chunk, which costs about this
+  // much per byte
+  int64_t slowFill(uint64_t off, uint8_t* buf, size_t len) {
+    uint32_t x = uint32_t(off);
+    for (size_t i = 0; i < len; ++i) {
+      for (int r = 0; r < 8; ++r) {
+        x = x * 1664525 + 1013904223;
+      }
+      buf[i] = uint8_t(x >> 24);
+    }
+    return len;
+  }
+
+  // threads reading neighboring 4 KiB pieces, as processors reading
+  // neighboring files do
+  uint64_t readNeighbors(BlockCache* cache, size_t numThreads) {
+    const size_t piece = 4096;
+    const uint64_t span = uint64_t(64) << 20;
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> sums(numThreads, 0);
+    for (size_t t = 0; t < numThreads; ++t) {
+      threads.emplace_back([&, t]() {
+        std::vector<uint8_t> buf(piece);
+        for (uint64_t off = t * piece; off < span; off += numThreads * piece) {
+          if (cache) {
+            cache->read(off, buf.data(), piece, slowFill);
+          }
+          else {
+            // every read decompresses the whole block it's in
+            std::vector<uint8_t> block(BlockCache::DEFAULT_BLOCK_SIZE);
+            const uint64_t base = off / block.size() * block.size();
+            slowFill(base, block.data(), block.size());
+            std::copy_n(block.begin() + (off - base), piece, buf.begin());
+          }
+          sums[t] += buf[0];
+        }
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+    uint64_t ret = 0;
+    for (uint64_t s : sums) {
+      ret += s;
+    }
+    return ret;
+  }
+
+  int hashImage(const std::string& image, const char* cacheSize) {
+    const fs::path out = fs::temp_directory_path() / "llama_bench_imagecache";
+    fs::remove_all(out);
+    const std::string outStr = out.string();
+    std::vector<const char*> args{
+      "llama", "--progress-interval", "0", "--hashes", "md5", "--image-cache", cacheSize, outStr.c_str(), image.c_str()
+    };
+    return Llama().run(args.size(), args.data());
+  }
+}
+
+TEST_CASE("BlockCacheBenchmark") {
+  BENCHMARK("4 threads, neighboring reads, no cache") {
+    return readNeighbors(nullptr, 4);
+  };
+
+  BENCHMARK("4 threads, neighboring reads, cached") {
+    BlockCache cache(uint64_t(256) << 20);
+    return readNeighbors(&cache, 4);
+  };
+}
+
+TEST_CASE("ImageCacheBenchmark") {
+  // needs a compressed image, e.g., an E01
+  const char* image = std::getenv("LLAMA_BENCH_IMAGE");
+  if (!image) {
+    WARN("Set LLAMA_BENCH_IMAGE to a compressed image to compare runs with and without the image cache");
+    return;
+  }
+
+  for (const char* size : {"0", "256M", "2G"}) {
+    const Metrics::Snapshot before = Metrics::global().snapshot();
+    BENCHMARK(std::string("hash image, --image-cache ") + size) {
+      return hashImage(image, size);
+    };
+    const Metrics::Snapshot run = Metrics::global().snapshot().since(before);
+    const uint64_t hits = run.Counters[Metrics::IMAGE_CACHE_HITS];
+    const uint64_t misses = run.Counters[Metrics::IMAGE_CACHE_MISSES];
+    std::cerr << "--image-cache " << size << ": " << hits << " hits, "
+              << misses << " blocks decompressed, hit rate "
+              << (hits + misses ? 100.0 * hits / (hits + misses) : 0.0) << "%\n";
+  }
+}
@@ -0,0 +1,44 @@
+#include <catch2/benchmark/catch_benchmark_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "llama.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+  int hashImage(const std::string& image, bool diskOrder) {
+    const fs::path out = fs::temp_directory_path() / "llama_bench_diskorder";
+    fs::remove_all(out);
+    std::vector<const char*> args{"llama", "--progress-interval", "0", "--hashes", "md5"};
+    if (diskOrder) {
+      args.push_back("--disk-order");
+    }
+    const std::string outStr = out.string();
+    args.push_back(outStr.c_str());
+    args.push_back(image.c_str());
+    return Llama().run(args.size(), args.data());
+  }
+}
+
+TEST_CASE("DiskOrderBenchmark") {
+  // needs a large image, ideally an E01 on a spinning disk, with a cold
+  // cache before each run
+  const char* image = std::getenv("LLAMA_BENCH_IMAGE");
+  if (!image) {
+    WARN("Set LLAMA_BENCH_IMAGE to an image to compare walk order with disk order");
+    return;
+  }
+
+  BENCHMARK("hash image, largest files first") {
+    return hashImage(image, false);
+  };
+
+  BENCHMARK("hash image, disk order") {
+    return hashImage(image, true);
+  };
+}
@@ -0,0 +1,105 @@
+#include <catch2/benchmark/catch_benchmark_all.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "knownhashset.h"
+#include "llamabatch.h"
+#include "processor.h"
+#include "readseek_impl.h"
+
+#include <lightgrep/api.h>
+
+#include <filesystem>
+#include <random>
+
+namespace {
+  std::vector<uint8_t> randomBytes(size_t n, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> ret(n);
+    for (auto& b : ret) {
+      b = byte(gen);
+    }
+    return ret;
+  }
+
+  std::shared_ptr<ProgramHandle> makeProgram(const std::vector<std::string>& patterns) {
+    std::shared_ptr<FSMHandle> fsm(lg_create_fsm(0, 0), lg_destroy_fsm);
+    std::shared_ptr<PatternHandle> pat(lg_create_pattern(), lg_destroy_pattern);
+    LG_KeyOptions opts{0, 0, 0};
+    LG_Error* err(nullptr);
+    for (const std::string& p : patterns) {
+      lg_parse_pattern(pat.get(), p.c_str(), &opts, &err);
+      lg_add_pattern(fsm.get(), pat.get(), "ASCII", 0, &err);
+    }
+    LG_ProgramOptions pOpts{10};
+    return std::shared_ptr<ProgramHandle>(lg_create_program(fsm.get(), &pOpts), lg_destroy_program);
+  }
+}
+
+TEST_CASE("KnownHashSetBenchmark") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_bench_known.lkh";
+  const size_t n = 1000000;
+  KnownHashSet::write(path.string(), SFHASH_SHA_1, randomBytes(n * 20, 1));
+  const auto misses = randomBytes(n * 20, 2);
+
+  BENCHMARK("load 1M digests") {
+    return KnownHashSet(path.string()).size();
+  };
+
+  KnownHashSet known(path.string());
+  BENCHMARK("1M lookups, all misses") {
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+      found += known.contains(misses.data() + i * 20);
+    }
+    return found;
+  };
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("KnownFileFilterBenchmark") {
+  // files big enough to skip small-file coalescing, all of them known
+  const size_t numFiles = 200;
+  std::vector<std::unique_ptr<ReadSeekBuf>> files;
+  std::vector<uint8_t> digests;
+  std::shared_ptr<SFHASH_Hasher> hasher(sfhash_create_hasher(SFHASH_SHA_1), sfhash_destroy_hasher);
+  for (size_t i = 0; i < numFiles; ++i) {
+    const auto data = randomBytes(256 << 10, i);
+    sfhash_reset_hasher(hasher.get());
+    sfhash_update_hasher(hasher.get(), data.data(), data.data() + data.size());
+    SFHASH_HashValues h;
+    sfhash_get_hashes(hasher.get(), &h);
+    digests.insert(digests.end(), std::begin(h.Sha1), std::end(h.Sha1));
+    files.push_back(std::make_unique<ReadSeekBuf>(data));
+  }
+  const auto path = std::filesystem::temp_directory_path() / "llama_bench_known_files.lkh";
+  KnownHashSet::write(path.string(), SFHASH_SHA_1, digests);
+  auto known = std::make_shared<const KnownHashSet>(path.string());
+
+  const std::vector<std::string> patterns{"foo", "bar[0-9]+", "[a-z]{6,}@[a-z]+\\.com"};
+  auto prog = makeProgram(patterns);
+
+  LlamaDB db;
+  LlamaDBConnection conn(db);
+  DBType<SearchHit>::createTable(conn.get(), "search_hits");
+  DBType<HashRec>::createTable(conn.get(), "hash");
+  DBType<SearchHitOverflow>::createTable(conn.get(), "search_hits_overflow");
+
+  Processor searchAll(&db, prog, SFHASH_SHA_1);
+  Processor skipKnown(&db, prog, SFHASH_SHA_1, nullptr, known);
+
+  BENCHMARK("search everything") {
+    for (auto& f : files) {
+      searchAll.process(*f);
+    }
+    searchAll.flush();
+  };
+
+  BENCHMARK("skip known files") {
+    for (auto& f : files) {
+      skipKnown.process(*f);
+    }
+    skipKnown.flush();
+  };
+  std::filesystem::remove(path);
+}
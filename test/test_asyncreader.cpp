@@ -0,0 +1,57 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "asyncreader.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+  std::vector<uint8_t> makeData(size_t n) {
+    std::vector<uint8_t> data(n);
+    for (size_t i = 0; i < n; ++i) {
+      data[i] = i % 251;
+    }
+    return data;
+  }
+
+  std::shared_ptr<FILE> makeTmpFile(const std::vector<uint8_t>& data) {
+    std::shared_ptr<FILE> f(std::tmpfile(), std::fclose);
+    std::fwrite(data.data(), 1, data.size(), f.get());
+    std::fflush(f.get());
+    return f;
+  }
+
+  void basicAsyncReaderTest(AsyncReader& reader) {
+    const auto data = makeData(10000);
+    auto f = makeTmpFile(data);
+    const int fd = fileno(f.get());
+
+    std::vector<uint8_t> a(4000), b(4000), c(4000);
+    const uint64_t ta = reader.submit(fd, 0, a.data(), a.size());
+    const uint64_t tb = reader.submit(fd, 4000, b.data(), b.size());
+    const uint64_t tc = reader.submit(fd, 8000, c.data(), c.size());
+
+    // wait out of order
+    REQUIRE(reader.wait(tc) == 2000);
+    REQUIRE(reader.wait(ta) == 4000);
+    REQUIRE(reader.wait(tb) == 4000);
+
+    REQUIRE(std::equal(a.begin(), a.end(), data.begin()));
+    REQUIRE(std::equal(b.begin(), b.end(), data.begin() + 4000));
+    REQUIRE(std::equal(c.begin(), c.begin() + 2000, data.begin() + 8000));
+
+    REQUIRE(reader.wait(tc) == -1); // already collected
+  }
+}
+
+TEST_CASE("testThreadPoolAsyncReader") {
+  auto reader = AsyncReader::createThreadPool(4);
+  REQUIRE(std::string("threadpool") == reader->name());
+  basicAsyncReaderTest(*reader);
+}
+
+TEST_CASE("testBestAsyncReader") {
+  // io_uring if it's there and permitted, else the thread pool
+  auto reader = AsyncReader::create(4);
+  basicAsyncReaderTest(*reader);
+}
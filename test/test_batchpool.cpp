@@ -0,0 +1,43 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "batchpool.h"
+#include "direntbatch.h"
+
+TEST_CASE("testBatchPoolRecycles") {
+  BatchPool<DirentBatch> pool(2);
+  REQUIRE(0u == pool.kept());
+
+  auto batch = pool.take();
+  REQUIRE(batch);
+  REQUIRE(0u == batch->size());
+
+  batch->add(Dirent{"a", "b", "c", "d", "e", "f", 1, 2, 3, 4});
+  batch->add(Dirent{"g", "h", "i", "j", "k", "l", 5, 6, 7, 8});
+  REQUIRE(2u == batch->size());
+  const DirentBatch* orig = batch.get();
+  const size_t capacity = batch->Buf.capacity();
+
+  pool.give(std::move(batch));
+  REQUIRE(1u == pool.kept());
+
+  // the same batch comes back empty, with its buffers still allocated
+  auto again = pool.take();
+  REQUIRE(orig == again.get());
+  REQUIRE(0u == again->size());
+  REQUIRE(again->Buf.empty());
+  REQUIRE(again->OffsetVals.empty());
+  REQUIRE(capacity == again->Buf.capacity());
+  REQUIRE(0u == pool.kept());
+}
+
+TEST_CASE("testBatchPoolKeepsAtMostMax") {
+  BatchPool<DirentBatch> pool(2);
+  auto a = pool.take();
+  auto b = pool.take();
+  auto c = pool.take();
+  REQUIRE(a != b);
+  pool.give(std::move(a));
+  pool.give(std::move(b));
+  pool.give(std::move(c));
+  REQUIRE(2u == pool.kept());
+}
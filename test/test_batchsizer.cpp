@@ -0,0 +1,58 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "batchsizer.h"
+
+TEST_CASE("testBatchSizerInitialLimits") {
+  BatchSizer sizer;
+  REQUIRE(BatchSizer::INITIAL_FILES == sizer.maxFiles());
+  REQUIRE(BatchSizer::INITIAL_BYTES == sizer.maxBytes());
+
+  REQUIRE(!sizer.full(0, BatchSizer::INITIAL_FILES - 1));
+  REQUIRE(sizer.full(0, BatchSizer::INITIAL_FILES));
+  REQUIRE(sizer.full(BatchSizer::INITIAL_BYTES, 1));
+  REQUIRE(!sizer.overfull(BatchSizer::INITIAL_BYTES, 1));
+  REQUIRE(sizer.overfull(2 * BatchSizer::INITIAL_BYTES, 1));
+  REQUIRE(sizer.overfull(0, 2 * BatchSizer::INITIAL_FILES));
+}
+
+TEST_CASE("testBatchSizerFollowsThroughput") {
+  BatchSizer sizer(2.0);
+  sizer.observe(0, 0, 0.0);
+  // 100 MiB/s and 1000 files/s
+  sizer.observe(uint64_t(100) << 20, 1000, 1.0);
+  REQUIRE((uint64_t(200) << 20) == sizer.maxBytes());
+  REQUIRE(2000u == sizer.maxFiles());
+
+  // a faster sample moves the estimate partway
+  sizer.observe((uint64_t(100) << 20) + (uint64_t(200) << 20), 1000 + 2000, 2.0);
+  REQUIRE(sizer.maxBytes() > (uint64_t(200) << 20));
+  REQUIRE(sizer.maxBytes() < (uint64_t(400) << 20));
+  REQUIRE(sizer.maxFiles() > 2000u);
+  REQUIRE(sizer.maxFiles() < 4000u);
+}
+
+TEST_CASE("testBatchSizerClamps") {
+  BatchSizer sizer(1.0);
+  sizer.observe(0, 0, 0.0);
+  sizer.observe(1, 1, 10.0);
+  REQUIRE(BatchSizer::MIN_BYTES == sizer.maxBytes());
+  REQUIRE(BatchSizer::MIN_FILES == sizer.maxFiles());
+
+  BatchSizer fast(1.0);
+  fast.observe(0, 0, 0.0);
+  fast.observe(uint64_t(1) << 40, 10000000, 1.0);
+  REQUIRE(BatchSizer::MAX_BYTES == fast.maxBytes());
+  REQUIRE(BatchSizer::MAX_FILES == fast.maxFiles());
+}
+
+TEST_CASE("testBatchSizerIgnoresIdleAndShortSamples") {
+  BatchSizer sizer;
+  sizer.observe(0, 0, 0.0);
+  // nothing done yet
+  sizer.observe(0, 0, 5.0);
+  REQUIRE(BatchSizer::INITIAL_FILES == sizer.maxFiles());
+  // too soon after the last sample to tell
+  sizer.observe(1, 1, 0.01);
+  REQUIRE(BatchSizer::INITIAL_FILES == sizer.maxFiles());
+  REQUIRE(BatchSizer::INITIAL_BYTES == sizer.maxBytes());
+}
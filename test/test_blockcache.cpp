@@ -0,0 +1,119 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "blockcache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+  std::vector<uint8_t> pattern(size_t n) {
+    std::vector<uint8_t> ret(n);
+    for (size_t i = 0; i < n; ++i) {
+      ret[i] = uint8_t(i * 7 + i / 253);
+    }
+    return ret;
+  }
+
+  // an image in memory, counting the reads of it
+  struct FakeImage {
+    FakeImage(size_t size): Data(pattern(size)), Reads(0) {}
+
+    BlockCache::Fill fill() {
+      return [this](uint64_t off, uint8_t* buf, size_t len) -> int64_t {
+        ++Reads;
+        if (off >= Data.size()) {
+          return 0;
+        }
+        const size_t n = std::min<uint64_t>(len, Data.size() - off);
+        std::copy(Data.begin() + off, Data.begin() + off + n, buf);
+        return n;
+      };
+    }
+
+    std::vector<uint8_t> Data;
+    std::atomic<size_t> Reads;
+  };
+}
+
+TEST_CASE("testBlockCacheReadsThrough") {
+  FakeImage img(10000);
+  BlockCache cache(1 << 20, 1024);
+  REQUIRE(1024u == cache.blockSize());
+
+  // spans three blocks
+  std::vector<uint8_t> buf(2000);
+  REQUIRE(2000 == cache.read(1000, buf.data(), buf.size(), img.fill()));
+  REQUIRE(std::equal(buf.begin(), buf.end(), img.Data.begin() + 1000));
+  REQUIRE(3u == img.Reads);
+  REQUIRE(3u == cache.stats().Misses);
+  REQUIRE(0u == cache.stats().Hits);
+
+  // the same blocks again, from the cache
+  REQUIRE(100 == cache.read(2048, buf.data(), 100, img.fill()));
+  REQUIRE(std::equal(buf.begin(), buf.begin() + 100, img.Data.begin() + 2048));
+  REQUIRE(3u == img.Reads);
+  REQUIRE(1u == cache.stats().Hits);
+}
+
+TEST_CASE("testBlockCacheEndOfImage") {
+  FakeImage img(3000);
+  BlockCache cache(1 << 20, 1024);
+  std::vector<uint8_t> buf(1000);
+  REQUIRE(200 == cache.read(2800, buf.data(), buf.size(), img.fill()));
+  REQUIRE(std::equal(buf.begin(), buf.begin() + 200, img.Data.begin() + 2800));
+  REQUIRE(0 == cache.read(3000, buf.data(), buf.size(), img.fill()));
+}
+
+TEST_CASE("testBlockCacheFillFails") {
+  BlockCache cache(1 << 20, 1024);
+  std::vector<uint8_t> buf(100);
+  auto fail = [](uint64_t, uint8_t*, size_t) -> int64_t { return -1; };
+  REQUIRE(-1 == cache.read(0, buf.data(), buf.size(), fail));
+  // failures aren't cached
+  FakeImage img(3000);
+  REQUIRE(100 == cache.read(0, buf.data(), buf.size(), img.fill()));
+}
+
+TEST_CASE("testBlockCacheEvictsLeastRecent") {
+  FakeImage img(1 << 20);
+  // one block per shard
+  BlockCache cache(BlockCache::NUM_SHARDS * 1024, 1024);
+  std::vector<uint8_t> buf(10);
+  const uint64_t a = 0, b = BlockCache::NUM_SHARDS * 1024; // same shard
+  cache.read(a, buf.data(), buf.size(), img.fill());
+  cache.read(b, buf.data(), buf.size(), img.fill());
+  REQUIRE(1u == cache.stats().Evictions);
+  REQUIRE(2u == img.Reads);
+
+  cache.read(b, buf.data(), buf.size(), img.fill());
+  REQUIRE(2u == img.Reads);
+  cache.read(a, buf.data(), buf.size(), img.fill());
+  REQUIRE(3u == img.Reads);
+}
+
+TEST_CASE("testBlockCacheConcurrent") {
+  FakeImage img(256 * 1024);
+  BlockCache cache(1 << 20, 4096);
+  std::atomic<bool> ok(true);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<uint8_t> buf(5000);
+      for (uint64_t i = 0; i < 200; ++i) {
+        const uint64_t off = (i * 7919 + t * 104729) % (img.Data.size() - buf.size());
+        if (cache.read(off, buf.data(), buf.size(), img.fill()) != int64_t(buf.size()) ||
+            !std::equal(buf.begin(), buf.end(), img.Data.begin() + off)) {
+          ok = false;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  REQUIRE(ok);
+  // everything fits, so each block was read about once
+  REQUIRE(cache.stats().Misses <= 64 + 4 * 2);
+}
@@ -6,6 +6,8 @@
 #include <sstream>
 #include <thread>
 
+#include <hasher/common.h>
+
 TEST_CASE("testCLIVersion") {
   const char* args[] = {"llama", "--version"};
   Cli cli;
@@ -171,6 +173,178 @@ TEST_CASE("testCLICodec") {
   CHECK(Codec::LZ4 == opts->OutputCodec);
 }
 
+TEST_CASE("testCLIIoQueueDepth") {
+  const char* args[] = {"llama", "--io-queue-depth", "16", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  auto opts = cli.parse(5, args);
+  REQUIRE(16u == opts->IoQueueDepth);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  opts = cli.parse(3, defaultArgs);
+  REQUIRE(0u == opts->IoQueueDepth);
+}
+
+TEST_CASE("testCLIHashes") {
+  const char* args[] = {"llama", "--hashes", "md5,blake3", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  auto opts = cli.parse(5, args);
+  REQUIRE((SFHASH_MD5 | SFHASH_BLAKE3) == opts->HashAlgs);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  opts = cli.parse(3, defaultArgs);
+  REQUIRE((SFHASH_MD5 | SFHASH_SHA_1 | SFHASH_SHA_2_256 | SFHASH_BLAKE3 | SFHASH_FUZZY) == opts->HashAlgs);
+
+  const char* badArgs[] = {"llama", "--hashes", "md5,crc32", "output", "nosnits_workstation.E01"};
+  REQUIRE_THROWS_AS(cli.parse(5, badArgs), std::invalid_argument);
+}
+
+TEST_CASE("testCLIBuildKnownHashes") {
+  const char* args[] = {"llama", "--build-known-hashes", "sha1", "nsrl.lkh", "nsrl_sha1.txt"};
+  Cli cli;
+  auto opts = cli.parse(5, args);
+  REQUIRE("build-known-hashes" == opts->Command);
+  REQUIRE(SFHASH_SHA_1 == opts->KnownHashesAlg);
+  REQUIRE("nsrl.lkh" == opts->Output);
+  REQUIRE("nsrl_sha1.txt" == opts->Input);
+
+  const char* fuzzyArgs[] = {"llama", "--build-known-hashes", "fuzzy", "nsrl.lkh", "nsrl_sha1.txt"};
+  REQUIRE_THROWS_AS(cli.parse(5, fuzzyArgs), std::invalid_argument);
+}
+
+TEST_CASE("testCLIKnownHashesMustExist") {
+  const char* args[] = {"llama", "--known-hashes", "no_such_set.lkh", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE_THROWS(cli.parse(5, args));
+}
+
+TEST_CASE("testCLIScanCache") {
+  const char* args[] = {"llama", "--scan-cache", "cache.db", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  auto opts = cli.parse(5, args);
+  REQUIRE(opts->ScanCache == "cache.db");
+}
+
+TEST_CASE("testCLIAllHits") {
+  const char* args[] = {"llama", "--all-hits", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE(cli.parse(4, args)->AllHits);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(!defaultCli.parse(3, defaultArgs)->AllHits);
+}
+
+TEST_CASE("testCLIHitLimits") {
+  const char* args[] = {"llama", "--max-hits-per-pattern", "100", "--max-hits-per-file", "1000", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  auto opts = cli.parse(7, args);
+  REQUIRE(100u == opts->MaxHitsPerPattern);
+  REQUIRE(1000u == opts->MaxHitsPerFile);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  opts = defaultCli.parse(3, defaultArgs);
+  REQUIRE(0u == opts->MaxHitsPerPattern);
+  REQUIRE(0u == opts->MaxHitsPerFile);
+}
+
+TEST_CASE("testCLIProgressInterval") {
+  const char* args[] = {"llama", "--progress-interval", "0", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE(0u == cli.parse(5, args)->ProgressInterval);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(10u == defaultCli.parse(3, defaultArgs)->ProgressInterval);
+}
+
+TEST_CASE("testCLIDiskOrder") {
+  const char* args[] = {"llama", "--disk-order", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE(cli.parse(4, args)->DiskOrder);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(!defaultCli.parse(3, defaultArgs)->DiskOrder);
+}
+
+TEST_CASE("testCLIIoThreads") {
+  const char* args[] = {"llama", "--io-threads", "4", "-j", "8", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  auto opts = cli.parse(7, args);
+  REQUIRE(4u == opts->IoThreads);
+  REQUIRE(8u == opts->NumThreads);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(0u == defaultCli.parse(3, defaultArgs)->IoThreads);
+}
+
+TEST_CASE("testCLIWalkThreads") {
+  const char* args[] = {"llama", "--walk-threads", "4", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE(4u == cli.parse(5, args)->WalkThreads);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(1u == defaultCli.parse(3, defaultArgs)->WalkThreads);
+}
+
+TEST_CASE("testCLIImageCache") {
+  const char* args[] = {"llama", "--image-cache", "1G", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE((uint64_t(1) << 30) == cli.parse(5, args)->ImageCacheSize);
+
+  const char* offArgs[] = {"llama", "--image-cache", "0", "output", "nosnits_workstation.E01"};
+  Cli offCli;
+  REQUIRE(0u == offCli.parse(5, offArgs)->ImageCacheSize);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE((uint64_t(256) << 20) == defaultCli.parse(3, defaultArgs)->ImageCacheSize);
+
+  const char* badArgs[] = {"llama", "--image-cache", "big", "output", "nosnits_workstation.E01"};
+  Cli badCli;
+  REQUIRE_THROWS_AS(badCli.parse(5, badArgs), std::invalid_argument);
+
+  // the default leaves most of a memory limit to the pipeline
+  const char* limitedArgs[] = {"llama", "--memory-limit", "200M", "output", "nosnits_workstation.E01"};
+  Cli limitedCli;
+  REQUIRE((uint64_t(50) << 20) == limitedCli.parse(5, limitedArgs)->ImageCacheSize);
+
+  const char* roomyArgs[] = {"llama", "--memory-limit", "8G", "output", "nosnits_workstation.E01"};
+  Cli roomyCli;
+  REQUIRE((uint64_t(256) << 20) == roomyCli.parse(5, roomyArgs)->ImageCacheSize);
+
+  const char* explicitArgs[] = {"llama", "--memory-limit", "200M", "--image-cache", "100M", "output", "nosnits_workstation.E01"};
+  Cli explicitCli;
+  REQUIRE((uint64_t(100) << 20) == explicitCli.parse(7, explicitArgs)->ImageCacheSize);
+}
+
+TEST_CASE("testCLIMemoryLimit") {
+  const char* args[] = {"llama", "--memory-limit", "8G", "output", "nosnits_workstation.E01"};
+  Cli cli;
+  REQUIRE((uint64_t(8) << 30) == cli.parse(5, args)->MemoryLimit);
+
+  const char* byteArgs[] = {"llama", "--memory-limit", "1000000", "output", "nosnits_workstation.E01"};
+  Cli byteCli;
+  REQUIRE(1000000u == byteCli.parse(5, byteArgs)->MemoryLimit);
+
+  const char* lowerArgs[] = {"llama", "--memory-limit", "512m", "output", "nosnits_workstation.E01"};
+  Cli lowerCli;
+  REQUIRE((uint64_t(512) << 20) == lowerCli.parse(5, lowerArgs)->MemoryLimit);
+
+  const char* defaultArgs[] = {"llama", "output", "nosnits_workstation.E01"};
+  Cli defaultCli;
+  REQUIRE(0u == defaultCli.parse(3, defaultArgs)->MemoryLimit);
+
+  for (const char* bad : {"lots", "8X", "8GB", "-1", "99999999999T"}) {
+    const char* badArgs[] = {"llama", "--memory-limit", bad, "output", "nosnits_workstation.E01"};
+    Cli badCli;
+    REQUIRE_THROWS_AS(badCli.parse(5, badArgs), std::invalid_argument);
+  }
+}
+
 TEST_CASE("testPrintVersion") {
   Cli cli;
   std::stringstream output;
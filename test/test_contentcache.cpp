@@ -0,0 +1,58 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "contentcache.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+  ContentCache::Digest digestOf(uint8_t b) {
+    ContentCache::Digest d;
+    d.fill(b);
+    return d;
+  }
+}
+
+TEST_CASE("contentCacheInsertOnce") {
+  ContentCache cache;
+  REQUIRE(!cache.contains(digestOf(1)));
+  REQUIRE(cache.insert(digestOf(1)));
+  REQUIRE(cache.contains(digestOf(1)));
+  REQUIRE(!cache.insert(digestOf(1)));
+  REQUIRE(cache.insert(digestOf(2)));
+  REQUIRE(cache.size() == 2);
+}
+
+TEST_CASE("contentCacheFingerprints") {
+  const std::vector<uint8_t> prefix{'M', 'Z', 0x90, 0};
+  const uint64_t fp = ContentCache::fingerprint(4096, prefix.data(), prefix.size());
+  REQUIRE(fp != ContentCache::fingerprint(4097, prefix.data(), prefix.size()));
+  REQUIRE(fp != ContentCache::fingerprint(4096, prefix.data(), prefix.size() - 1));
+
+  ContentCache cache;
+  REQUIRE(!cache.hasFingerprint(fp));
+  cache.addFingerprint(fp);
+  REQUIRE(cache.hasFingerprint(fp));
+  REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("contentCacheOneWinnerPerDigest") {
+  ContentCache cache;
+  std::atomic<unsigned> wins(0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      for (unsigned i = 0; i < 256; ++i) {
+        if (cache.insert(digestOf(i))) {
+          ++wins;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  REQUIRE(wins == 256);
+  REQUIRE(cache.size() == 256);
+}
@@ -97,3 +97,38 @@ TEST_CASE("testDirentStackPushPushPopPop") {
   REQUIRE(dirents.empty());
 }
 
+
+TEST_CASE("testDirentStackBasePath") {
+  RecordHasher rh;
+  DirentStack dirents(rh, "a");
+  REQUIRE(dirents.empty());
+
+  dirents.push(makeDirent("", "b"));
+  REQUIRE("a/b" == dirents.top().Path);
+  dirents.push(makeDirent("", "c"));
+  REQUIRE("a/b/c" == dirents.top().Path);
+
+  REQUIRE("a/b/c" == dirents.pop().Path);
+  REQUIRE("a/b" == dirents.pop().Path);
+  REQUIRE(dirents.empty());
+
+  // back under the base
+  dirents.push(makeDirent("", "d"));
+  REQUIRE("a/d" == dirents.top().Path);
+}
+
+TEST_CASE("testDirentStackReset") {
+  RecordHasher rh;
+  DirentStack dirents(rh, "a");
+  dirents.push(makeDirent("", "b"));
+  dirents.push(makeDirent("", "c"));
+
+  // left over from a walk which failed
+  dirents.reset("x/y");
+  REQUIRE(dirents.empty());
+
+  dirents.push(makeDirent("", "z"));
+  REQUIRE("x/y/z" == dirents.top().Path);
+  REQUIRE("x/y/z" == dirents.pop().Path);
+  REQUIRE(dirents.empty());
+}
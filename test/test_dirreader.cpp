@@ -2,6 +2,73 @@
 
 #include "dirreader.h"
 
+#include "direntbatch.h"
+#include "inode.h"
 #include "mockinputhandler.h"
+#include "readseek.h"
 
-// TODO
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+namespace fs = std::filesystem;
+
+TEST_CASE("testDirReaderPushesStreamsForRegularFiles") {
+  const fs::path root = fs::temp_directory_path() / "llama_test_dirreader";
+  fs::remove_all(root);
+  fs::create_directories(root / "sub");
+  {
+    std::ofstream f(root / "sub" / "a.txt", std::ios::binary);
+    f << "hello";
+  }
+
+  auto in = std::make_shared<MockInputHandler>();
+  DirReader reader(root.string());
+  reader.setInputHandler(in);
+  REQUIRE(reader.startReading());
+
+  REQUIRE(2u == in->Dirents.size());
+  REQUIRE(1u == in->Inodes.size());
+  REQUIRE(1u == in->Streams.size());
+
+  const Inode& inode = in->Inodes.front();
+  REQUIRE(5u == inode.Filesize);
+
+  auto& stream = *in->Streams.front();
+  REQUIRE(inode.Addr == stream.getID());
+  REQUIRE(stream.open());
+  std::vector<uint8_t> buf;
+  REQUIRE(5 == stream.read(1024, buf));
+  REQUIRE(std::string(buf.begin(), buf.end()) == "hello");
+  stream.close();
+
+  fs::remove_all(root);
+}
+
+TEST_CASE("testDirReaderIdentityIsStable") {
+  const fs::path root = fs::temp_directory_path() / "llama_test_dirreader_identity";
+  fs::remove_all(root);
+  fs::create_directories(root);
+  for (const char* name : {"a.txt", "b.txt"}) {
+    std::ofstream f(root / name, std::ios::binary);
+    f << name;
+  }
+
+  // the scan cache finds files by these across runs
+  std::set<uint64_t> addrs[2];
+  for (auto& run : addrs) {
+    auto in = std::make_shared<MockInputHandler>();
+    DirReader reader(root.string());
+    reader.setInputHandler(in);
+    REQUIRE(reader.startReading());
+    REQUIRE(2u == in->Streams.size());
+    for (const auto& stream : in->Streams) {
+      REQUIRE(stream->identity());
+      run.insert(stream->identity()->Addr);
+    }
+  }
+  REQUIRE(2u == addrs[0].size());
+  REQUIRE(addrs[0] == addrs[1]);
+
+  fs::remove_all(root);
+}
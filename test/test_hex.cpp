@@ -20,3 +20,15 @@ TEST_CASE("testHexEncode") {
     REQUIRE(t.second == hexEncode(&t.first[0], &t.first[0] + t.first.size()));
   }
 }
+
+TEST_CASE("testHexDecode") {
+  uint8_t buf[3];
+  REQUIRE(hexDecode("0fF002", buf, sizeof(buf)));
+  REQUIRE(buf[0] == 0x0f);
+  REQUIRE(buf[1] == 0xf0);
+  REQUIRE(buf[2] == 0x02);
+  REQUIRE(hexEncode(buf, sizeof(buf)) == "0ff002");
+
+  REQUIRE(!hexDecode("0ff0", buf, sizeof(buf)));
+  REQUIRE(!hexDecode("0ff00g", buf, sizeof(buf)));
+}
@@ -0,0 +1,148 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "hitneeds.h"
+#include "rulereader.h"
+
+#include <algorithm>
+#include <optional>
+
+namespace {
+  class NeedsTester {
+  public:
+    NeedsTester(const std::string& rules): Input(rules) {
+      Reader.read(Input, "test"); // tokens point into Input
+      const std::vector<Rule>& parsed = Reader.getRules();
+      for (size_t r = 0; r < parsed.size(); ++r) {
+        for (const auto& pPair : parsed[r].getPatternMap()) {
+          KeywordPatterns.emplace_back(r, pPair.first);
+        }
+      }
+      Needs.emplace(parsed, Reader.getParser(), KeywordPatterns);
+      Needs->reset(State);
+    }
+
+    bool hit(size_t rule, std::string_view pattern, uint64_t start = 0, uint64_t end = 1) {
+      auto it = std::find(KeywordPatterns.begin(), KeywordPatterns.end(), std::make_pair(rule, pattern));
+      REQUIRE(it != KeywordPatterns.end());
+      LG_SearchHit h{start, end, uint32_t(it - KeywordPatterns.begin())};
+      return Needs->addHit(State, h);
+    }
+
+    bool settled() const { return State.settled(); }
+
+    const HitNeeds& needs() const { return *Needs; }
+
+  private:
+    std::string Input;
+    RuleReader Reader;
+    std::vector<std::pair<size_t, std::string_view>> KeywordPatterns;
+    std::optional<HitNeeds> Needs;
+    HitNeeds::State State;
+  };
+}
+
+TEST_CASE("hitNeedsAnySettlesOnFirstHit") {
+  NeedsTester t(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: any() })");
+  REQUIRE(t.needs().canSettle());
+  REQUIRE(!t.settled());
+  REQUIRE(t.hit(0, "b"));
+}
+
+TEST_CASE("hitNeedsAllWaitsForEveryPattern") {
+  NeedsTester t(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: all(a, b) })");
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(t.hit(0, "b"));
+}
+
+TEST_CASE("hitNeedsCountComparisons") {
+  NeedsTester greater(R"(rule r { grep: patterns: a = "foo" condition: count(a) > 2 })");
+  REQUIRE(!greater.hit(0, "a"));
+  REQUIRE(!greater.hit(0, "a"));
+  REQUIRE(greater.hit(0, "a"));
+
+  // decided false once exceeded
+  NeedsTester equal(R"(rule r { grep: patterns: a = "foo" condition: count(a) == 1 })");
+  REQUIRE(!equal.hit(0, "a"));
+  REQUIRE(equal.hit(0, "a"));
+
+  // already decided false with no hits at all
+  NeedsTester less(R"(rule r { grep: patterns: a = "foo" condition: count(a) < 0 })");
+  REQUIRE(less.settled());
+}
+
+TEST_CASE("hitNeedsCountHasHitsIsBoundedByItsPatterns") {
+  NeedsTester t(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: count_has_hits(a, b) <= 1 })");
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(t.hit(0, "b"));
+}
+
+TEST_CASE("hitNeedsBooleanOperators") {
+  NeedsTester t(R"(rule r { grep: patterns: a = "foo" b = "bar" c = "baz" condition: (any(a) and any(b)) or count(c) > 1 })");
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(!t.hit(0, "c"));
+  REQUIRE(t.hit(0, "b"));
+
+  NeedsTester falseAnd(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: count(a) == 0 and any(b) })");
+  REQUIRE(falseAnd.hit(0, "a"));
+}
+
+TEST_CASE("hitNeedsOffsetAndLength") {
+  NeedsTester t(R"(rule r { grep: patterns: a = "foo" condition: offset(a) < 25 })");
+  REQUIRE(!t.hit(0, "a", 30, 33));
+  REQUIRE(t.hit(0, "a", 20, 23));
+
+  NeedsTester len(R"(rule r { grep: patterns: a = "foo" condition: length(a) > 3 })");
+  REQUIRE(!len.hit(0, "a", 0, 3));
+  REQUIRE(len.hit(0, "a", 10, 14));
+
+  // the nth hit can't be known until the end
+  NeedsTester nth(R"(rule r { grep: patterns: a = "foo" condition: offset(a, 2) > 50 })");
+  REQUIRE(!nth.needs().canSettle());
+  REQUIRE(!nth.hit(0, "a", 60, 63));
+  REQUIRE(!nth.hit(0, "a", 70, 73));
+}
+
+TEST_CASE("hitNeedsWaitsForEveryRule") {
+  NeedsTester t(R"(
+  rule r1 { grep: patterns: a = "foo" condition: any() }
+  rule r2 { grep: patterns: a = "bar" condition: any() }
+  rule r3 { file_metadata: filesize > 100 })");
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(!t.hit(0, "a"));
+  REQUIRE(t.hit(1, "a"));
+}
+
+TEST_CASE("hitNeedsMixedRulesSettleOnlyIfTheyCan") {
+  // any() is never false, and the nth offset is never decided, so the AND
+  // can't be decided either way before the end
+  NeedsTester anyAndNth(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: any(a) and offset(b, 2) > 5 })");
+  REQUIRE(!anyAndNth.needs().canSettle());
+  REQUIRE(!anyAndNth.hit(0, "a"));
+
+  NeedsTester anyOrNth(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: any(a) or offset(b, 2) > 5 })");
+  REQUIRE(anyOrNth.needs().canSettle());
+  REQUIRE(anyOrNth.hit(0, "a"));
+
+  NeedsTester noneAndNth(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: count(a) == 0 and offset(b, 2) > 5 })");
+  REQUIRE(noneAndNth.needs().canSettle());
+  REQUIRE(noneAndNth.hit(0, "a"));
+
+  // a count below a bound only ever becomes false
+  NeedsTester fewOrNth(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: count(a) < 2 or offset(b, 2) > 5 })");
+  REQUIRE(!fewOrNth.needs().canSettle());
+
+  NeedsTester anyAndFew(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: any(a) and count(b) < 2 })");
+  REQUIRE(anyAndFew.needs().canSettle());
+  REQUIRE(!anyAndFew.hit(0, "a"));
+  REQUIRE(!anyAndFew.hit(0, "b"));
+  REQUIRE(anyAndFew.hit(0, "b"));
+
+  NeedsTester fewOrFew(R"(rule r { grep: patterns: a = "foo" b = "bar" condition: count(a) < 2 or count(b) < 2 })");
+  REQUIRE(fewOrFew.needs().canSettle());
+  REQUIRE(!fewOrFew.hit(0, "a"));
+  REQUIRE(!fewOrFew.hit(0, "a"));
+  REQUIRE(!fewOrFew.hit(0, "b"));
+  REQUIRE(fewOrFew.hit(0, "b"));
+}
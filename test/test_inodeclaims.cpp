@@ -0,0 +1,45 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "inodeclaims.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_CASE("testInodeClaimsOnce") {
+  InodeClaims claims(16, 200);
+  REQUIRE(claims.claim(16));
+  REQUIRE(!claims.claim(16));
+  REQUIRE(claims.claim(79));
+  REQUIRE(claims.claim(80));
+  REQUIRE(!claims.claim(79));
+  REQUIRE(claims.claim(199));
+  REQUIRE(!claims.claim(199));
+
+  // untracked
+  REQUIRE(claims.claim(15));
+  REQUIRE(claims.claim(15));
+  REQUIRE(claims.claim(200));
+  REQUIRE(claims.claim(200));
+}
+
+TEST_CASE("testInodeClaimsConcurrent") {
+  const uint64_t n = 10000;
+  InodeClaims claims(0, n);
+  std::atomic<uint64_t> claimed(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      for (uint64_t i = 0; i < n; ++i) {
+        if (claims.claim(i)) {
+          ++claimed;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // every inode was claimed by exactly one thread
+  REQUIRE(n == claimed);
+}
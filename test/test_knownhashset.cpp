@@ -0,0 +1,86 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "knownhashset.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+namespace {
+  std::vector<uint8_t> randomDigests(size_t n, size_t dsize, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> ret(n * dsize);
+    for (auto& b : ret) {
+      b = byte(gen);
+    }
+    return ret;
+  }
+}
+
+TEST_CASE("knownHashSetDigestSizes") {
+  REQUIRE(KnownHashSet::digestSize(SFHASH_MD5) == 16);
+  REQUIRE(KnownHashSet::digestSize(SFHASH_SHA_1) == 20);
+  REQUIRE(KnownHashSet::digestSize(SFHASH_SHA_2_256) == 32);
+  REQUIRE(KnownHashSet::digestSize(SFHASH_BLAKE3) == 32);
+  REQUIRE(KnownHashSet::digestSize(SFHASH_FUZZY) == 0);
+}
+
+TEST_CASE("knownHashSetWriteAndLookup") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_known.lkh";
+  const size_t n = 10000;
+  auto digests = randomDigests(n, 20, 1);
+  // a duplicate, which should be dropped
+  digests.insert(digests.end(), digests.begin(), digests.begin() + 20);
+
+  REQUIRE(KnownHashSet::write(path.string(), SFHASH_SHA_1, digests) == n);
+
+  KnownHashSet known(path.string());
+  REQUIRE(known.algorithm() == SFHASH_SHA_1);
+  REQUIRE(known.size() == n);
+  for (size_t i = 0; i < n; ++i) {
+    REQUIRE(known.contains(digests.data() + i * 20));
+  }
+
+  const auto others = randomDigests(n, 20, 2);
+  for (size_t i = 0; i < n; ++i) {
+    REQUIRE(!known.contains(others.data() + i * 20));
+  }
+
+  SFHASH_HashValues h;
+  std::copy(digests.begin() + 40, digests.begin() + 60, h.Sha1);
+  REQUIRE(known.contains(h));
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("knownHashSetFromHexFile") {
+  const auto hexPath = std::filesystem::temp_directory_path() / "llama_test_known.txt";
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_known_hex.lkh";
+  {
+    std::ofstream out(hexPath);
+    out << "\"MD5\"\n"
+        << "d41d8cd98f00b204e9800998ecf8427e\r\n"
+        << "not a hash at all, but 32 chars!\n"
+        << "098F6BCD4621D373CADE4E832627B4F6\n";
+  }
+  REQUIRE(KnownHashSet::writeFromHexFile(path.string(), SFHASH_MD5, hexPath.string()) == 2);
+
+  KnownHashSet known(path.string());
+  const uint8_t empty[16] = {0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04, 0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e};
+  const uint8_t test[16] = {0x09, 0x8f, 0x6b, 0xcd, 0x46, 0x21, 0xd3, 0x73, 0xca, 0xde, 0x4e, 0x83, 0x26, 0x27, 0xb4, 0xf6};
+  REQUIRE(known.contains(empty));
+  REQUIRE(known.contains(test));
+  std::filesystem::remove(hexPath);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("knownHashSetRejectsOtherFiles") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_not_known.lkh";
+  {
+    std::ofstream out(path);
+    out << "this is not a known hash set, and is long enough to have a header";
+  }
+  REQUIRE_THROWS_AS(KnownHashSet(path.string()), std::runtime_error);
+  REQUIRE_THROWS_AS(KnownHashSet((path / "missing").string()), std::runtime_error);
+  std::filesystem::remove(path);
+}
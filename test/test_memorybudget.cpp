@@ -0,0 +1,62 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "memorybudget.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST_CASE("testMemoryBudgetUnlimited") {
+  MemoryBudget budget(0);
+  budget.acquire(uint64_t(1) << 40);
+  budget.acquire(uint64_t(1) << 40);
+  REQUIRE((uint64_t(2) << 40) == budget.used());
+  REQUIRE(!budget.over());
+  budget.release(uint64_t(2) << 40);
+  REQUIRE(0u == budget.used());
+}
+
+TEST_CASE("testMemoryBudgetAcquireWaits") {
+  MemoryBudget budget(100);
+  budget.acquire(60);
+  REQUIRE(60u == budget.used());
+
+  std::atomic<bool> acquired(false);
+  std::thread t([&]() {
+    budget.acquire(50);
+    acquired = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(!acquired);
+
+  budget.release(20);
+  t.join();
+  REQUIRE(acquired);
+  REQUIRE(90u == budget.used());
+}
+
+TEST_CASE("testMemoryBudgetOversizedFitsAlone") {
+  MemoryBudget budget(100);
+  budget.acquire(1000);
+  REQUIRE(1000u == budget.used());
+  REQUIRE(budget.over());
+  budget.release(1000);
+  REQUIRE(!budget.over());
+}
+
+TEST_CASE("testMemoryBudgetCharge") {
+  MemoryBudget budget(100);
+  budget.acquire(80);
+  // held memory is charged without waiting, and may spend the budget
+  budget.charge(40);
+  REQUIRE(120u == budget.used());
+  REQUIRE(budget.over());
+
+  budget.release(40);
+  REQUIRE(!budget.over());
+  REQUIRE(0u == budget.overReleased());
+  // releasing more than is held doesn't wrap around, but is counted
+  budget.release(1000);
+  REQUIRE(0u == budget.used());
+  REQUIRE(920u == budget.overReleased());
+}
@@ -0,0 +1,130 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "metrics.h"
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+TEST_CASE("testMetricsCountersSumThreads") {
+  Metrics metrics;
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < 4; ++t) {
+    threads.emplace_back([&metrics]() {
+      for (unsigned int i = 0; i < 1000; ++i) {
+        metrics.add(Metrics::FILES);
+        metrics.add(Metrics::BYTES_READ, 10);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const Metrics::Snapshot snap = metrics.snapshot();
+  REQUIRE(4000u == snap.Counters[Metrics::FILES]);
+  REQUIRE(40000u == snap.Counters[Metrics::BYTES_READ]);
+  REQUIRE(0u == snap.Counters[Metrics::HITS]);
+}
+
+TEST_CASE("testMetricsInstancesAreSeparate") {
+  Metrics a, b;
+  a.add(Metrics::HITS, 3);
+  b.add(Metrics::HITS, 5);
+  a.add(Metrics::HITS);
+  REQUIRE(4u == a.snapshot().Counters[Metrics::HITS]);
+  REQUIRE(5u == b.snapshot().Counters[Metrics::HITS]);
+}
+
+TEST_CASE("testMetricsHistogram") {
+  Metrics metrics;
+  for (uint64_t v = 1; v <= 100; ++v) {
+    metrics.record(Metrics::SEARCH_NS, v);
+  }
+  metrics.record(Metrics::SEARCH_NS, 0);
+
+  const Metrics::Snapshot snap = metrics.snapshot();
+  const Metrics::HistogramSnapshot& hist = snap.Histograms[Metrics::SEARCH_NS];
+  REQUIRE(101u == hist.Count);
+  REQUIRE(5050u == hist.Sum);
+  REQUIRE(100u == hist.Max);
+  REQUIRE(1u == hist.Buckets[0]);
+  REQUIRE(1u == hist.Buckets[1]); // 1
+  REQUIRE(2u == hist.Buckets[2]); // 2, 3
+  REQUIRE(37u == hist.Buckets[7]); // 64..100
+
+  // percentiles are bucket upper bounds, never beyond the max
+  REQUIRE(63u == hist.percentile(0.5));
+  REQUIRE(100u == hist.percentile(0.99));
+  REQUIRE(100u == hist.percentile(1.0));
+  REQUIRE(0u == hist.percentile(0.0));
+
+  REQUIRE(0u == Metrics::HistogramSnapshot().percentile(0.5));
+}
+
+TEST_CASE("testMetricsLatency") {
+  Metrics metrics;
+  {
+    Metrics::Latency t(Metrics::FLUSH_NS, metrics);
+  }
+  REQUIRE(1u == metrics.snapshot().Histograms[Metrics::FLUSH_NS].Count);
+  REQUIRE(0u == metrics.snapshot().Histograms[Metrics::READ_NS].Count);
+}
+
+TEST_CASE("testMetricsSnapshotSince") {
+  Metrics metrics;
+  metrics.add(Metrics::BATCHES_QUEUED, 3);
+  metrics.record(Metrics::HASH_NS, 10);
+  const Metrics::Snapshot before = metrics.snapshot();
+
+  metrics.add(Metrics::BATCHES_QUEUED, 2);
+  metrics.add(Metrics::BATCHES_DONE);
+  metrics.record(Metrics::HASH_NS, 20);
+
+  const Metrics::Snapshot after = metrics.snapshot();
+  REQUIRE(4u == after.pendingBatches());
+
+  const Metrics::Snapshot diff = after.since(before);
+  REQUIRE(2u == diff.Counters[Metrics::BATCHES_QUEUED]);
+  REQUIRE(1u == diff.pendingBatches());
+  REQUIRE(1u == diff.Histograms[Metrics::HASH_NS].Count);
+  REQUIRE(20u == diff.Histograms[Metrics::HASH_NS].Sum);
+}
+
+TEST_CASE("testMetricsProgressLine") {
+  Metrics metrics;
+  const Metrics::Snapshot prev = metrics.snapshot();
+  metrics.add(Metrics::FILES, 7);
+  metrics.add(Metrics::BYTES_READ, 2048);
+  metrics.add(Metrics::BATCHES_QUEUED, 2);
+
+  const std::string line = Metrics::progressLine(metrics.snapshot(), prev, 2);
+  REQUIRE(line.find("7 files") != std::string::npos);
+  REQUIRE(line.find("2.0 KiB read (1.0 KiB/s)") != std::string::npos);
+  REQUIRE(line.find("2 batches pending") != std::string::npos);
+}
+
+TEST_CASE("testMetricsProgressReporterStops") {
+  Metrics metrics;
+  std::stringstream out;
+  {
+    // destruction mustn't wait for the interval to pass
+    Metrics::ProgressReporter progress(metrics, out, 3600);
+  }
+  REQUIRE(out.str().empty());
+  {
+    Metrics::ProgressReporter none(metrics, out, 0);
+  }
+  REQUIRE(out.str().empty());
+}
+
+TEST_CASE("testMetricsToJson") {
+  Metrics metrics;
+  metrics.add(Metrics::HITS, 12);
+  metrics.record(Metrics::QUEUE_WAIT_NS, 3000000);
+
+  const std::string json = Metrics::toJson(metrics.snapshot(), 1.5);
+  REQUIRE(json.find("\"elapsed_seconds\"") != std::string::npos);
+  REQUIRE(json.find("\"hits\"") != std::string::npos);
+  REQUIRE(json.find("\"queue_wait\"") != std::string::npos);
+  REQUIRE(json.find("\"p99_ms\"") != std::string::npos);
+}
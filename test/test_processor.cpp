@@ -3,17 +3,25 @@
 #include "processor.h"
 
 #include "lightgrep/api.h"
+#include "contentcache.h"
+#include "knownhashset.h"
 #include "filerecord.h"
+#include "metrics.h"
 #include "mockoutputhandler.h"
+#include "readahead.h"
 #include "readseek_impl.h"
 #include "patternparser.h"
+#include "rulereader.h"
 
 #include <hasher/api.h>
 
+#include <cstring>
+#include <filesystem>
 #include <thread>
 #include <vector>
 
 #include "boost_asio.h"
+#include "hex.h"
 
 TEST_CASE("testBoostThreadPool") {
   unsigned int count = 0;
@@ -30,8 +38,11 @@ TEST_CASE("testBoostThreadPool") {
 
 class ProcessorSearchTester {
 public:
-  ProcessorSearchTester(std::string needle, std::string haystack, uint64_t numExpectedHits) 
-  : PatternToRuleId(numExpectedHits, "rule_id"), RsBuf(haystack), Db(), DbConn(Db), Proc(createProcessor(needle)) {
+  ProcessorSearchTester(std::string needle, std::string haystack,
+                        const std::shared_ptr<ContentCache>& seen = nullptr,
+                        const std::shared_ptr<const KnownHashSet>& known = nullptr,
+                        const std::shared_ptr<const HitNeeds>& needs = nullptr)
+  : RsBuf(haystack), Db(), DbConn(Db), Proc(createProcessor(needle, seen, known, needs)) {
     Proc.setBlake3("file_hash");
   }
 
@@ -39,6 +50,46 @@ public:
     Proc.search(RsBuf);
   }
 
+  void search(ReadSeek& rs) {
+    Proc.search(rs);
+  }
+
+  void setHitLimits(uint64_t perPattern, uint64_t perFile) {
+    Proc.setHitLimits(perPattern, perFile);
+  }
+
+  void process(ReadSeek& rs) {
+    Proc.process(rs);
+    Proc.searchCoalesced();
+  }
+
+  void processWithoutSearching(ReadSeek& rs) {
+    Proc.process(rs);
+  }
+
+  void searchCoalesced() {
+    Proc.searchCoalesced();
+  }
+
+  std::vector<LG_SearchHit> searchSegment(uint64_t beg, uint64_t end, uint64_t overlap, std::vector<uint8_t>* data = nullptr) {
+    return Proc.searchSegment(RsBuf, beg, end, overlap, nullptr, data);
+  }
+
+  // hashes the pieces in order, as the large file jobs do
+  SFHASH_HashValues hashPieces(const std::vector<std::vector<uint8_t>>& pieces) {
+    auto hasher = Proc.makeHasher();
+    for (const auto& piece : pieces) {
+      Proc.hashPiece(hasher.get(), piece);
+    }
+    SFHASH_HashValues h;
+    sfhash_get_hashes(hasher.get(), &h);
+    return h;
+  }
+
+  SFHASH_HashValues hashStream() {
+    return Proc.hashStream(RsBuf);
+  }
+
   uint64_t putSearchHitsInDb() {
     LlamaDBAppender appender(DbConn.get(), "search_hits");
     uint64_t recordsInserted = Proc.searchHits()->copyToDB(appender.get());
@@ -58,6 +109,24 @@ public:
     return recordsInserted;
   }
 
+  uint64_t numDroppedHits() {
+    Proc.flush();
+    duckdb_result result;
+    duckdb_query(DbConn.get(), "SELECT COALESCE(SUM(dropped), 0) FROM search_hits_overflow;", &result);
+    auto dropped = duckdb_value_uint64(&result, 0, 0);
+    duckdb_destroy_result(&result);
+    return dropped;
+  }
+
+  uint64_t numHashRecords() {
+    Proc.flush();
+    duckdb_result result;
+    duckdb_query(DbConn.get(), "SELECT * FROM hash;", &result);
+    auto rows = duckdb_row_count(&result);
+    duckdb_destroy_result(&result);
+    return rows;
+  }
+
   uint64_t numDiffsBetweenTables() {
     duckdb_result result;
     std::string diffUnionQuery = "(Select * from search_hits Except Select * from temp_search_hits ) UNION ALL (Select * from search_hits Except Select * from temp_search_hits)";
@@ -68,7 +137,8 @@ public:
   }
 
 private:
-  Processor createProcessor(std::string needle) {
+  Processor createProcessor(std::string needle, const std::shared_ptr<ContentCache>& seen, const std::shared_ptr<const KnownHashSet>& known,
+                            const std::shared_ptr<const HitNeeds>& needs) {
     std::shared_ptr<PatternHandle> pat(lg_create_pattern(), lg_destroy_pattern);
     LG_KeyOptions opts{0,0,0};
     LG_Error* err(nullptr);
@@ -82,9 +152,9 @@ private:
     // duckdb setup
     DBType<SearchHit>::createTable(DbConn.get(), "search_hits");
     DBType<HashRec>::createTable(DbConn.get(), "hash");
-    return Processor{&Db, pHandle, PatternToRuleId};
+    DBType<SearchHitOverflow>::createTable(DbConn.get(), "search_hits_overflow");
+    return Processor{&Db, pHandle, Processor::DEFAULT_HASH_ALGS, seen, known, nullptr, needs};
   }
-  std::vector<std::string> PatternToRuleId;
   ReadSeekBuf RsBuf;
   LlamaDB Db;
   LlamaDBConnection DbConn;
@@ -96,10 +166,10 @@ TEST_CASE("testBasicOneHitSearch") {
   std::string haystack = "this is so foobar";
 
   std::vector<SearchHit> expectedHits = {
-    SearchHit{"foobar", 11, 17, "rule_id", "file_hash", 6}
+    SearchHit{0, 11, 17, "file_hash", 6}
   };
 
-  ProcessorSearchTester pst{needle, haystack, expectedHits.size()};
+  ProcessorSearchTester pst{needle, haystack};
   pst.search();
 
   REQUIRE(expectedHits.size() == pst.putSearchHitsInDb());
@@ -118,10 +188,10 @@ TEST_CASE("testSearchThatSpansMultipleBuffers") {
   CHECK(hitLength == haystack.size());
 
   std::vector<SearchHit> expectedHits = {
-    SearchHit{needle, 0, hitLength, "rule_id", "file_hash", hitLength}
+    SearchHit{0, 0, hitLength, "file_hash", hitLength}
   };
 
-  ProcessorSearchTester pst{needle, haystack, expectedHits.size()};
+  ProcessorSearchTester pst{needle, haystack};
   pst.search();
 
   REQUIRE(expectedHits.size() == pst.putSearchHitsInDb());
@@ -134,12 +204,12 @@ TEST_CASE("testSearchWithMultipleHits") {
   std::string haystack = "foo is foobar is foobaz";
 
   std::vector<SearchHit> expectedHits{
-    SearchHit{"foo", 0, 3, "rule_id", "file_hash", 3},
-    SearchHit{"foo", 7, 10, "rule_id", "file_hash", 3},
-    SearchHit{"foo", 17, 20, "rule_id", "file_hash", 3},
+    SearchHit{0, 0, 3, "file_hash", 3},
+    SearchHit{0, 7, 10, "file_hash", 3},
+    SearchHit{0, 17, 20, "file_hash", 3},
   };
 
-  ProcessorSearchTester pst(needle, haystack, expectedHits.size());
+  ProcessorSearchTester pst(needle, haystack);
   pst.search();
 
   REQUIRE(expectedHits.size() == pst.putSearchHitsInDb());
@@ -147,3 +217,331 @@ TEST_CASE("testSearchWithMultipleHits") {
   REQUIRE(0 == pst.numDiffsBetweenTables());
 
 }
+
+class CountingReadSeek: public ReadSeekBuf {
+public:
+  CountingReadSeek(const std::string& str, bool cheap = true): ReadSeekBuf(str), BytesRead(0), Cheap(cheap) {}
+
+  virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override {
+    auto ret = ReadSeekBuf::read(len, buf);
+    BytesRead += ret;
+    return ret;
+  }
+
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override {
+    auto ret = ReadSeekBuf::readView(len, buf);
+    BytesRead += ret;
+    return ret;
+  }
+
+  virtual bool cheapToReread() const override { return Cheap; }
+
+  uint64_t BytesRead;
+  bool Cheap;
+};
+
+std::string blake3Hex(const std::string& data) {
+  std::shared_ptr<SFHASH_Hasher> hasher(sfhash_create_hasher(SFHASH_BLAKE3), sfhash_destroy_hasher);
+  sfhash_update_hasher(hasher.get(), data.data(), data.data() + data.size());
+  SFHASH_HashValues hashes;
+  sfhash_get_hashes(hasher.get(), &hashes);
+  return hexEncode(hashes.Blake3, sizeof(hashes.Blake3));
+}
+
+TEST_CASE("testProcessReadsOnceAndHitsGetFileHash") {
+  std::string needle = "foo";
+  std::string haystack = "foo is foobar is foobaz";
+  const std::string blake3 = blake3Hex(haystack);
+
+  std::vector<SearchHit> expectedHits{
+    SearchHit{0, 0, 3, blake3, 3},
+    SearchHit{0, 7, 10, blake3, 3},
+    SearchHit{0, 17, 20, blake3, 3},
+  };
+
+  ProcessorSearchTester pst(needle, haystack);
+  CountingReadSeek rs(haystack);
+  pst.process(rs);
+
+  REQUIRE(haystack.size() == rs.BytesRead);
+  REQUIRE(expectedHits.size() == pst.putSearchHitsInDb());
+  pst.createTempTableAndPopulate(expectedHits);
+  REQUIRE(0 == pst.numDiffsBetweenTables());
+}
+
+// reads as far as failAt, then fails
+class FailingReadSeek: public ReadSeekBuf {
+public:
+  FailingReadSeek(const std::string& str, size_t failAt): ReadSeekBuf(str), FailAt(failAt) {}
+
+  virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override {
+    return tellg() < FailAt ? ReadSeekBuf::read(std::min(len, FailAt - tellg()), buf) : -1;
+  }
+
+  virtual int64_t readView(size_t len, const uint8_t*& buf) override {
+    return tellg() < FailAt ? ReadSeekBuf::readView(std::min(len, FailAt - tellg()), buf) : -1;
+  }
+
+  const size_t FailAt;
+};
+
+TEST_CASE("testProcessStopsAtReadError") {
+  std::string haystack(Processor::SMALL_FILE_SIZE * 4, 'x');
+  haystack.replace(100, 3, "foo");
+  haystack.replace(haystack.size() - 100, 3, "foo");
+  const size_t failAt = haystack.size() / 2;
+
+  // the read-ahead fails along with the stream it wraps, and the file is
+  // processed as far as it was read
+  const uint64_t errors = Metrics::global().snapshot().Counters[Metrics::READ_ERRORS];
+  BufferPool pool(2, 4096);
+  ProcessorSearchTester pst("foo", "");
+  ReadAheadStream ra(std::make_unique<FailingReadSeek>(haystack, failAt), pool);
+  std::thread filler(ra.filler());
+  pst.process(ra);
+  filler.join();
+  ra.close();
+  REQUIRE(failAt == ra.tellg());
+  REQUIRE(1 == pst.putSearchHitsInDb());
+  REQUIRE(errors + 1 == Metrics::global().snapshot().Counters[Metrics::READ_ERRORS]);
+
+  FailingReadSeek rs(haystack, failAt);
+  pst.search(rs);
+  REQUIRE(failAt == rs.tellg());
+  REQUIRE(2 == pst.putSearchHitsInDb());
+  REQUIRE(errors + 2 == Metrics::global().snapshot().Counters[Metrics::READ_ERRORS]);
+}
+
+TEST_CASE("testSearchSegmentsMatchFullSearch") {
+  // runs of 'a' straddle both segment boundaries; a segment which began
+  // searching right at its boundary would see a shorter, spurious hit
+  std::string haystack(300, 'x');
+  haystack.replace(98, 4, "aaaa");
+  haystack.replace(197, 7, "aaaaaaa");
+
+  ProcessorSearchTester pst("a+", haystack);
+  std::vector<std::pair<uint64_t, uint64_t>> hits;
+  for (uint64_t beg = 0; beg < haystack.size(); beg += 100) {
+    for (const LG_SearchHit& hit : pst.searchSegment(beg, beg + 100, 16)) {
+      hits.emplace_back(hit.Start, hit.End);
+    }
+  }
+
+  const std::vector<std::pair<uint64_t, uint64_t>> expected{{98, 102}, {197, 204}};
+  REQUIRE(expected == hits);
+}
+
+TEST_CASE("testSearchedSegmentsHashLikeTheWholeStream") {
+  std::string haystack(1000, 'x');
+  for (size_t i = 0; i < haystack.size(); ++i) {
+    haystack[i] = 'a' + i % 26;
+  }
+  ProcessorSearchTester pst("abc", haystack);
+
+  // each segment's data is just its own, not the overlap searched
+  std::vector<std::vector<uint8_t>> pieces(4);
+  size_t hits = 0;
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    hits += pst.searchSegment(i * 300, std::min<uint64_t>(i * 300 + 300, haystack.size()), 16, &pieces[i]).size();
+  }
+  REQUIRE(39 == hits);
+  REQUIRE(300 == pieces[0].size());
+  REQUIRE(100 == pieces[3].size());
+  REQUIRE('a' + 300 % 26 == pieces[1][0]);
+
+  const SFHASH_HashValues whole = pst.hashStream();
+  const SFHASH_HashValues pieced = pst.hashPieces(pieces);
+  REQUIRE(0 == std::memcmp(whole.Md5, pieced.Md5, sizeof(whole.Md5)));
+  REQUIRE(0 == std::memcmp(whole.Blake3, pieced.Blake3, sizeof(whole.Blake3)));
+}
+
+TEST_CASE("testCoalescedSmallFilesHitsMapBackToFiles") {
+  // packed together these are "xaaaxzzaz"; the run of 'a's crossing the
+  // first boundary must give way to the hits in each file alone
+  const std::vector<std::string> files{"xa", "aax", "", "zzaz"};
+
+  std::vector<SearchHit> expectedHits{
+    SearchHit{0, 1, 2, blake3Hex(files[0]), 1},
+    SearchHit{0, 0, 2, blake3Hex(files[1]), 2},
+    SearchHit{0, 2, 3, blake3Hex(files[3]), 1},
+  };
+
+  ProcessorSearchTester pst("a+", "");
+  for (const std::string& f : files) {
+    ReadSeekBuf rs(f);
+    pst.processWithoutSearching(rs);
+  }
+  REQUIRE(0 == pst.putSearchHitsInDb());
+  pst.searchCoalesced();
+
+  REQUIRE(expectedHits.size() == pst.putSearchHitsInDb());
+  pst.createTempTableAndPopulate(expectedHits);
+  REQUIRE(0 == pst.numDiffsBetweenTables());
+}
+
+TEST_CASE("testDuplicateContentIsSearchedOnce") {
+  // big enough not to be coalesced, so the second copy's fingerprint
+  // makes it get hashed before it's searched
+  std::string haystack(Processor::SMALL_FILE_SIZE * 2, 'x');
+  haystack.replace(100, 3, "foo");
+  haystack.replace(haystack.size() - 10, 3, "foo");
+
+  auto seen = std::make_shared<ContentCache>();
+  ProcessorSearchTester pst("foo", "", seen);
+
+  ReadSeekBuf first(haystack);
+  pst.process(first);
+  REQUIRE(2 == pst.putSearchHitsInDb());
+
+  ProcessorSearchTester other("foo", "", seen);
+  ReadSeekBuf second(haystack);
+  other.process(second);
+  REQUIRE(0 == other.putSearchHitsInDb());
+  REQUIRE(1 == other.numHashRecords());
+  REQUIRE(seen->size() == 1);
+}
+
+TEST_CASE("testKnownFilesAreHashedButNotSearched") {
+  std::string known(Processor::SMALL_FILE_SIZE * 2, 'x');
+  known.replace(100, 3, "foo");
+  std::string unknown = known;
+  unknown.replace(200, 3, "foo");
+
+  std::shared_ptr<SFHASH_Hasher> hasher(sfhash_create_hasher(SFHASH_SHA_1), sfhash_destroy_hasher);
+  sfhash_update_hasher(hasher.get(), known.data(), known.data() + known.size());
+  SFHASH_HashValues hashes;
+  sfhash_get_hashes(hasher.get(), &hashes);
+
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_processor_known.lkh";
+  KnownHashSet::write(path.string(), SFHASH_SHA_1, std::vector<uint8_t>(std::begin(hashes.Sha1), std::end(hashes.Sha1)));
+
+  ProcessorSearchTester pst("foo", "", nullptr, std::make_shared<const KnownHashSet>(path.string()));
+  ReadSeekBuf knownRs(known);
+  pst.process(knownRs);
+  REQUIRE(0 == pst.putSearchHitsInDb());
+
+  ReadSeekBuf unknownRs(unknown);
+  pst.process(unknownRs);
+  REQUIRE(2 == pst.putSearchHitsInDb());
+  REQUIRE(2 == pst.numHashRecords());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("testKnownHashesSkipSearchingKnownFiles") {
+  std::string known(Processor::SMALL_FILE_SIZE * 2, 'x');
+  known.replace(100, 3, "foo");
+  std::string unknown = known;
+  unknown.replace(200, 3, "foo");
+
+  std::shared_ptr<SFHASH_Hasher> hasher(sfhash_create_hasher(SFHASH_SHA_1), sfhash_destroy_hasher);
+  sfhash_update_hasher(hasher.get(), known.data(), known.data() + known.size());
+  SFHASH_HashValues hashes;
+  sfhash_get_hashes(hasher.get(), &hashes);
+
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_processor_known_skip.lkh";
+  KnownHashSet::write(path.string(), SFHASH_SHA_1, std::vector<uint8_t>(std::begin(hashes.Sha1), std::end(hashes.Sha1)));
+
+  // files cheap to reread are hashed first, so known ones aren't searched,
+  // and unknown ones are read again to search them
+  ProcessorSearchTester pst("foo", "", nullptr, std::make_shared<const KnownHashSet>(path.string()));
+  CountingReadSeek knownRs(known);
+  pst.process(knownRs);
+  REQUIRE(known.size() == knownRs.BytesRead);
+  REQUIRE(0 == pst.putSearchHitsInDb());
+  CountingReadSeek unknownRs(unknown);
+  pst.process(unknownRs);
+  REQUIRE(2 * unknown.size() == unknownRs.BytesRead);
+  REQUIRE(2 == pst.putSearchHitsInDb());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("testKnownHashesReadCostlyFilesOnce") {
+  std::string known(Processor::SMALL_FILE_SIZE * 2, 'x');
+  std::string unknown = known;
+  unknown.replace(200, 3, "foo");
+
+  std::shared_ptr<SFHASH_Hasher> hasher(sfhash_create_hasher(SFHASH_SHA_1), sfhash_destroy_hasher);
+  sfhash_update_hasher(hasher.get(), known.data(), known.data() + known.size());
+  SFHASH_HashValues hashes;
+  sfhash_get_hashes(hasher.get(), &hashes);
+
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_processor_known_once.lkh";
+  KnownHashSet::write(path.string(), SFHASH_SHA_1, std::vector<uint8_t>(std::begin(hashes.Sha1), std::end(hashes.Sha1)));
+
+  // for files costly to reread, hashing and searching share one pass,
+  // which on an image means one decompression
+  ProcessorSearchTester pst("foo", "", nullptr, std::make_shared<const KnownHashSet>(path.string()));
+  CountingReadSeek knownRs(known, false);
+  pst.process(knownRs);
+  REQUIRE(known.size() == knownRs.BytesRead);
+  CountingReadSeek unknownRs(unknown, false);
+  pst.process(unknownRs);
+  REQUIRE(unknown.size() == unknownRs.BytesRead);
+  REQUIRE(1 == pst.putSearchHitsInDb());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("testSearchStopsOnceRulesAreDecided") {
+  std::string haystack(3 << 20, 'x');
+  haystack.replace(100, 3, "foo");
+  haystack.replace(3 << 19, 3, "foo");
+  haystack.replace(5 << 19, 3, "foo");
+
+  const std::string rules = R"(rule r { grep: patterns: a = "foo" condition: any() })";
+  RuleReader reader;
+  REQUIRE(reader.read(rules, "test"));
+  const std::vector<std::pair<size_t, std::string_view>> keywordPatterns{{0, "a"}};
+  auto needs = std::make_shared<const HitNeeds>(reader.getRules(), reader.getParser(), keywordPatterns);
+
+  ProcessorSearchTester all("foo", haystack);
+  all.search();
+  REQUIRE(3 == all.putSearchHitsInDb());
+
+  // the first block settles any(), so the rest isn't searched
+  ProcessorSearchTester early("foo", haystack, nullptr, nullptr, needs);
+  early.search();
+  REQUIRE(1 == early.putSearchHitsInDb());
+
+  ReadSeekBuf rs(haystack);
+  early.process(rs);
+  REQUIRE(2 == early.putSearchHitsInDb());
+  REQUIRE(1 == early.numHashRecords());
+}
+
+TEST_CASE("testHitLimitsDropAndCountHits") {
+  std::string haystack(Processor::SMALL_FILE_SIZE * 2, 'x');
+  for (size_t i = 0; i < 10; ++i) {
+    haystack.replace(i * 1000, 3, "foo");
+  }
+
+  ProcessorSearchTester pst("foo", haystack);
+  pst.setHitLimits(4, 0);
+  pst.search();
+  REQUIRE(4 == pst.putSearchHitsInDb());
+
+  ReadSeekBuf rs(haystack);
+  pst.process(rs);
+  REQUIRE(8 == pst.putSearchHitsInDb());
+  REQUIRE(12 == pst.numDroppedHits());
+
+  // small files are limited one by one, too
+  ProcessorSearchTester small("foo", "");
+  small.setHitLimits(0, 2);
+  ReadSeekBuf first("foo foo foo"), second("foo");
+  small.processWithoutSearching(first);
+  small.processWithoutSearching(second);
+  small.searchCoalesced();
+  REQUIRE(3 == small.putSearchHitsInDb());
+  REQUIRE(1 == small.numDroppedHits());
+}
+
+TEST_CASE("testHitLimitsApplyToSegments") {
+  std::string haystack(1000, 'x');
+  for (size_t i = 0; i < 10; ++i) {
+    haystack.replace(i * 100, 3, "foo");
+  }
+  ProcessorSearchTester pst("foo", haystack);
+  pst.setHitLimits(2, 0);
+  REQUIRE(2 == pst.searchSegment(0, 500, 16).size());
+  REQUIRE(2 == pst.searchSegment(500, 1000, 16).size());
+}
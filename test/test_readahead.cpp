@@ -0,0 +1,230 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "readahead.h"
+#include "readseek_impl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <thread>
+
+namespace {
+  // A stream over a buffer, which sleeps before every read, like storage
+  // with high latency
+  class SlowReadSeek: public ReadSeek {
+  public:
+    SlowReadSeek(const std::vector<uint8_t>& data, std::chrono::microseconds delay, size_t maxRead):
+      Data(data), Delay(delay), MaxRead(maxRead), Pos(0), Reads(0), Closed(false) {}
+
+    virtual bool open(void) override { return true; }
+    virtual void close(void) override { Closed = true; }
+
+    virtual uint64_t getID() const override { return 17; }
+
+    virtual int64_t read(size_t len, std::vector<uint8_t>& buf) override {
+      std::this_thread::sleep_for(Delay);
+      ++Reads;
+      const size_t n = std::min({len, MaxRead, Data.size() - Pos});
+      buf.assign(Data.begin() + Pos, Data.begin() + Pos + n);
+      Pos += n;
+      return n;
+    }
+
+    virtual size_t tellg() const override { return Pos; }
+    virtual size_t seek(size_t pos) override { return (Pos = std::min(pos, Data.size())); }
+
+    virtual size_t size(void) const override { return Data.size(); }
+
+    std::vector<uint8_t> Data;
+    std::chrono::microseconds Delay;
+    size_t MaxRead;
+    size_t Pos;
+    std::atomic<size_t> Reads;
+    bool Closed;
+  };
+
+  std::vector<uint8_t> pattern(size_t n) {
+    std::vector<uint8_t> ret(n);
+    for (size_t i = 0; i < n; ++i) {
+      ret[i] = uint8_t(i * 31 + i / 251);
+    }
+    return ret;
+  }
+
+  std::vector<uint8_t> readAll(ReadSeek& rs, size_t chunk) {
+    std::vector<uint8_t> ret;
+    const uint8_t* buf = nullptr;
+    int64_t n = 0;
+    while ((n = rs.readView(chunk, buf)) > 0) {
+      ret.insert(ret.end(), buf, buf + n);
+    }
+    return ret;
+  }
+}
+
+TEST_CASE("testBufferPool") {
+  BufferPool pool(2, 1000);
+  REQUIRE(1000u == pool.bufferSize());
+  REQUIRE(2u == pool.available());
+
+  uint8_t* a = pool.acquire();
+  uint8_t* b = pool.acquire();
+  REQUIRE(a != b);
+  REQUIRE(0u == reinterpret_cast<uintptr_t>(a) % BufferPool::ALIGNMENT);
+  REQUIRE(0u == reinterpret_cast<uintptr_t>(b) % BufferPool::ALIGNMENT);
+  REQUIRE(0u == pool.available());
+
+  // a third acquire waits for a release
+  std::thread t([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    pool.release(a);
+  });
+  REQUIRE(a == pool.acquire());
+  t.join();
+
+  pool.release(a);
+  pool.release(b);
+  REQUIRE(2u == pool.available());
+}
+
+TEST_CASE("testReadAheadReadsEverything") {
+  const auto data = pattern(100000);
+  BufferPool pool(3, 4096);
+  auto inner = std::make_unique<SlowReadSeek>(data, std::chrono::microseconds(100), 1000);
+  ReadAheadStream ra(std::move(inner), pool);
+  REQUIRE(17u == ra.getID());
+  REQUIRE(data.size() == ra.size());
+
+  std::thread filler(ra.filler());
+  REQUIRE(data == readAll(ra, 3000));
+  REQUIRE(data.size() == ra.tellg());
+  filler.join();
+
+  ra.close();
+  REQUIRE(3u == pool.available());
+}
+
+TEST_CASE("testReadAheadStaysAhead") {
+  const auto data = pattern(8 * 4096);
+  BufferPool pool(9, 4096);
+  auto inner = std::make_unique<SlowReadSeek>(data, std::chrono::microseconds(0), 4096);
+  SlowReadSeek* slow = inner.get();
+  ReadAheadStream ra(std::move(inner), pool);
+
+  // with enough buffers, the whole stream is read before it's consumed;
+  // the last buffer finds the end
+  ra.filler()();
+  REQUIRE(9u == slow->Reads);
+  REQUIRE(1u == pool.available());
+  REQUIRE(data == readAll(ra, 1 << 20));
+}
+
+TEST_CASE("testReadAheadSeekWithinBuffer") {
+  const auto data = pattern(20000);
+  BufferPool pool(2, 8192);
+  ReadAheadStream ra(std::make_unique<SlowReadSeek>(data, std::chrono::microseconds(0), 8192), pool);
+  std::thread filler(ra.filler());
+
+  // peek at a prefix, then start over, as Processor does
+  const uint8_t* buf = nullptr;
+  REQUIRE(100 == ra.readView(100, buf));
+  REQUIRE(std::equal(buf, buf + 100, data.begin()));
+  REQUIRE(0u == ra.seek(0));
+  REQUIRE(data == readAll(ra, 5000));
+  filler.join();
+}
+
+TEST_CASE("testReadAheadSeekBackGoesDirect") {
+  const auto data = pattern(50000);
+  BufferPool pool(2, 4096);
+  ReadAheadStream ra(std::make_unique<SlowReadSeek>(data, std::chrono::microseconds(50), 4096), pool);
+  std::thread filler(ra.filler());
+
+  REQUIRE(data == readAll(ra, 4096));
+  // rereading, as when a file is hashed before it's searched
+  REQUIRE(0u == ra.seek(0));
+  REQUIRE(data == readAll(ra, 4096));
+  filler.join();
+  REQUIRE(2u == pool.available());
+
+  REQUIRE(1000u == ra.seek(1000));
+  const uint8_t* buf = nullptr;
+  REQUIRE(10 == ra.readView(10, buf));
+  REQUIRE(std::equal(buf, buf + 10, data.begin() + 1000));
+}
+
+TEST_CASE("testReadAheadCloseWhileFilling") {
+  const auto data = pattern(1 << 20);
+  BufferPool pool(2, 4096);
+  auto inner = std::make_unique<SlowReadSeek>(data, std::chrono::microseconds(10), 4096);
+  SlowReadSeek* slow = inner.get();
+  std::thread filler;
+  {
+    ReadAheadStream ra(std::move(inner), pool);
+    filler = std::thread(ra.filler());
+    const uint8_t* buf = nullptr;
+    REQUIRE(4096 == ra.readView(4096, buf));
+    // the filler is waiting for buffers, which closing gives back
+    ra.close();
+    REQUIRE(slow->Closed);
+    REQUIRE(2u == pool.available());
+  }
+  filler.join();
+  REQUIRE(2u == pool.available());
+}
+
+TEST_CASE("testReadAheadRewindOverAsyncWhileFilling") {
+  const auto data = pattern(256 * 1024);
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_ra_async";
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(data.data()), data.size());
+  }
+
+  // The I/O thread opens and fills the stream, then goes on reading other
+  // files through its AsyncReader, as FileScheduler's readers do. The
+  // rewind must not touch that reader.
+  BufferPool pool(2, 16384);
+  std::promise<std::unique_ptr<ReadAheadStream>> handoff;
+  std::atomic<bool> done(false), otherOk(true);
+  std::thread io([&]() {
+    auto inner = std::make_unique<ReadSeekAsync>(path.string(), 1, 4, 4096);
+    if (!inner->open()) {
+      otherOk = false;
+      handoff.set_value(nullptr);
+      return;
+    }
+    auto ra = std::make_unique<ReadAheadStream>(std::move(inner), pool);
+    auto fill = ra->filler();
+    handoff.set_value(std::move(ra));
+    fill();
+    while (!done) {
+      ReadSeekAsync other(path.string(), 2, 4, 4096);
+      if (!other.open() || readAll(other, 8192) != data) {
+        otherOk = false;
+      }
+      other.close();
+    }
+  });
+
+  std::unique_ptr<ReadAheadStream> ra = handoff.get_future().get();
+  REQUIRE(ra);
+  REQUIRE(data == readAll(*ra, 4096));
+  // rereading, as when a file is hashed before it's searched
+  REQUIRE(0u == ra->seek(0));
+  REQUIRE(data == readAll(*ra, 4096));
+  REQUIRE(1000u == ra->seek(1000));
+  const uint8_t* buf = nullptr;
+  REQUIRE(10 == ra->readView(10, buf));
+  REQUIRE(std::equal(buf, buf + 10, data.begin() + 1000));
+  ra->close();
+
+  done = true;
+  io.join();
+  REQUIRE(otherOk);
+  REQUIRE(2u == pool.available());
+  std::filesystem::remove(path);
+}
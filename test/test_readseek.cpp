@@ -2,6 +2,11 @@
 
 #include "readseek_impl.h"
 
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
 namespace {
   std::vector<uint8_t> SRCBUF{ 35, 32, 113, 65 };
 }
@@ -25,9 +30,25 @@ void basicReadSeekTest(const std::vector<uint8_t>& srcbuf, ReadSeek& rs) {
   REQUIRE(rs.seek(rs.size() + 1) == rs.size());
 }
 
+void basicReadViewTest(const std::vector<uint8_t>& srcbuf, ReadSeek& rs) {
+  const uint8_t* buf = nullptr;
+
+  REQUIRE(rs.seek(0) == 0);
+  REQUIRE(size_t(rs.readView(srcbuf.size(), buf)) == srcbuf.size());
+  REQUIRE(std::vector<uint8_t>(buf, buf + srcbuf.size()) == srcbuf);
+  REQUIRE(rs.tellg() == rs.size());
+  REQUIRE(rs.readView(1, buf) == 0);
+
+  REQUIRE(rs.seek(1) == 1);
+  REQUIRE(rs.readView(2, buf) == 2);
+  REQUIRE(std::vector<uint8_t>(buf, buf + 2) == std::vector<uint8_t>{32, 113});
+  REQUIRE(rs.tellg() == 3);
+}
+
 TEST_CASE("readSeekBuf") {
   ReadSeekBuf rs(SRCBUF);
   basicReadSeekTest(SRCBUF, rs);
+  basicReadViewTest(SRCBUF, rs);
 }
 
 TEST_CASE("readSeekFile") {
@@ -41,4 +62,209 @@ TEST_CASE("readSeekFile") {
 
   ReadSeekFile rs(f);
   basicReadSeekTest(SRCBUF, rs);
+  basicReadViewTest(SRCBUF, rs);
+}
+
+TEST_CASE("readSeekMMapSmallFileFallsBack") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsmmap_small";
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(SRCBUF.data()), SRCBUF.size());
+  }
+  ReadSeekMMap rs(path.string(), 7);
+  REQUIRE(rs.getID() == 7);
+  REQUIRE(rs.open());
+  REQUIRE(!rs.isMapped());
+  basicReadSeekTest(SRCBUF, rs);
+  basicReadViewTest(SRCBUF, rs);
+  rs.close();
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekMMapLargeFile") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsmmap_large";
+  std::vector<uint8_t> srcbuf(ReadSeekMMap::MMAP_THRESHOLD + 4);
+  for (size_t i = 0; i < srcbuf.size(); ++i) {
+    srcbuf[i] = i % 251;
+  }
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(srcbuf.data()), srcbuf.size());
+  }
+  ReadSeekMMap rs(path.string(), 0);
+  REQUIRE(rs.open());
+  REQUIRE(rs.isMapped());
+  REQUIRE(rs.size() == srcbuf.size());
+
+  std::vector<uint8_t> buf;
+  REQUIRE(size_t(rs.read(srcbuf.size(), buf)) == srcbuf.size());
+  REQUIRE(buf == srcbuf);
+  REQUIRE(rs.read(1, buf) == 0);
+
+  const uint8_t* view = nullptr;
+  REQUIRE(rs.seek(srcbuf.size() - 2) == srcbuf.size() - 2);
+  REQUIRE(rs.readView(10, view) == 2);
+  REQUIRE(view[0] == srcbuf[srcbuf.size() - 2]);
+  REQUIRE(view[1] == srcbuf[srcbuf.size() - 1]);
+
+  // a reopened stream reads independently of the original
+  auto other = rs.reopen();
+  REQUIRE(other);
+  REQUIRE(other->open());
+  REQUIRE(other->read(4, buf) == 4);
+  REQUIRE(std::equal(buf.begin(), buf.end(), srcbuf.begin()));
+  REQUIRE(rs.tellg() == srcbuf.size());
+  other->close();
+
+  rs.close();
+  // the size stays known once closed
+  REQUIRE(rs.size() == srcbuf.size());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekMMapSizeBeforeOpen") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsmmap_size";
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(SRCBUF.data()), SRCBUF.size());
+  }
+  ReadSeekMMap rs(path.string(), 0, SRCBUF.size());
+  REQUIRE(rs.size() == SRCBUF.size());
+  REQUIRE(rs.reopen()->size() == SRCBUF.size());
+  REQUIRE(rs.open());
+  REQUIRE(rs.size() == SRCBUF.size());
+  rs.close();
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekMMapFileShrinksWhileRead") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsmmap_shrink";
+  const size_t block = ReadSeekMMap::MMAP_THRESHOLD;
+  std::vector<uint8_t> srcbuf(4 * block);
+  for (size_t i = 0; i < srcbuf.size(); ++i) {
+    srcbuf[i] = i % 251;
+  }
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(srcbuf.data()), srcbuf.size());
+  }
+  ReadSeekMMap rs(path.string(), 0);
+  REQUIRE(rs.open());
+  REQUIRE(rs.isMapped());
+
+  const uint8_t* view = nullptr;
+  REQUIRE(size_t(rs.readView(block, view)) == block);
+
+  // truncated, as by a writer; touching the mapping past the new end
+  // would raise SIGBUS
+  std::filesystem::resize_file(path, 2 * block + 10);
+  size_t total = block;
+  int64_t n = 0;
+  while ((n = rs.readView(block, view)) > 0) {
+    REQUIRE(std::equal(view, view + n, srcbuf.begin() + total));
+    total += n;
+  }
+  REQUIRE(total == 2 * block + 10);
+  REQUIRE(!rs.isMapped());
+  REQUIRE(rs.size() == 2 * block + 10);
+  rs.close();
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekAsync") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsasync";
+  std::vector<uint8_t> srcbuf(10000);
+  for (size_t i = 0; i < srcbuf.size(); ++i) {
+    srcbuf[i] = i % 251;
+  }
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(srcbuf.data()), srcbuf.size());
+  }
+  // small blocks, so that reads and seeks cross several of them
+  ReadSeekAsync rs(path.string(), 3, 2, 1024);
+  REQUIRE(rs.getID() == 3);
+  REQUIRE(rs.open());
+  REQUIRE(rs.size() == srcbuf.size());
+
+  std::vector<uint8_t> buf;
+  REQUIRE(size_t(rs.read(srcbuf.size(), buf)) == srcbuf.size());
+  REQUIRE(buf == srcbuf);
+  REQUIRE(rs.read(1, buf) == 0);
+
+  REQUIRE(rs.seek(5000) == 5000);
+  REQUIRE(rs.read(3000, buf) == 3000);
+  REQUIRE(std::equal(buf.begin(), buf.end(), srcbuf.begin() + 5000));
+
+  // backwards
+  const uint8_t* view = nullptr;
+  REQUIRE(rs.seek(10) == 10);
+  const auto n = rs.readView(4096, view); // no more than a block at a time
+  REQUIRE(n > 0);
+  REQUIRE(n <= 1024);
+  REQUIRE(std::equal(view, view + n, srcbuf.begin() + 10));
+  REQUIRE(rs.tellg() == size_t(10 + n));
+
+  rs.close();
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekAsyncOwnerThread") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsasync_owner";
+  std::vector<uint8_t> srcbuf(5000, 7);
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(srcbuf.data()), srcbuf.size());
+  }
+  ReadSeekAsync rs(path.string(), 3, 2, 1024);
+  REQUIRE(rs.open());
+
+  // its reads are in flight on this thread's AsyncReader
+  bool threw = false;
+  bool reopened = false;
+  std::thread([&]() {
+    std::vector<uint8_t> buf;
+    try {
+      rs.read(10, buf);
+    }
+    catch (const std::runtime_error&) {
+      threw = true;
+    }
+    auto other = rs.reopen();
+    reopened = other->open() && size_t(other->read(srcbuf.size(), buf)) == srcbuf.size() && buf == srcbuf;
+    other->close();
+  }).join();
+  REQUIRE(threw);
+  REQUIRE(reopened);
+
+  std::vector<uint8_t> buf;
+  REQUIRE(size_t(rs.read(srcbuf.size(), buf)) == srcbuf.size());
+  rs.close();
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("readSeekAsyncDestroyedOnAnotherThread") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_rsasync_destroy";
+  std::vector<uint8_t> srcbuf(5000, 7);
+  {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(srcbuf.data()), srcbuf.size());
+  }
+  // opened, with reads in flight, on a thread which is gone by the time
+  // the stream is destroyed, as when a batch is released elsewhere
+  std::unique_ptr<ReadSeekAsync> rs;
+  std::thread([&]() {
+    rs = std::make_unique<ReadSeekAsync>(path.string(), 3, 2, 1024);
+    REQUIRE(rs->open());
+    std::vector<uint8_t> buf;
+    REQUIRE(10 == rs->read(10, buf));
+  }).join();
+  REQUIRE_NOTHROW(rs.reset());
+
+  // and closing on another thread while the owner lives
+  ReadSeekAsync other(path.string(), 3, 2, 1024);
+  REQUIRE(other.open());
+  std::thread([&]() { REQUIRE_NOTHROW(other.close()); }).join();
+  REQUIRE(0u == other.size());
+  std::filesystem::remove(path);
 }
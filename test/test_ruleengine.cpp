@@ -21,6 +21,9 @@ TEST_CASE("TestCreateTables") {
   state = duckdb_query(conn.get(), "select * from search_hits;", &result);
   REQUIRE(state == DuckDBSuccess);
   REQUIRE(duckdb_row_count(&result) == 0);
+  state = duckdb_query(conn.get(), "select * from search_hits_overflow;", &result);
+  REQUIRE(state == DuckDBSuccess);
+  REQUIRE(duckdb_row_count(&result) == 0);
   REQUIRE_THROWS(engine.createTables(conn));
 }
 
@@ -78,4 +81,63 @@ TEST_CASE("getFsm") {
   REQUIRE(patToRuleId.size() == 3);
   REQUIRE(patToRuleId[0] == patToRuleId[1]);
   REQUIRE(patToRuleId[1] != patToRuleId[2]);
-}
\ No newline at end of file
+}
+
+TEST_CASE("hashAlgsUnionsRuleHashSections") {
+  std::string input = R"(
+  rule MyRule {
+    hash:
+      md5 == "abcdef"
+  }
+  rule MyOtherRule {
+    hash:
+      sha1 == "abcdef", sha256 == "012345"
+  }
+  rule NoHashRule {
+    file_metadata:
+      filesize > 100
+  })";
+  LlamaRuleEngine engine;
+  engine.read(input, "test");
+  REQUIRE(engine.hashAlgs() == (SFHASH_MD5 | SFHASH_SHA_1 | SFHASH_SHA_2_256));
+}
+
+TEST_CASE("writePatternsToDb") {
+  std::string input = R"(
+  rule myRule {
+    grep:
+      patterns:
+        a = "test" encodings=UTF-8,UTF-16LE
+      condition:
+        any()
+    }
+  rule MyOtherRule {
+    grep:
+      patterns:
+        a = "foobar" fixed
+      condition:
+        any()
+  })";
+  LlamaRuleEngine engine;
+  engine.read(input, "test");
+  LgFsmHolder fsmHolder = engine.buildFsm();
+  LG_ProgramOptions opts{10};
+  std::shared_ptr<ProgramHandle> prog(lg_create_program(fsmHolder.getFsm(), &opts), lg_destroy_program);
+
+  LlamaDB db;
+  LlamaDBConnection conn(db);
+  engine.createTables(conn);
+  engine.writePatternsToDb(conn, prog.get());
+
+  duckdb_result result;
+  auto state = duckdb_query(conn.get(), "SELECT id, pattern, encoding, rule_id FROM patterns ORDER BY id;", &result);
+  REQUIRE(state == DuckDBSuccess);
+  REQUIRE(duckdb_row_count(&result) == 3);
+  for (uint64_t i = 0; i < 3; ++i) {
+    REQUIRE(duckdb_value_uint64(&result, 0, i) == i);
+    char* ruleId = duckdb_value_varchar(&result, 3, i);
+    REQUIRE(engine.patternToRuleId()[i] == ruleId);
+    duckdb_free(ruleId);
+  }
+  duckdb_destroy_result(&result);
+}
@@ -0,0 +1,192 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "llamabatch.h"
+#include "llamaduck.h"
+#include "scancache.h"
+
+#include <hasher/common.h>
+
+#include <filesystem>
+#include <fstream>
+
+namespace {
+  HashRec hashesFor(const std::string& blake3) {
+    return HashRec{0, "md5", "sha1", "", blake3, ""};
+  }
+
+  void createOutputTables(duckdb_connection& conn) {
+    REQUIRE(DBType<SearchHit>::createTable(conn, "search_hits"));
+    REQUIRE(DBType<SearchHitOverflow>::createTable(conn, "search_hits_overflow"));
+  }
+
+  uint64_t countRows(duckdb_connection& conn, const std::string& query) {
+    duckdb_result result;
+    REQUIRE(duckdb_query(conn, query.c_str(), &result) != DuckDBError);
+    const uint64_t n = duckdb_value_uint64(&result, 0, 0);
+    duckdb_destroy_result(&result);
+    return n;
+  }
+
+  void addHit(duckdb_connection& conn, const std::string& fileHash) {
+    DBBatch<SearchHit> hits;
+    hits.add(SearchHit{0, 3, 6, fileHash, 3});
+    LlamaDBAppender appender(conn, "search_hits");
+    hits.copyToDB(appender.get());
+    REQUIRE(appender.flush());
+  }
+}
+
+TEST_CASE("scanCacheRoundTrip") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_scan_cache.db";
+  std::filesystem::remove(path);
+
+  const FileIdentity a{0, 5, 1, 100, "2023-01-01"};
+  const FileIdentity b{0, 6, 1, 200, "2023-01-01"};
+  const uint64_t algs = SFHASH_MD5 | SFHASH_SHA_1 | SFHASH_BLAKE3;
+  {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+
+    ScanCache cache(conn.get(), path.string(), "image", "program");
+    REQUIRE(cache.numCachedFiles() == 0);
+    REQUIRE(!cache.find(a, algs));
+
+    cache.add(a, algs, hashesFor("aaaa"), true);
+    cache.add(b, algs, hashesFor("bbbb"), false);
+    addHit(conn.get(), "aaaa");
+    REQUIRE(countRows(conn.get(), "INSERT INTO search_hits_overflow VALUES (0, 'aaaa', 7);") == 1);
+    cache.finish(conn.get());
+  }
+  {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+
+    ScanCache cache(conn.get(), path.string(), "image", "program");
+    REQUIRE(cache.numCachedFiles() == 2);
+
+    const ScanCache::Entry* e = cache.find(a, algs);
+    REQUIRE(e);
+    REQUIRE(e->Hashes.Blake3 == "aaaa");
+    REQUIRE(e->Hashes.MD5 == "md5");
+    REQUIRE(e->HashAlgs == algs);
+    // fewer hashes will do, but not more
+    REQUIRE(cache.find(a, SFHASH_BLAKE3));
+    REQUIRE(!cache.find(a, algs | SFHASH_SHA_2_256));
+    // a changed file isn't found
+    REQUIRE(!cache.find(FileIdentity{0, 5, 1, 100, "2023-01-02"}, algs));
+
+    REQUIRE(cache.wasSearched("aaaa"));
+    REQUIRE(!cache.wasSearched("bbbb"));
+    cache.add(a, algs, hashesFor("aaaa"), true);
+    cache.finish(conn.get());
+
+    // the hit for aaaa was copied from the cache
+    REQUIRE(countRows(conn.get(), "SELECT COUNT(*) FROM search_hits WHERE file_hash = 'aaaa';") == 1);
+    REQUIRE(countRows(conn.get(), "SELECT SUM(dropped) FROM search_hits_overflow WHERE file_hash = 'aaaa';") == 7);
+  }
+  {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+
+    // only the latest run's files are kept
+    ScanCache cache(conn.get(), path.string(), "image", "program");
+    REQUIRE(cache.numCachedFiles() == 1);
+    REQUIRE(!cache.find(b, algs));
+    cache.finish(conn.get());
+  }
+  {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+
+    // other evidence and other rules share nothing
+    ScanCache cache(conn.get(), path.string(), "other image", "other program");
+    REQUIRE(cache.numCachedFiles() == 0);
+    REQUIRE(!cache.wasSearched("aaaa"));
+    cache.finish(conn.get());
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("scanCacheImageIdentity") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_scan_cache.img";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "some evidence";
+  }
+  const std::string id = ScanCache::imageIdentity(path.string());
+  REQUIRE(id.size() == 64);
+  REQUIRE(id == ScanCache::imageIdentity(path.string()));
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << " and then some";
+  }
+  REQUIRE(id != ScanCache::imageIdentity(path.string()));
+
+  // images alike in size and first 64KiB, as clones of a disk may be
+  const std::string lead(64 << 10, 'x');
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << lead << "one";
+  }
+  const std::string one = ScanCache::imageIdentity(path.string());
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << lead << "two";
+  }
+  REQUIRE(one != ScanCache::imageIdentity(path.string()));
+  std::filesystem::remove(path);
+
+  const std::string dir = std::filesystem::temp_directory_path().string();
+  REQUIRE(ScanCache::imageIdentity(dir) == ScanCache::imageIdentity(dir + "/."));
+}
+
+TEST_CASE("scanCacheKeepsImageIdentity") {
+  const auto path = std::filesystem::temp_directory_path() / "llama_test_scan_cache.db";
+  const auto img = std::filesystem::temp_directory_path() / "llama_test_scan_cache.img";
+  const auto moved = std::filesystem::temp_directory_path() / "llama_test_scan_cache_moved.img";
+  std::filesystem::remove(path);
+  {
+    std::ofstream out(img, std::ios::binary);
+    out << "some evidence";
+  }
+  const std::string id = ScanCache::imageIdentity(img.string());
+
+  auto idInCache = [&](const std::filesystem::path& input) {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+    ScanCache cache(conn.get(), path.string(), ScanCache::Evidence{input.string()}, "program");
+    const std::string ret = cache.imageId();
+    cache.finish(conn.get());
+    return ret;
+  };
+
+  REQUIRE(id == idInCache(img));
+  // the digest is kept for the next run
+  {
+    LlamaDB db;
+    LlamaDBConnection conn(db);
+    createOutputTables(conn.get());
+    ScanCache cache(conn.get(), path.string(), "image", "program");
+    REQUIRE(1 == countRows(conn.get(), "SELECT COUNT(*) FROM scan_cache.images WHERE ImageId = '" + id + "';"));
+    cache.finish(conn.get());
+  }
+
+  // moved, it's read again, and still the same evidence
+  std::filesystem::rename(img, moved);
+  REQUIRE(id == idInCache(moved));
+
+  // changed, it's different evidence
+  {
+    std::ofstream out(moved, std::ios::binary | std::ios::app);
+    out << " and then some";
+  }
+  REQUIRE(id != idInCache(moved));
+
+  std::filesystem::remove(moved);
+  std::filesystem::remove(path);
+}
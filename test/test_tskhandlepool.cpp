@@ -0,0 +1,241 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "blockcache.h"
+#include "dummytsk.h"
+#include "memorybudget.h"
+#include "readseek_impl.h"
+#include "tskhandlepool.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+  int OpenImgs = 0;
+  int OpenFs = 0;
+  int OpenFiles = 0;
+
+  ssize_t fakeRead(TSK_IMG_INFO*, TSK_OFF_T, char*, size_t len) {
+    return len;
+  }
+
+  void closeImg(TSK_IMG_INFO* img) {
+    --OpenImgs;
+    delete img;
+  }
+
+  void closeFs(TSK_FS_INFO* fs) {
+    --OpenFs;
+    delete fs;
+  }
+
+  void closeFile(TSK_FS_FILE* file) {
+    --OpenFiles;
+    delete file->meta;
+    delete file;
+  }
+
+  // opens a new, fake handle each time
+  class HandleTsk: public DummyTsk {
+  public:
+    virtual std::unique_ptr<TSK_IMG_INFO, void(*)(TSK_IMG_INFO*)> openImg(const char*) const override {
+      auto img = new TSK_IMG_INFO;
+      std::memset(img, 0, sizeof(*img));
+      img->size = 1 << 20;
+      img->read = fakeRead;
+      ++OpenImgs;
+      return {img, closeImg};
+    }
+
+    virtual std::unique_ptr<TSK_FS_INFO, void(*)(TSK_FS_INFO*)> openFS(TSK_IMG_INFO* img, TSK_OFF_T off, TSK_FS_TYPE_ENUM type) const override {
+      auto fs = new TSK_FS_INFO;
+      std::memset(fs, 0, sizeof(*fs));
+      fs->img_info = img;
+      fs->offset = off;
+      fs->ftype = type;
+      ++OpenFs;
+      return {fs, closeFs};
+    }
+
+    // empty files, unless sized, so reading them doesn't go to TSK
+    virtual std::unique_ptr<TSK_FS_FILE, void(*)(TSK_FS_FILE*)> openFile(TSK_FS_INFO* fs, TSK_INUM_T inum) const override {
+      auto meta = new TSK_FS_META;
+      std::memset(meta, 0, sizeof(*meta));
+      meta->addr = inum;
+      meta->size = FileSize;
+      auto file = new TSK_FS_FILE{nullptr, meta, fs};
+      ++OpenFiles;
+      OpenedOn.push_back(fs);
+      return {file, closeFile};
+    }
+
+    mutable std::vector<TSK_FS_INFO*> OpenedOn;
+    TSK_OFF_T FileSize = 0;
+  };
+}
+
+TEST_CASE("testTskHandlePoolLendsHandles") {
+  OpenImgs = OpenFs = 0;
+  {
+    TskHandlePool pool("image.E01", std::make_shared<HandleTsk>(), nullptr);
+    TSK_FS_INFO* fs = nullptr;
+    {
+      TskHandlePool::Lease lease(pool.checkout());
+      fs = lease.fs(32256, TSK_FS_TYPE_NTFS);
+      REQUIRE(fs);
+      REQUIRE(32256 == fs->offset);
+      REQUIRE(fs == lease.fs(32256, TSK_FS_TYPE_NTFS));
+
+      // another file system of the image, on the same image handle
+      TSK_FS_INFO* other = lease.fs(1048576, TSK_FS_TYPE_NTFS);
+      REQUIRE(other != fs);
+      REQUIRE(other->img_info == fs->img_info);
+      REQUIRE(1 == OpenImgs);
+
+      // another lease at the same time gets handles of its own
+      TskHandlePool::Lease theirs(pool.checkout());
+      TSK_FS_INFO* theirFs = theirs.fs(32256, TSK_FS_TYPE_NTFS);
+      REQUIRE(theirFs);
+      REQUIRE(theirFs->img_info != fs->img_info);
+      REQUIRE(2 == OpenImgs);
+      REQUIRE(3 == OpenFs);
+      REQUIRE(2u == pool.size());
+    }
+    // only one is kept once both are given back
+    REQUIRE(1u == pool.size());
+    REQUIRE(1u == pool.idle());
+    REQUIRE(1 == OpenImgs);
+
+    // and lent again, from any thread
+    TSK_FS_INFO* again = nullptr;
+    std::thread([&]() {
+      TskHandlePool::Lease lease(pool.checkout());
+      again = lease.fs(32256, TSK_FS_TYPE_NTFS);
+    }).join();
+    REQUIRE(again);
+    REQUIRE(1 == OpenImgs);
+    REQUIRE(1u == pool.idle());
+  }
+  REQUIRE(0 == OpenImgs);
+  REQUIRE(0 == OpenFs);
+}
+
+TEST_CASE("testTskHandlePoolKeepsMaxIdle") {
+  OpenImgs = 0;
+  TskHandlePool pool("image.E01", std::make_shared<HandleTsk>(), nullptr, 2);
+  {
+    std::vector<TskHandlePool::Lease> leases;
+    for (int i = 0; i < 4; ++i) {
+      leases.push_back(pool.checkout());
+      REQUIRE(leases.back().fs(0, TSK_FS_TYPE_NTFS));
+    }
+    REQUIRE(4 == OpenImgs);
+  }
+  REQUIRE(2 == OpenImgs);
+  REQUIRE(2u == pool.idle());
+}
+
+TEST_CASE("testTskHandlePoolChargesBudget") {
+  auto budget = std::make_shared<MemoryBudget>(0);
+  TskHandlePool pool("image.E01", std::make_shared<HandleTsk>(), nullptr, 1);
+  TskHandlePool::Lease kept(pool.checkout());
+  REQUIRE(kept.fs(0, TSK_FS_TYPE_NTFS));
+
+  // handles open already are charged, too
+  pool.setMemoryBudget(budget);
+  REQUIRE(TskHandlePool::HANDLE_BYTES == budget->used());
+  {
+    TskHandlePool::Lease lease(pool.checkout());
+    REQUIRE(lease.fs(0, TSK_FS_TYPE_NTFS));
+    REQUIRE(2 * TskHandlePool::HANDLE_BYTES == budget->used());
+  }
+  // the one kept idle stays charged
+  REQUIRE(2 * TskHandlePool::HANDLE_BYTES == budget->used());
+  {
+    TskHandlePool::Lease extra(std::move(kept));
+  }
+  REQUIRE(TskHandlePool::HANDLE_BYTES == budget->used());
+}
+
+TEST_CASE("testTskHandlePoolSharesCache") {
+  auto cache = std::make_shared<BlockCache>(1 << 20, 4096);
+  TskHandlePool pool("image.E01", std::make_shared<HandleTsk>(), cache);
+  TskHandlePool::Lease mine(pool.checkout());
+  TskHandlePool::Lease theirs(pool.checkout());
+  TSK_FS_INFO* fs = mine.fs(0, TSK_FS_TYPE_EXT4);
+  TSK_FS_INFO* theirFs = nullptr;
+  std::thread([&]() { theirFs = theirs.fs(0, TSK_FS_TYPE_EXT4); }).join();
+
+  char buf[100];
+  REQUIRE(fs->img_info->read != fakeRead);
+  REQUIRE(100 == fs->img_info->read(fs->img_info, 0, buf, sizeof(buf)));
+  REQUIRE(100 == theirFs->img_info->read(theirFs->img_info, 100, buf, sizeof(buf)));
+  REQUIRE(1u == cache->stats().Misses);
+  REQUIRE(1u == cache->stats().Hits);
+}
+
+TEST_CASE("testTskHandlePoolOpenFails") {
+  TskHandlePool pool("image.E01", std::make_shared<DummyTsk>(), nullptr);
+  {
+    TskHandlePool::Lease lease(pool.checkout());
+    REQUIRE(!lease.fs(0, TSK_FS_TYPE_NTFS));
+  }
+  // nothing worth keeping
+  REQUIRE(0u == pool.idle());
+}
+
+TEST_CASE("testReadSeekTSKHoldsHandleUntilClosed") {
+  OpenFiles = 0;
+  auto tsk = std::make_shared<HandleTsk>();
+  auto pool = std::make_shared<TskHandlePool>("image.E01", tsk, nullptr);
+  ReadSeekTSK rs(pool, 32256, TSK_FS_TYPE_NTFS, 42);
+  REQUIRE(42u == rs.getID());
+  REQUIRE(rs.open());
+  REQUIRE(1u == tsk->OpenedOn.size());
+  REQUIRE(0u == pool->idle());
+
+  // read on another thread, as after a hand-off from read-ahead, the file
+  // stays open on the same handle
+  std::thread([&]() {
+    std::vector<uint8_t> buf;
+    rs.read(100, buf);
+    rs.seek(0);
+  }).join();
+  REQUIRE(1u == tsk->OpenedOn.size());
+  REQUIRE(1 == OpenFiles);
+
+  rs.close();
+  REQUIRE(0 == OpenFiles);
+  REQUIRE(1u == pool->idle());
+
+  // the next stream borrows the same handle
+  ReadSeekTSK next(pool, 32256, TSK_FS_TYPE_NTFS, 43);
+  REQUIRE(next.open());
+  REQUIRE(2u == tsk->OpenedOn.size());
+  REQUIRE(tsk->OpenedOn[0] == tsk->OpenedOn[1]);
+  next.close();
+}
+
+TEST_CASE("testReadSeekTSKTellg") {
+  auto tsk = std::make_shared<HandleTsk>();
+  tsk->FileSize = 1000;
+  ReadSeekTSK rs(std::make_shared<TskHandlePool>("image.E01", tsk, nullptr), 0, TSK_FS_TYPE_NTFS, 42);
+  REQUIRE(rs.open());
+  REQUIRE(0u == rs.tellg());
+  REQUIRE(600u == rs.seek(600));
+  REQUIRE(600u == rs.tellg());
+  REQUIRE(1000u == rs.seek(2000));
+  REQUIRE(1000u == rs.tellg());
+}
+
+TEST_CASE("testReadSeekTSKCheapToRereadOnlyWithCache") {
+  auto tsk = std::make_shared<HandleTsk>();
+  // without a cache, reading again decompresses again
+  ReadSeekTSK uncached(std::make_shared<TskHandlePool>("image.E01", tsk, nullptr), 0, TSK_FS_TYPE_NTFS, 42);
+  REQUIRE(uncached.open());
+  REQUIRE(!uncached.cheapToReread());
+
+  ReadSeekTSK cached(std::make_shared<TskHandlePool>("image.E01", tsk, std::make_shared<BlockCache>(1 << 20, 4096)), 0, TSK_FS_TYPE_NTFS, 42);
+  REQUIRE(cached.open());
+  REQUIRE(cached.cheapToReread());
+}
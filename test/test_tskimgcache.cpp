@@ -0,0 +1,53 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "blockcache.h"
+#include "tskimgcache.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+  size_t BackendReads = 0;
+
+  ssize_t fakeBackendRead(TSK_IMG_INFO* img, TSK_OFF_T off, char* buf, size_t len) {
+    ++BackendReads;
+    for (size_t i = 0; i < len; ++i) {
+      buf[i] = char((off + i) % 251);
+    }
+    return off + TSK_OFF_T(len) > img->size ? -1 : ssize_t(len);
+  }
+}
+
+TEST_CASE("testTskImgCache") {
+  TSK_IMG_INFO img;
+  std::memset(&img, 0, sizeof(img));
+  img.size = 100000;
+  img.read = fakeBackendRead;
+  BackendReads = 0;
+
+  auto cache = std::make_shared<BlockCache>(1 << 20, 4096);
+  std::vector<char> buf(1000);
+  {
+    TskImgCache imgCache(&img, cache);
+    REQUIRE(img.read != fakeBackendRead);
+
+    // as tsk_img_read calls it
+    REQUIRE(1000 == img.read(&img, 5000, buf.data(), buf.size()));
+    REQUIRE(char(5000 % 251) == buf[0]);
+    REQUIRE(char(5999 % 251) == buf[999]);
+    REQUIRE(1u == BackendReads);
+
+    REQUIRE(1000 == img.read(&img, 6000, buf.data(), buf.size()));
+    REQUIRE(char(6000 % 251) == buf[0]);
+    REQUIRE(1u == BackendReads);
+
+    // the last block is short, and the backend isn't asked past the end
+    REQUIRE(100 == img.read(&img, 99900, buf.data(), buf.size()));
+    REQUIRE(char(99999 % 251) == buf[99]);
+    REQUIRE(2u == BackendReads);
+
+    REQUIRE(1u == cache->stats().Hits);
+    REQUIRE(2u == cache->stats().Misses);
+  }
+  REQUIRE(img.read == fakeBackendRead);
+}
@@ -305,3 +305,352 @@ TEST_CASE("testInodeDedupe") {
   REQUIRE(2u == in->batch.size());
 }
 */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "dummytsk.h"
+#include "filerecord.h"
+#include "inode.h"
+#include "inputhandler.h"
+
+namespace {
+  // a file system of directories and files, listed in order
+  struct FakeFs {
+    struct Node {
+      TSK_INUM_T Inum;
+      TSK_INUM_T Parent;
+      std::string Name;
+      bool Dir;
+    };
+
+    TSK_OFF_T Offset;
+    TSK_INUM_T First, Last, Root;
+    std::vector<Node> Nodes;
+  };
+
+  void closeImg(TSK_IMG_INFO* img) {
+    delete img;
+  }
+
+  void closeFs(TSK_FS_INFO* fs) {
+    delete fs;
+  }
+
+  // an image with a volume system and a file system in each volume,
+  // walked as TSK would walk it
+  class WalkTsk: public DummyTsk {
+  public:
+    WalkTsk(const std::vector<FakeFs>& fss): Fss(fss) {}
+
+    virtual std::unique_ptr<TSK_IMG_INFO, void(*)(TSK_IMG_INFO*)> openImg(const char*) const override {
+      auto img = new TSK_IMG_INFO;
+      std::memset(img, 0, sizeof(*img));
+      return {img, closeImg};
+    }
+
+    virtual std::unique_ptr<TSK_FS_INFO, void(*)(TSK_FS_INFO*)> openFS(TSK_IMG_INFO* img, TSK_OFF_T off, TSK_FS_TYPE_ENUM type) const override {
+      const FakeFs& f = fsAt(off);
+      auto fs = new TSK_FS_INFO;
+      std::memset(fs, 0, sizeof(*fs));
+      fs->img_info = img;
+      fs->offset = off;
+      fs->ftype = type;
+      fs->first_inum = f.First;
+      fs->last_inum = f.Last;
+      fs->root_inum = f.Root;
+      ++OpenedFs;
+      return {fs, closeFs};
+    }
+
+    virtual bool walk(
+      TSK_IMG_INFO* info,
+      std::function<TSK_FILTER_ENUM(const TSK_VS_INFO*)> vs_cb,
+      std::function<TSK_FILTER_ENUM(const TSK_VS_PART_INFO*)> vol_cb,
+      std::function<TSK_FILTER_ENUM(TSK_FS_INFO*)> fs_cb,
+      std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)>) override
+    {
+      TSK_VS_INFO vs;
+      std::memset(&vs, 0, sizeof(vs));
+      vs_cb(&vs);
+      for (const FakeFs& f : Fss) {
+        TSK_VS_PART_INFO vol;
+        std::memset(&vol, 0, sizeof(vol));
+        vol_cb(&vol);
+        fs_cb(openFS(info, f.Offset, TSK_FS_TYPE_NTFS).get());
+      }
+      return true;
+    }
+
+    virtual bool walkFs(
+      TSK_IMG_INFO* info,
+      TSK_OFF_T off,
+      TSK_FS_TYPE_ENUM type,
+      std::function<TSK_FILTER_ENUM(TSK_FS_INFO*)> fs_cb,
+      std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)> file_cb) override
+    {
+      auto fs = openFS(info, off, type);
+      fs_cb(fs.get());
+      walkTree(fs.get(), fs->root_inum, file_cb);
+      return true;
+    }
+
+    virtual bool listDir(TSK_FS_INFO* fs, TSK_INUM_T inum, std::function<void(TSK_FS_FILE*)> file_cb) const override {
+      {
+        std::lock_guard<std::mutex> lock(Mutex);
+        ListedOn.insert(std::this_thread::get_id());
+      }
+      for (const FakeFs::Node& n : fsAt(fs->offset).Nodes) {
+        if (n.Parent == inum) {
+          // slow enough for the other threads to be waiting for work
+          std::this_thread::sleep_for(std::chrono::microseconds(Delay));
+          visit(fs, n, file_cb);
+        }
+      }
+      return true;
+    }
+
+    jsoncons::json convertImg(const TSK_IMG_INFO&) const override {
+      return jsoncons::json(jsoncons::json_object_arg);
+    }
+
+    jsoncons::json convertVS(const TSK_VS_INFO&) const override {
+      return jsoncons::json(
+        jsoncons::json_object_arg,
+        {
+          { "volumes", jsoncons::json(jsoncons::json_array_arg) }
+        }
+      );
+    }
+
+    jsoncons::json convertVol(const TSK_VS_PART_INFO&) const override {
+      return jsoncons::json(jsoncons::json_object_arg);
+    }
+
+    jsoncons::json convertFS(const TSK_FS_INFO&) const override {
+      return jsoncons::json(jsoncons::json_object_arg);
+    }
+
+    std::unique_ptr<TimestampGetter> makeTimestampGetter(TSK_FS_TYPE_ENUM) const override {
+      ++MadeTimestampGetters;
+      return std::make_unique<CommonTimestampGetter>();
+    }
+
+    unsigned int Delay = 0;
+    mutable std::atomic<unsigned int> OpenedFs{0};
+    mutable std::atomic<unsigned int> MadeTimestampGetters{0};
+    mutable std::mutex Mutex;
+    mutable std::set<std::thread::id> ListedOn;
+
+  private:
+    const FakeFs& fsAt(TSK_OFF_T off) const {
+      for (const FakeFs& f : Fss) {
+        if (f.Offset == off) {
+          return f;
+        }
+      }
+      throw std::runtime_error("no file system there");
+    }
+
+    void visit(TSK_FS_INFO* fs, const FakeFs::Node& n, const std::function<void(TSK_FS_FILE*)>& cb) const {
+      TSK_FS_NAME name;
+      std::memset(&name, 0, sizeof(name));
+      name.name = const_cast<char*>(n.Name.c_str());
+      name.name_size = n.Name.size();
+      name.meta_addr = n.Inum;
+      name.par_addr = n.Parent;
+      name.type = n.Dir ? TSK_FS_NAME_TYPE_DIR : TSK_FS_NAME_TYPE_REG;
+      name.flags = TSK_FS_NAME_FLAG_ALLOC;
+
+      TSK_FS_META meta;
+      std::memset(&meta, 0, sizeof(meta));
+      meta.addr = n.Inum;
+      meta.type = n.Dir ? TSK_FS_META_TYPE_DIR : TSK_FS_META_TYPE_REG;
+      meta.flags = TSK_FS_META_FLAG_ALLOC;
+
+      TSK_FS_FILE file;
+      std::memset(&file, 0, sizeof(file));
+      file.name = &name;
+      file.meta = &meta;
+      file.fs_info = fs;
+      cb(&file);
+    }
+
+    // depth first, each directory's entries before the next entry
+    void walkTree(TSK_FS_INFO* fs, TSK_INUM_T inum, const std::function<TSK_RETVAL_ENUM(TSK_FS_FILE*, const char*)>& file_cb) const {
+      for (const FakeFs::Node& n : fsAt(fs->offset).Nodes) {
+        if (n.Parent == inum) {
+          visit(fs, n, [&](TSK_FS_FILE* file) { file_cb(file, ""); });
+          if (n.Dir) {
+            walkTree(fs, n.Inum, file_cb);
+          }
+        }
+      }
+    }
+
+    std::vector<FakeFs> Fss;
+  };
+
+  // collects what it and its forks are pushed
+  class ForkingInputHandler: public InputHandler {
+  public:
+    struct Pushed {
+      std::mutex Mutex;
+      std::vector<Dirent> Dirents;
+      std::vector<Inode> Inodes;
+      size_t Streams = 0;
+      size_t Forks = 0;
+    };
+
+    ForkingInputHandler(const std::shared_ptr<Pushed>& out = std::make_shared<Pushed>()): Out(out) {}
+
+    virtual void push(const Dirent& d) override {
+      std::lock_guard<std::mutex> lock(Out->Mutex);
+      Out->Dirents.push_back(d);
+    }
+
+    virtual void push(const Inode& i) override {
+      std::lock_guard<std::mutex> lock(Out->Mutex);
+      Out->Inodes.push_back(i);
+    }
+
+    virtual void push(std::unique_ptr<ReadSeek>) override {
+      std::lock_guard<std::mutex> lock(Out->Mutex);
+      ++Out->Streams;
+    }
+
+    virtual void maybeFlush() override {}
+
+    virtual void flush() override {}
+
+    virtual std::shared_ptr<InputHandler> fork() override {
+      std::lock_guard<std::mutex> lock(Out->Mutex);
+      ++Out->Forks;
+      return std::make_shared<ForkingInputHandler>(Out);
+    }
+
+    std::shared_ptr<Pushed> Out;
+  };
+
+  // Windows/notepad.exe, hard linked as Users/notepad.exe, and Users/a.txt,
+  // with inodes numbered from base
+  FakeFs makeFakeFs(TSK_OFF_T off, TSK_INUM_T base) {
+    return FakeFs{off, base, base + 99, base + 5, {
+      {base + 10, base + 5, "Windows", true},
+      {base + 11, base + 10, "notepad.exe", false},
+      {base + 12, base + 5, "Users", true},
+      {base + 13, base + 12, "a.txt", false},
+      {base + 11, base + 12, "notepad.exe", false}
+    }};
+  }
+}
+
+TEST_CASE("testTskReaderWalksFileSystemsOnce") {
+  // three file systems, walked two at a time
+  auto tsk = std::make_shared<WalkTsk>(std::vector<FakeFs>{
+    makeFakeFs(0, 0), makeFakeFs(1 << 20, 100), makeFakeFs(2 << 20, 200)
+  });
+  TskReader reader("bogus.E01", 1, 0, 2, tsk);
+  auto in = std::make_shared<ForkingInputHandler>();
+  reader.setInputHandler(in);
+  REQUIRE(reader.open());
+  REQUIRE(reader.startReading());
+
+  REQUIRE(1u == in->Out->Forks);
+
+  std::multiset<uint64_t> inodes, expInodes;
+  for (const Inode& i : in->Out->Inodes) {
+    inodes.insert(i.Addr);
+  }
+  std::multiset<std::pair<uint64_t, std::string>> dirents, expDirents;
+  for (const Dirent& d : in->Out->Dirents) {
+    dirents.emplace(d.ParentAddr, d.Path);
+  }
+  for (TSK_INUM_T base = 0; base < 300; base += 100) {
+    expInodes.insert({base + 10, base + 11, base + 12, base + 13});
+    expDirents.insert({
+      {base + 5, "Windows"},
+      {base + 10, "Windows/notepad.exe"},
+      {base + 5, "Users"},
+      {base + 12, "Users/a.txt"},
+      {base + 12, "Users/notepad.exe"}
+    });
+  }
+  REQUIRE(expInodes == inodes);
+  REQUIRE(expDirents == dirents);
+  REQUIRE(12u == in->Out->Streams);
+}
+
+namespace {
+  // the dirents and inodes pushed, keyed on what doesn't vary with the
+  // order of the walk
+  struct Walked {
+    std::multiset<std::pair<uint64_t, std::string>> Dirents;
+    std::multiset<uint64_t> Inodes;
+    size_t Streams;
+  };
+
+  Walked walkImage(const std::shared_ptr<TskFacade>& tsk, unsigned int walkThreads) {
+    TskReader reader("bogus.E01", walkThreads, 0, 1, tsk);
+    auto in = std::make_shared<ForkingInputHandler>();
+    reader.setInputHandler(in);
+    REQUIRE(reader.open());
+    REQUIRE(reader.startReading());
+
+    Walked ret{{}, {}, in->Out->Streams};
+    for (const Dirent& d : in->Out->Dirents) {
+      ret.Dirents.emplace(d.ParentAddr, d.Path);
+    }
+    for (const Inode& i : in->Out->Inodes) {
+      ret.Inodes.insert(i.Addr);
+    }
+    return ret;
+  }
+}
+
+TEST_CASE("testTskReaderSplitWalkMatchesWholeWalk") {
+  // four directories, of three directories of five files each, with a
+  // file in the first hard linked into the last
+  FakeFs f{0, 0, 999, 5, {}};
+  TSK_INUM_T inum = 10;
+  for (int i = 0; i < 4; ++i) {
+    const TSK_INUM_T dir = inum++;
+    f.Nodes.push_back({dir, 5, "dir" + std::to_string(i), true});
+    for (int j = 0; j < 3; ++j) {
+      const TSK_INUM_T sub = inum++;
+      f.Nodes.push_back({sub, dir, "sub" + std::to_string(j), true});
+      for (int k = 0; k < 5; ++k) {
+        f.Nodes.push_back({inum++, sub, "file" + std::to_string(k), false});
+      }
+    }
+  }
+  const FakeFs::Node& linked = f.Nodes[2];
+  f.Nodes.push_back({linked.Inum, f.Nodes.back().Parent, "link", false});
+  auto tsk = std::make_shared<WalkTsk>(std::vector<FakeFs>{f});
+
+  const Walked whole = walkImage(tsk, 1);
+  REQUIRE(4u + 4 * 3 + 4 * 3 * 5 + 1 == whole.Dirents.size());
+  REQUIRE(4u + 4 * 3 + 4 * 3 * 5 == whole.Inodes.size());
+  REQUIRE(1u == whole.Inodes.count(linked.Inum));
+  REQUIRE(whole.Dirents.count({f.Nodes.back().Parent, "dir3/sub2/link"}));
+
+  tsk->OpenedFs = 0;
+  tsk->MadeTimestampGetters = 0;
+  tsk->Delay = 500;
+  const Walked split = walkImage(tsk, 4);
+  REQUIRE(whole.Dirents == split.Dirents);
+  REQUIRE(whole.Inodes == split.Inodes);
+  REQUIRE(whole.Streams == split.Streams);
+  // one for finding the file system, and one for each walking thread
+  REQUIRE(tsk->OpenedFs <= 1u + 4);
+  // and the same for the walks, which each thread reuses across directories
+  REQUIRE(tsk->MadeTimestampGetters <= 1u + 4);
+  // the directories were split among the threads
+  REQUIRE(tsk->ListedOn.size() > 1);
+}
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstring>
+#include <optional>
 
 #include "tskreaderhelper.h"
 
@@ -298,3 +299,36 @@ TEST_CASE("testHandleRunsNoSkipDataNoSlack") {
   REQUIRE(exp == jnrd_runs);
 }
 */
+
+TEST_CASE("testFirstDataOffset") {
+  std::array<TSK_FS_ATTR_RUN, 3> run;
+  std::memset(run.data(), 0, sizeof(TSK_FS_ATTR_RUN) * run.size());
+  run[0].next = &run[1];
+  run[1].next = &run[2];
+  run[0].addr = 0;
+  run[0].flags = TSK_FS_ATTR_RUN_FLAG_SPARSE;
+  run[1].addr = 0;
+  run[1].flags = TSK_FS_ATTR_RUN_FLAG_FILLER;
+  run[2].addr = 100;
+  run[2].flags = TSK_FS_ATTR_RUN_FLAG_NONE;
+
+  TSK_FS_ATTR attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.flags = TSK_FS_ATTR_NONRES;
+  attr.nrd.run = &run[0];
+
+  // sparse and filler runs have no data on disk
+  REQUIRE(std::optional<uint64_t>(32256 + 100 * 4096) == TskReaderHelper::firstDataOffset(attr, 32256, 4096));
+
+  // a deleted file's runs may be gone
+  run[2].flags = TSK_FS_ATTR_RUN_FLAG_FILLER;
+  REQUIRE(!TskReaderHelper::firstDataOffset(attr, 32256, 4096));
+  attr.nrd.run = nullptr;
+  REQUIRE(!TskReaderHelper::firstDataOffset(attr, 32256, 4096));
+
+  // resident data is read with the metadata
+  attr.flags = TSK_FS_ATTR_RES;
+  attr.nrd.run = &run[0];
+  run[2].flags = TSK_FS_ATTR_RUN_FLAG_NONE;
+  REQUIRE(!TskReaderHelper::firstDataOffset(attr, 32256, 4096));
+}
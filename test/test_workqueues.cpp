@@ -0,0 +1,133 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "workqueues.h"
+
+#include "filescheduler.h"
+#include "readseek_impl.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("testWorkQueuesHighestPriorityFirst") {
+  WorkQueues<int> queues(1);
+  queues.push(0, 10, 1);
+  queues.push(0, 1000, 2);
+  queues.push(0, 0, 3);
+  queues.push(0, 100, 4);
+  REQUIRE(4u == queues.pending());
+
+  int task = 0;
+  std::vector<int> order;
+  while (queues.pop(0, task)) {
+    order.push_back(task);
+  }
+  REQUIRE(std::vector<int>{2, 4, 1, 3} == order);
+  REQUIRE(0u == queues.pending());
+}
+
+TEST_CASE("testWorkQueuesOwnQueueFirst") {
+  WorkQueues<int> queues(2);
+  queues.push(0, 1, 1);
+  queues.push(1, 1000, 2);
+
+  int task = 0;
+  REQUIRE(queues.pop(0, task));
+  REQUIRE(1 == task);
+}
+
+TEST_CASE("testWorkQueuesSteal") {
+  WorkQueues<int> queues(3);
+  queues.push(1, 5, 1);
+  queues.push(1, 50, 2);
+
+  int task = 0;
+  REQUIRE(queues.pop(0, task));
+  REQUIRE(2 == task); // thieves take the highest priority, too
+  REQUIRE(queues.pop(2, task));
+  REQUIRE(1 == task);
+  REQUIRE(!queues.pop(1, task));
+}
+
+TEST_CASE("testWorkQueuesMoveOnly") {
+  WorkQueues<std::unique_ptr<int>> queues(2);
+  queues.push(1, 7, std::make_unique<int>(7));
+
+  std::unique_ptr<int> task;
+  REQUIRE(queues.pop(0, task));
+  REQUIRE(7 == *task);
+}
+
+TEST_CASE("testWorkQueuesBalance") {
+  // all the work lands on one queue, but every worker gets some of it
+  const size_t numWorkers = 4;
+  WorkQueues<int> queues(numWorkers);
+  for (int i = 0; i < 400; ++i) {
+    queues.push(0, i, int(i));
+  }
+
+  std::atomic<int> sum(0);
+  std::vector<size_t> taken(numWorkers, 0);
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < numWorkers; ++w) {
+    threads.emplace_back([&, w]() {
+      int task = 0;
+      while (queues.pop(w, task)) {
+        sum += task;
+        ++taken[w];
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  REQUIRE(399 * 400 / 2 == sum);
+  REQUIRE(0u == queues.pending());
+  for (size_t w = 0; w < numWorkers; ++w) {
+    REQUIRE(taken[w] > 0);
+  }
+}
+
+TEST_CASE("testWorkQueuesDiskOrder") {
+  // offsets as firstDataOffset() gives them, and a resident file without one
+  const std::vector<std::optional<uint64_t>> offsets{5000, 100, std::nullopt, 70000, 3000};
+  WorkQueues<std::unique_ptr<ReadSeek>> queues(1);
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    auto stream = std::make_unique<ReadSeekBuf>(std::string(i + 1, 'x'));
+    if (offsets[i]) {
+      stream->setDiskOffset(*offsets[i]);
+    }
+    const uint64_t p = FileScheduler::priority(*stream, true);
+    queues.push(0, p, std::move(stream));
+  }
+
+  std::unique_ptr<ReadSeek> stream;
+  std::vector<std::optional<uint64_t>> order;
+  while (queues.pop(0, stream)) {
+    order.push_back(stream->diskOffset());
+  }
+  // resident files are read with their metadata, so they go first
+  REQUIRE(std::vector<std::optional<uint64_t>>{std::nullopt, 100, 3000, 5000, 70000} == order);
+}
+
+TEST_CASE("testWorkQueuesSizeOrder") {
+  WorkQueues<std::unique_ptr<ReadSeek>> queues(1);
+  for (size_t size : {10, 1000, 1, 100}) {
+    auto stream = std::make_unique<ReadSeekBuf>(std::string(size, 'x'));
+    stream->setDiskOffset(size);
+    const uint64_t p = FileScheduler::priority(*stream, false);
+    queues.push(0, p, std::move(stream));
+  }
+
+  std::unique_ptr<ReadSeek> stream;
+  std::vector<size_t> order;
+  while (queues.pop(0, stream)) {
+    order.push_back(stream->size());
+  }
+  REQUIRE(std::vector<size_t>{1000, 100, 10, 1} == order);
+}